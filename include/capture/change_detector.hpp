@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <limits>
+
+#include "capture/task.hpp"
+#include "common/image.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace ChangeDetectorConst {
+        // Change mask is a grid of this many cells in both directions, one bit per cell
+        constexpr int MaskSize = 8;
+
+        // Frames are normalized to this mean luma, so that global brightness changes aren't detected
+        constexpr int NormalizedLuma = 128;
+
+        // Normalization is limited to this factor either way, dark frames would be mostly noise
+        constexpr int MaxGain = 4;
+
+        // Cell is changed if mean absolute luma difference of its pixels exceeds this
+        constexpr float CellThreshold = 12.0f;
+    }
+
+    /*
+    *   Change detection between consecutive frames of a task, on brightness-normalized luma of their thumbnails.
+    *   Frames are split into a coarse grid of cells compared by sum of absolute differences:
+    *   the change mask marks changed cells and the change score is their fraction.
+    */
+    class ChangeDetector {
+    public:
+        // Bit (y * MaskSize + x) is set if cell in column x and row y (from the top left) has changed
+        using Mask = uint64_t;
+        static_assert(ChangeDetectorConst::MaskSize * ChangeDetectorConst::MaskSize == sizeof(Mask) * 8);
+
+        struct Change {
+            float score = std::numeric_limits<float>::quiet_NaN();  // Fraction of changed cells [0; 1], NaN if there is no previous frame
+            Mask mask = 0;
+        };
+
+    private:
+        std::array<Image, Tasks.size()> m_previousFrames;
+
+    public:
+        /// @brief Prepare frame for comparison, may be called concurrently
+        /// @param thumbnail Smallest pyramid level of captured region
+        /// @param height Count of thumbnail rows to compare from the top, the rest (such as info bar) is ignored
+        /// @return Normalized luma of the frame
+        static Image Prepare(const Image& thumbnail, int height);
+
+        /// @brief Compare the frame with the previous frame of the task, and keep it for the next one.
+        ///        Frames of a task have to be passed in capture order
+        /// @param task Captured task
+        /// @param frame Prepared frame
+        /// @return Change against the previous frame, unknown if frame size has changed
+        Change update(TaskId task, const Image& frame);
+
+        /// @brief Check whether the task has a frame to compare with
+        /// @param task The task
+        /// @return True if a frame of the task was passed already
+        inline bool hasPrevious(TaskId task) const {
+            return !m_previousFrames[static_cast<size_t>(task)].is_empty();
+        }
+    };
+}
+
+} // namespace cp
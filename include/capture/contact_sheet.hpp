@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <boost/date_time.hpp>
+namespace dt = boost::gregorian;
+namespace pt = boost::posix_time;
+
+#include <spdlog/spdlog.h>
+
+#include "capture/index.hpp"
+#include "capture/task.hpp"
+#include "common/camera.hpp"
+#include "common/jpeg.hpp"
+#include "common/pyramid.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace ContactSheetConst {
+        // Tasks put on contact sheet of a day
+        inline constexpr std::array<TaskId, 3> SheetTasks = { TaskId::Main, TaskId::Sunrise, TaskId::Sunset };
+
+        constexpr int Columns = 8;
+
+        // Tiles are thumbnail previews of captures
+        constexpr int TileWidth = PyramidConst::ThumbnailWidth;
+        constexpr int TileHeight = (TileWidth * CameraConst::CaptureHeight + CameraConst::CaptureWidth / 2) / CameraConst::CaptureWidth;
+
+        // Space between tiles and around the sheet
+        constexpr int Margin = 8;
+
+        // Timestamp below every tile
+        constexpr int LabelHeight = 28;
+        constexpr int LabelTextSize = 22;
+
+        // Date and capture counts above the tiles
+        constexpr int TitleHeight = 64;
+        constexpr int TitleTextSize = 40;
+
+        constexpr int Quality = 85;
+
+        // Missing contact sheets of this many previous days are generated on start
+        constexpr int CatchUpDays = 7;
+    }
+
+    /*
+    *   Daily contact sheet: all captures of a day composed into a single mosaic with their timestamps,
+    *   so a day is reviewed by fetching one image instead of every capture.
+    *   Sheets are generated from thumbnail previews by a background job once their day is over and are never changed.
+    */
+    class ContactSheet {
+    public:
+        struct Tile {
+            TaskId task;
+            Index::Entry entry;
+        };
+
+    public:
+        /// @brief Find captures of a day to put on its contact sheet
+        /// @param index Capture index
+        /// @param date The day
+        /// @return Tiles ordered by timestamp
+        static std::vector<Tile> Tiles(const Index& index, dt::date date);
+
+        /// @brief Compose contact sheet. Tiles are drawn in parallel, captures without a preview are decoded instead
+        /// @param tiles Tiles of the sheet
+        /// @param date Day of the sheet
+        /// @throw std::runtime_error if text couldn't be rendered
+        /// @return Contact sheet JPEG data
+        static Jpeg::Buffer Generate(const std::vector<Tile>& tiles, dt::date date);
+
+    private:
+        spdlog::logger m_logger;
+        std::shared_ptr<Index> m_index;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        dt::date m_currentDay;
+        bool m_stopping = false;
+        std::thread m_thread;
+
+    public:
+        /// @brief Start contact sheet job
+        /// @param index Capture index
+        ContactSheet(std::shared_ptr<Index> index);
+
+        /// @brief Stop contact sheet job
+        ~ContactSheet();
+
+        ContactSheet(const ContactSheet&) = delete;
+
+        ContactSheet& operator=(const ContactSheet&) = delete;
+
+    private:
+        void contactSheetFunction();
+
+        // Generate and save contact sheet of a day unless it exists, returns false if the day has no captures
+        bool save(dt::date date);
+
+    public:
+        /// @brief Let the job know which day is being captured: contact sheets of previous days are complete
+        /// @param date Current capture day
+        void setCurrentDay(dt::date date);
+    };
+}
+
+} // namespace cp
@@ -1,18 +1,26 @@
 #pragma once
 
-#include <memory>
-#include <deque>
-#include <set>
+#include <cstdint>
+#include <array>
+#include <span>
 #include <string>
 
 #include <boost/date_time.hpp>
 namespace dt = boost::gregorian;
 namespace pt = boost::posix_time;
 
+#include "capture/task.hpp"
+
 namespace cp {
 
 namespace Capture {
     namespace EventConst {
+        /*
+        *   Maximum amount of events that can be generated for one day.
+        *   Main (60), Midnight, Midday, Sunrise, Sunset (4), Day (6) and Night (up to 8) fit with a good margin.
+        */
+        constexpr size_t MaxDailyEvents = 128;
+
         namespace Objects {
             constexpr const char* Name = "name";
             constexpr const char* ShortName = "short_name";
@@ -22,32 +30,27 @@ namespace Capture {
 
     class Event {
     public:
-        using Pointer = std::unique_ptr<Event>;
-
-        using Queue = std::deque<Pointer>;
-
-        using Tasks = std::set<std::string>;
+        // Microseconds since Unix epoch, local time
+        using Timestamp = int64_t;
 
     public:
-        static void Generate(dt::date date, Queue& queue);
-
-        static const Tasks& GetTasks();
+        static void Generate(dt::date date, Schedule& schedule);
 
     private:
-        int m_id = -1;
-        std::string m_name;
-        std::string m_shortName;
-        pt::ptime m_timestamp;
-        Pointer m_overlapping;
+        Timestamp m_timestamp = 0;
+        uint16_t m_id = 0;
+        TaskId m_task = TaskId::Start;
+        uint8_t m_overlapping = 0;  // Count of overlapping events stored right after this one
 
     public:
-        Event(const std::string& name, const std::string& shortName, pt::ptime timestamp);
+        Event() = default;
+
+        Event(TaskId task, pt::ptime timestamp);
 
+        // Load event from legacy JSON event file
         Event(const std::string& filename);
 
     public:
-        void save(const std::string& filename) const;
-
         std::string summary(int length = -1) const;
 
     public:
@@ -55,28 +58,104 @@ namespace Capture {
             return m_id;
         }
 
-        inline int& id() {
-            return m_id;
+        inline void setId(int id) {
+            m_id = static_cast<uint16_t>(id);
         }
 
-        inline const std::string& name() const {
-            return m_name;
+        inline TaskId task() const {
+            return m_task;
         }
 
-        inline const std::string& shortName() const {
-            return m_shortName;
+        inline const char* name() const {
+            return GetTask(m_task).name;
         }
 
-        inline pt::ptime timestamp() const {
+        inline const char* shortName() const {
+            return GetTask(m_task).shortName;
+        }
+
+        inline Timestamp rawTimestamp() const {
             return m_timestamp;
         }
 
-        inline const Pointer& overlapping() const {
+        pt::ptime timestamp() const;
+
+        inline size_t overlapping() const {
             return m_overlapping;
         }
 
-        inline Pointer& overlapping() {
-            return m_overlapping;
+        inline void setOverlapping(size_t overlapping) {
+            m_overlapping = static_cast<uint8_t>(overlapping);
+        }
+    };
+    static_assert(sizeof(Event) == 16, "Event is expected to stay compact");
+
+    /*
+    *   Fixed-capacity contiguous event storage for one day.
+    *   Overlapping events form a group: the group leader is followed by its overlapping events.
+    *   Nothing is allocated after construction, so the same schedule can be reused for any amount of days.
+    */
+    class Schedule {
+    public:
+        using Group = std::span<const Event>;
+
+    private:
+        std::array<Event, EventConst::MaxDailyEvents> m_events;
+        size_t m_begin = 0;
+        size_t m_end = 0;
+
+    public:
+        inline void clear() {
+            m_begin = 0;
+            m_end = 0;
+        }
+
+        void push(TaskId task, pt::ptime timestamp);
+
+        // Sort events by timestamp and assign IDs
+        void sort();
+
+        // Drop events that are not later than timestamp, returns count of dropped events
+        size_t dropUntil(Event::Timestamp timestamp);
+
+        // Group events closer than time reserve, returns count of overlapping events
+        size_t group(int timeReserve);
+
+        void pop();
+
+    public:
+        inline bool empty() const {
+            return m_begin == m_end;
+        }
+
+        // Count of remaining events, including overlapping
+        inline size_t events() const {
+            return m_end - m_begin;
+        }
+
+        // Count of remaining groups
+        size_t size() const;
+
+        Group operator[](size_t index) const;
+
+        inline Group front() const {
+            return (*this)[0];
+        }
+
+        inline Event* begin() {
+            return m_events.data() + m_begin;
+        }
+
+        inline Event* end() {
+            return m_events.data() + m_end;
+        }
+
+        inline const Event* begin() const {
+            return m_events.data() + m_begin;
+        }
+
+        inline const Event* end() const {
+            return m_events.data() + m_end;
         }
     };
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "capture/event.hpp"
+#include "common/mapped_file.hpp"
+#include "common/scene.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace IndexConst {
+        // Index file of a task is "<capture directory>/<task directory>.index"
+        constexpr const char* IndexExtension = "index";
+
+        // "CPI1" as little-endian 32-bit integer
+        constexpr uint32_t Magic = 0x31495043;
+        constexpr uint32_t Version = 2;
+
+        // Entries of version 1 have no frame analysis and are a prefix of the current entry, such files are migrated in place
+        constexpr uint32_t LegacyVersion = 1;
+        constexpr size_t LegacyEntrySize = 32;
+
+        constexpr size_t HeaderSize = 32;
+
+        // Index files grow by this amount of entries to avoid remapping on every append
+        constexpr size_t GrowthEntries = 1024;
+
+        // Maximum amount of entries returned by one query
+        constexpr size_t MaxQueryLimit = 1000;
+    }
+
+    /*
+    *   Sorted memory-mapped index of captures, one file per task.
+    *   Entries are fixed-size and ordered by timestamp, so range queries are binary searches over the mapping.
+    *   The index is maintained incrementally as captures are saved and can always be restored from capture journal.
+    */
+    class Index {
+    public:
+        struct Entry {
+            Event::Timestamp timestamp = 0; // Event timestamp
+            uint64_t size = 0;              // Capture size in bytes
+            uint64_t offset = 0;            // Offset of capture data inside its file, 0 for standalone capture files
+            float meanLuma = 0.0f;          // Mean luma of the frame [0; 255]
+            float clipped = 0.0f;           // Fraction of clipped (overexposed) pixels [0; 1]
+            float skyLuma = std::numeric_limits<float>::quiet_NaN();            // See Scene::Metrics, NaN if not measured
+            float cloudCover = std::numeric_limits<float>::quiet_NaN();
+            float colorTemperature = std::numeric_limits<float>::quiet_NaN();
+            float gain = std::numeric_limits<float>::quiet_NaN();               // See Stabilizer::Correction, NaN if not computed
+            float shiftX = std::numeric_limits<float>::quiet_NaN();
+            float shiftY = std::numeric_limits<float>::quiet_NaN();
+            float change = std::numeric_limits<float>::quiet_NaN();              // See ChangeDetector::Change, NaN if not detected
+            uint32_t reserved = 0;
+            uint64_t changeMask = 0;
+        };
+        static_assert(sizeof(Entry) == 72, "Index entry size is a part of index file format");
+
+        // Entries not passing the filter are skipped by queries
+        using Filter = std::function<bool(const Entry& entry)>;
+
+        struct QueryResult {
+            size_t total = 0;               // Count of entries in requested range
+            std::vector<Entry> entries;     // Requested page of entries
+        };
+
+    private:
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t entrySize;
+            uint32_t reserved;
+            uint64_t count;
+            uint64_t padding;
+        };
+        static_assert(sizeof(Header) == IndexConst::HeaderSize, "Index header size is a part of index file format");
+
+    private:
+        spdlog::logger m_logger;
+        mutable std::mutex m_mutex;
+        std::array<std::unique_ptr<MappedFile>, Tasks.size()> m_files;
+
+    public:
+        /// @brief Open (or create) index files of all captured tasks
+        /// @param directory Capture directory
+        /// @throw std::runtime_error if an index file couldn't be opened
+        Index(const std::string& directory);
+
+    private:
+        // Convert index file of earlier version to the current format, the file has to be valid
+        void migrate(MappedFile& file);
+
+        Header& header(TaskId task) const;
+
+        Entry* entries(TaskId task) const;
+
+    public:
+        /// @brief Add capture to the index
+        /// @param task Captured task
+        /// @param entry Capture entry
+        void append(TaskId task, const Entry& entry);
+
+        /// @brief Replace entry of a capture
+        /// @param task Captured task
+        /// @param entry New capture entry, matched by its timestamp
+        /// @return True if the capture was found
+        bool update(TaskId task, const Entry& entry);
+
+        /// @brief Remove capture from the index
+        /// @param task Captured task
+        /// @param timestamp Capture timestamp
+        /// @return True if the capture was found
+        bool erase(TaskId task, Event::Timestamp timestamp);
+
+        /// @brief Add captures present in capture journal, but missing from the index.
+        ///        Recompressed and removed captures are updated
+        /// @param journalPath Capture journal path
+        /// @return Count of added entries
+        size_t synchronize(const std::string& journalPath);
+
+        /// @brief Find capture of a task
+        /// @param task The task
+        /// @param timestamp Capture timestamp
+        /// @return The entry, if the capture is indexed
+        std::optional<Entry> find(TaskId task, Event::Timestamp timestamp) const;
+
+        /// @brief Get the latest capture of a task
+        /// @param task The task
+        /// @return The latest entry, if the task has any
+        std::optional<Entry> last(TaskId task) const;
+
+        /// @brief Find captures of a task in time range
+        /// @param task The task
+        /// @param from Range start (inclusive)
+        /// @param to Range end (inclusive)
+        /// @param offset Count of entries in range to skip
+        /// @param limit Maximum count of entries to return
+        /// @param filter Optional filter, the total and the offset only count entries passing it
+        /// @return Query result
+        QueryResult query(TaskId task, Event::Timestamp from, Event::Timestamp to, size_t offset, size_t limit, const Filter& filter = {}) const;
+    };
+}
+
+} // namespace cp
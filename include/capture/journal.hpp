@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "capture/event.hpp"
+#include "sensors/recorder.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace JournalConst {
+        constexpr const char* JournalFile = "capture.journal";
+
+        // "CPJ1" as little-endian 32-bit integer
+        constexpr uint32_t Magic = 0x314A5043;
+        constexpr uint32_t Version = 1;
+
+        // Magic and version
+        constexpr size_t HeaderSize = sizeof(uint32_t) * 2;
+
+        // Payload length, CRC-32 and payload length again, so the file can be read from its tail
+        constexpr size_t FramingSize = sizeof(uint32_t) * 3;
+
+        // Records larger than this are considered corrupted
+        constexpr uint32_t MaxPayloadSize = 64 * 1024;
+    }
+
+    /*
+    *   Append-only, checksummed capture journal.
+    *   Records are buffered by append() and written with one write and one fsync by commit().
+    *   Every record is framed as [length][payload][crc32][length]: the last record is found by reading the file tail,
+    *   and a torn write on power loss is detected by CRC and truncated away on the next start.
+    *   Records may be appended from several threads.
+    */
+    class Journal {
+    public:
+        enum class RecordType : uint8_t {
+            Start,          // Capture filesystem was created (or migrated from legacy last event file)
+            Capture,        // Event was captured
+            Expired,        // Event expired and wasn't captured
+            Recompressed,   // Capture was recompressed by retention, size and location are updated
+            Removed,        // Capture was deleted by retention
+        };
+
+        // Capture stage timings in microseconds
+        struct Timings {
+            uint32_t capture = 0;   // Camera exposure and readout, including info bar rendering
+            uint32_t save = 0;      // Encoding of the capture and handing it over to storage
+        };
+
+        struct Record {
+            RecordType type = RecordType::Start;
+            TaskId task = TaskId::Start;
+            uint16_t id = 0;
+            Event::Timestamp scheduled = 0;     // Event timestamp
+            Event::Timestamp actual = 0;        // Moment capture was made, 0 if not captured
+            uint64_t size = 0;                  // Capture size in bytes
+            Timings timings;
+            std::optional<Sensors::Recorder::Record> sensors;
+            std::string path;                   // Capture or pack file path relative to working directory
+            uint64_t offset = 0;                // Offset of capture data inside pack file, 0 for standalone capture files
+            uint8_t quality = 0;                // JPEG quality the capture was encoded with
+
+            Event event() const;
+        };
+
+    public:
+        /// @brief Read all valid records of a journal in order
+        /// @param filePath Journal file path
+        /// @param callback Function called for every record
+        /// @throw std::runtime_error if journal file couldn't be opened or its header is invalid
+        static void Read(const std::string& filePath, const std::function<void(const Record&)>& callback);
+
+    private:
+        spdlog::logger m_logger;
+        std::string m_filePath;
+        mutable std::mutex m_mutex;
+        std::FILE* m_file = nullptr;
+        std::vector<uint8_t> m_pending;
+        size_t m_pendingRecords = 0;
+        std::optional<Record> m_last;
+
+    public:
+        /// @brief Open journal, recover its last event record and truncate torn tail if there is one
+        /// @param filePath Journal file path
+        /// @throw std::runtime_error if journal file couldn't be opened or its header is invalid
+        Journal(const std::string& filePath);
+
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+
+        Journal& operator=(const Journal&) = delete;
+
+    private:
+        void recover();
+
+        // Close the journal, truncate it to its size before a failed commit and open it again
+        void rollback(uint64_t size);
+
+    public:
+        /// @brief Buffer record to be written by the next commit
+        /// @param record The record to append
+        void append(const Record& record);
+
+        /// @brief Write all buffered records and flush them to storage
+        /// @throw std::runtime_error if records couldn't be written
+        void commit();
+
+    public:
+        // Last appended event record (start, capture or expiration), if the journal has any
+        inline std::optional<Record> last() const {
+            std::lock_guard lock(m_mutex);
+            return m_last;
+        }
+    };
+}
+
+} // namespace cp
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+
+#include <boost/date_time.hpp>
+namespace dt = boost::gregorian;
+namespace pt = boost::posix_time;
+
+#include <spdlog/spdlog.h>
+
+#include "capture/task.hpp"
+#include "common/config.hpp"
+#include "common/pyramid.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace LayoutConst {
+        constexpr const char* CaptureDirectory = "Capture";
+        constexpr const char* CaptureExtension = "jpeg";
+        constexpr const char* PackExtension = "pack";
+
+        // Previews are kept apart from captures, in "<capture directory>/<preview directory>/<task directory>/YYYY/MM/DD/"
+        constexpr const char* PreviewDirectory = "Previews";
+
+        // Contact sheets of days are "<capture directory>/<contact sheet directory>/YYYY.MM.DD.jpeg"
+        constexpr const char* ContactSheetDirectory = "ContactSheets";
+    }
+
+    namespace Layout {
+        struct MigrationResult {
+            size_t moved = 0;       // Count of moved capture files
+            size_t skipped = 0;     // Count of files that aren't captures
+            size_t failed = 0;      // Count of capture files that couldn't be moved
+        };
+
+        /// @brief Get directory of a task
+        /// @param task The task
+        /// @return Task directory path relative to working directory
+        std::string TaskDirectory(TaskId task);
+
+        /// @brief Get capture file path of a task event in configured layout
+        /// @param task The task
+        /// @param timestamp Event timestamp
+        /// @return Capture file path relative to working directory
+        std::string CapturePath(TaskId task, pt::ptime timestamp);
+
+        /// @brief Get capture file path of a task event
+        /// @param layout Capture directory layout
+        /// @param task The task
+        /// @param timestamp Event timestamp
+        /// @return Capture file path relative to working directory
+        std::string CapturePath(Config::CaptureLayout layout, TaskId task, pt::ptime timestamp);
+
+        /// @brief Get pack file path of a task day in configured layout
+        /// @param task The task
+        /// @param date Pack day
+        /// @return Pack file path relative to working directory
+        std::string PackPath(TaskId task, dt::date date);
+
+        /// @brief Get pack file path of a task day
+        /// @param layout Capture directory layout
+        /// @param task The task
+        /// @param date Pack day
+        /// @return Pack file path relative to working directory
+        std::string PackPath(Config::CaptureLayout layout, TaskId task, dt::date date);
+
+        /// @brief Get preview directory of a task day. Previews are sharded by day in every layout
+        /// @param task The task
+        /// @param date Preview day
+        /// @return Preview directory path relative to working directory
+        std::string PreviewDayDirectory(TaskId task, dt::date date);
+
+        /// @brief Get preview file path of a task event
+        /// @param task The task
+        /// @param timestamp Event timestamp
+        /// @param level Pyramid level of the preview
+        /// @return Preview file path relative to working directory
+        std::string PreviewPath(TaskId task, pt::ptime timestamp, Pyramid::Level level);
+
+        /// @brief Get contact sheet file path of a day
+        /// @param date The day
+        /// @return Contact sheet file path relative to working directory
+        std::string ContactSheetPath(dt::date date);
+
+        /// @brief Move existing capture and pack files to another layout. Capture master must not be running
+        /// @param layout Target layout
+        /// @param logger Logger to report progress to
+        /// @return Migration result
+        MigrationResult Migrate(Config::CaptureLayout layout, spdlog::logger& logger);
+    }
+}
+
+} // namespace cp
@@ -1,22 +1,42 @@
 #pragma once
 
+#include <array>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 #include <condition_variable>
 
+#include <boost/asio/thread_pool.hpp>
+namespace asio = boost::asio;
+
 #include <spdlog/spdlog.h>
 
+#include "capture/change_detector.hpp"
+#include "capture/contact_sheet.hpp"
 #include "capture/event.hpp"
+#include "capture/index.hpp"
+#include "capture/journal.hpp"
+#include "capture/layout.hpp"
+#include "capture/rate_control.hpp"
+#include "capture/retention.hpp"
+#include "capture/stabilizer.hpp"
+#include "capture/storage.hpp"
+#include "capture/timelapse.hpp"
+#include "capture/viewfinder.hpp"
 #include "common/camera.hpp"
+#include "common/jpeg.hpp"
 #include "display/ui.hpp"
+#include "sensors/recorder.hpp"
 
 namespace cp {
 
 namespace Capture {
     namespace MasterConst {
-        constexpr const char* CaptureDirectory = "Capture";
-        constexpr const char* LastEventFile = "last.event";
+        // Last event file used before capture journal, read once for migration
+        constexpr const char* LegacyLastEventFile = "last.event";
     }
 
     class Master {
@@ -36,19 +56,43 @@ namespace Capture {
             size_t expired = 0;
         };
 
+        struct LatestCapture {
+            TaskId task = TaskId::Start;
+            Event::Timestamp timestamp = 0;     // Event timestamp
+            Jpeg::SharedBuffer data;            // Encoded capture, shared with storage and never modified
+        };
+
         struct CaptureResult {
             size_t eventsCaptured = 0;  // Count of events captured (including overlapped events)
             size_t timeElapsed = 0;     // Amount of time it took to make the capture in milliseconds
-            size_t savedSize = 0;       // Total size of created capture file(s) in bytes
+            size_t savedSize = 0;       // Total size of capture(s) handed over to storage in bytes
         };
 
     private:
         spdlog::logger m_logger;
         Display::Ui::Pointer m_displayUi;
-        Camera m_camera;
+        std::vector<Camera::Pointer> m_cameras;
+        std::vector<std::unique_ptr<Viewfinder>> m_viewfinders;
         GenerationResult m_lastGenerationResult;
-        Event::Queue m_queue;
-        Event::Pointer m_lastEvent;
+        Schedule m_queue;
+        Event m_lastEvent;
+        std::unique_ptr<Journal> m_journal;
+        std::unique_ptr<Storage> m_storage;
+        RateControl m_rateControl;
+        Stabilizer m_stabilizer;
+        ChangeDetector m_changeDetector;
+        std::unique_ptr<Timelapse> m_timelapse;
+        std::shared_ptr<Index> m_index;
+        std::unique_ptr<Retention> m_retention;
+        std::unique_ptr<ContactSheet> m_contactSheet;
+        std::array<std::optional<LatestCapture>, Tasks.size()> m_latestCaptures;
+        std::optional<LatestCapture> m_latestCapture;
+
+        // Sensors snapshot of the next capture, kept until it's finished so that it never blocks capture thread
+        std::future<Sensors::Recorder::Record> m_snapshot;
+
+        // Encodes captures and previews of all cameras
+        asio::thread_pool m_workers;
 
         mutable std::mutex m_mutex;
         std::thread m_thread;
@@ -65,7 +109,14 @@ namespace Capture {
 
         bool sleepToTimestamp(pt::ptime timestamp, bool subtractTimeReserve = false);
 
-        CaptureResult capture(Event::Pointer&& event, bool expired = false);
+        // Sensors snapshot is used if it's finished by the capture, the last recorded measurement otherwise
+        CaptureResult capture(Schedule::Group group);
+
+        // Journal group as expired without capturing, returns count of expired events
+        size_t expire(Schedule::Group group);
+
+        // Expire everything missed since the last event and generate queue for today
+        void catchUp();
 
         void generateEvents(dt::date date);
 
@@ -77,6 +128,32 @@ namespace Capture {
             return m_threadStatus == ThreadStatus::Running;
         };
 
+        // Capture index, empty until capture thread has opened it
+        inline std::shared_ptr<const Index> index() const {
+            std::lock_guard lock(m_mutex);
+            return m_index;
+        }
+
+        /// @brief Get the latest capture made since capture master was started
+        /// @param task Captured task, the latest capture of any task if empty
+        /// @return The capture, if there is one
+        inline std::optional<LatestCapture> latestCapture(std::optional<TaskId> task = {}) const {
+            std::lock_guard lock(m_mutex);
+            return task ? m_latestCaptures[static_cast<size_t>(*task)] : m_latestCapture;
+        }
+
+        /// @brief Find viewfinder of a camera
+        /// @param camera Camera name, the first camera if empty
+        /// @return The viewfinder, nullptr if there is no such camera
+        inline Viewfinder* viewfinder(const std::string& camera = {}) const {
+            for (const std::unique_ptr<Viewfinder>& viewfinder : m_viewfinders) {
+                if (camera.empty() || viewfinder->camera().name() == camera) {
+                    return viewfinder.get();
+                }
+            }
+            return nullptr;
+        }
+
         void enable(bool blocking = false);
 
         void disable();
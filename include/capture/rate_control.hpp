@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+
+#include "capture/task.hpp"
+#include "common/image.hpp"
+#include "common/jpeg.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace RateControlConst {
+        // Quality range rate control chooses from
+        constexpr int MinQuality = 30;
+        constexpr int MaxQuality = JpegConst::DefaultQuality;
+
+        // Size of sampled tiles, a multiple of 16 so that tiles are aligned to JPEG MCUs
+        constexpr int TileSize = 32;
+
+        // Every TileStep-th tile of every TileStep-th row is sampled: 1/36 of the frame
+        constexpr int TileStep = 6;
+
+        // Weight of the last frame in calibration factor
+        constexpr double CalibrationWeight = 0.5;
+    }
+
+    /*
+    *   JPEG rate control: picks the highest quality that keeps capture within its target size.
+    *   Full-resolution tiles sampled from the frame are assembled into a small mosaic that is encoded at candidate qualities.
+    *   Mosaic estimation is corrected by a per-task calibration factor learned from the sizes of previous frames,
+    *   so the frame itself is encoded only once.
+    */
+    class RateControl {
+    public:
+        struct Result {
+            Jpeg::Buffer data;          // Encoded frame
+            int quality = 0;            // Chosen quality
+            size_t predictedSize = 0;   // Size the frame was expected to have
+        };
+
+    private:
+        std::array<double, Tasks.size()> m_calibration;
+
+    public:
+        RateControl();
+
+    public:
+        /// @brief Encode frame within target size
+        /// @param task Captured task, every task has its own calibration
+        /// @param image Frame to encode
+        /// @param targetSize Target size in bytes
+        /// @throw std::runtime_error if the frame couldn't be encoded
+        /// @return Encoding result
+        Result encode(TaskId task, const Image& image, size_t targetSize);
+
+        /// @brief Encode frame region within target size, the region is sampled and encoded straight from the frame
+        /// @param task Captured task, every task has its own calibration
+        /// @param image The frame
+        /// @param region Region to encode, has to lie within the frame
+        /// @param targetSize Target size in bytes
+        /// @throw std::invalid_argument if the region doesn't lie within the frame
+        /// @throw std::runtime_error if the region couldn't be encoded
+        /// @return Encoding result
+        Result encode(TaskId task, const Image& image, const Region& region, size_t targetSize);
+    };
+}
+
+} // namespace cp
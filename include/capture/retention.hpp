@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <boost/date_time.hpp>
+namespace dt = boost::gregorian;
+namespace pt = boost::posix_time;
+
+#include <spdlog/spdlog.h>
+
+#include "capture/index.hpp"
+#include "capture/journal.hpp"
+#include "common/config.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace RetentionConst {
+        // Last recompressed capture of every task, "<capture directory>/<state file>"
+        constexpr const char* StateFile = "retention.json";
+
+        // Retention pass is repeated with this interval in seconds
+        constexpr double RunInterval = 6 * 60 * 60;
+
+        // Share of time the job works, it sleeps the rest
+        constexpr double WorkShare = 0.25;
+
+        // Maximum average write rate in bytes per second
+        constexpr double MaxWriteRate = 2.0 * 1024 * 1024;
+
+        // The job stops this amount of seconds before the next capture (in addition to time reserve)
+        constexpr int QuietPeriod = 60;
+    }
+
+    /*
+    *   Background job applying per-task retention policies: old captures are recompressed and then deleted,
+    *   either at a fixed age or once they are in timelapse of their task.
+    *   It runs with the lowest CPU and I/O priority, sleeps to stay within its CPU and write budget
+    *   and doesn't work around scheduled captures at all.
+    */
+    class Retention {
+    public:
+        struct Report {
+            size_t recompressed = 0;    // Count of recompressed captures
+            size_t removed = 0;         // Count of deleted captures
+            uint64_t reclaimed = 0;     // Reclaimed space in bytes
+        };
+
+    private:
+        spdlog::logger m_logger;
+        std::shared_ptr<Index> m_index;
+        Journal& m_journal;
+        std::array<Event::Timestamp, Tasks.size()> m_recompressed = {};
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        pt::ptime m_nextCapture;
+        bool m_stopping = false;
+        std::thread m_thread;
+
+    public:
+        /// @brief Start retention job
+        /// @param index Capture index
+        /// @param journal Capture journal to record recompressed and deleted captures to
+        Retention(std::shared_ptr<Index> index, Journal& journal);
+
+        /// @brief Stop retention job
+        ~Retention();
+
+    private:
+        void retentionFunction();
+
+        // Wait until there is enough time before the next capture, returns false if the job is stopping
+        bool waitForWindow();
+
+        // Sleep unless the job is stopping, returns false if it is
+        bool rest(double seconds);
+
+        void loadState();
+
+        void saveState();
+
+        // Remove captures between the timestamps (inclusive), returns false if the job is stopping
+        bool removeCaptures(TaskId task, Event::Timestamp from, Event::Timestamp to, Report& report);
+
+        // Returns false if the job is stopping
+        bool removeTimelapsed(TaskId task, const Config::RetentionPolicy& policy, Report& report);
+
+        // Returns false if the job is stopping
+        bool recompressCaptures(TaskId task, const Config::RetentionPolicy& policy, Report& report);
+
+        // Returns false if the job is stopping
+        bool recompressDay(TaskId task, const Config::RetentionPolicy& policy, const std::vector<Index::Entry>& entries, Report& report);
+
+    public:
+        /// @brief Let the job know when the next capture is. It doesn't work until this is called
+        /// @param timestamp Next capture timestamp
+        void setNextCapture(pt::ptime timestamp);
+    };
+}
+
+} // namespace cp
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <complex>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "capture/task.hpp"
+#include "common/image.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace StabilizerConst {
+        // Frames are correlated at this resolution at most, it's a power of two
+        constexpr int CorrelationSize = 128;
+
+        // Smaller frames can't be correlated reliably
+        constexpr int MinCorrelationSize = 16;
+
+        // Reference follows about this many last frames of a task
+        constexpr int ReferenceFrames = 8;
+
+        // Brightness correction is limited to this factor either way
+        constexpr float MaxGain = 2.0f;
+
+        // Darker frames are mostly noise, they are neither corrected nor followed by the reference
+        constexpr float MinLuma = 10.0f;
+    }
+
+    /*
+    *   Timelapse deflicker and stabilization parameters, computed incrementally as frames are captured.
+    *   Every task has a rolling reference: exponential average of its last frames' brightness and spectra.
+    *   A frame's brightness correction is the gain bringing it to the reference brightness,
+    *   its translation is found by phase correlation with the reference spectrum.
+    *   Following the reference, the parameters remove flicker and jitter, but keep slow changes of the scene.
+    */
+    class Stabilizer {
+    public:
+        // Luma spectrum of a frame, analyzed by capture workers concurrently
+        struct Frame {
+            int width = 0;                                  // Correlation size, powers of two
+            int height = 0;
+            float scaleX = 0.0f;                            // Captured pixels per correlation pixel
+            float scaleY = 0.0f;
+            float meanLuma = 0.0f;
+            std::vector<std::complex<float>> spectrum;      // Empty if the frame is too small
+        };
+
+        struct Correction {
+            float gain = std::numeric_limits<float>::quiet_NaN();    // Brightness multiplier, NaN if frame is too dark
+            float shiftX = std::numeric_limits<float>::quiet_NaN();  // Translation of the frame against the reference in captured pixels,
+            float shiftY = std::numeric_limits<float>::quiet_NaN();  // NaN if unknown. Frame is stabilized by shifting it back
+        };
+
+    private:
+        struct Reference {
+            int width = 0;
+            int height = 0;
+            double logLuma = std::numeric_limits<double>::quiet_NaN();
+            std::vector<std::complex<float>> spectrum;
+        };
+
+    private:
+        std::array<std::optional<Reference>, Tasks.size()> m_references;
+        std::array<bool, Tasks.size()> m_passed = {};
+
+    public:
+        /// @brief Analyze a frame, may be called concurrently
+        /// @param thumbnail Smallest pyramid level of captured region
+        /// @param height Count of thumbnail rows to analyze from the top, the rest (such as info bar) is ignored
+        /// @param region Captured region
+        /// @return Frame analysis
+        static Frame Analyze(const Image& thumbnail, int height, const Region& region);
+
+        /// @brief Calculate correction of the frame and move task reference towards it.
+        ///        Frames of a task have to be passed in capture order
+        /// @param task Captured task
+        /// @param frame Frame analysis
+        /// @return Frame correction, the first frame of a task becomes the reference and is left as it is
+        Correction update(TaskId task, const Frame& frame);
+
+        /// @brief Check whether the task has frames passed already, even if they were too dark to be followed
+        /// @param task The task
+        /// @return True if a frame of the task was passed already
+        inline bool hasPrevious(TaskId task) const {
+            return m_passed[static_cast<size_t>(task)];
+        }
+    };
+}
+
+} // namespace cp
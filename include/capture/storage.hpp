@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <array>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <boost/date_time.hpp>
+namespace dt = boost::gregorian;
+namespace pt = boost::posix_time;
+
+#include <spdlog/spdlog.h>
+
+#include "capture/index.hpp"
+#include "capture/task.hpp"
+#include "common/config.hpp"
+#include "common/file_writer.hpp"
+#include "common/jpeg.hpp"
+#include "common/pyramid.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace StorageConst {
+        // "CPK1" as little-endian 32-bit integer
+        constexpr uint32_t PackMagic = 0x314B5043;
+        constexpr uint32_t PackVersion = 1;
+
+        // Magic, version, task and reserved field
+        constexpr size_t PackHeaderSize = 16;
+
+        // "CPF1" as little-endian 32-bit integer, precedes every frame so that unsealed packs can be scanned
+        constexpr uint32_t FrameMagic = 0x31465043;
+
+        // Magic, frame size and event timestamp
+        constexpr size_t FrameHeaderSize = 16;
+
+        // Event timestamp, frame data offset and size
+        constexpr size_t PackEntrySize = 24;
+
+        // "CPX1" as little-endian 32-bit integer, ends sealed packs
+        constexpr uint32_t TrailerMagic = 0x31585043;
+
+        // Magic, entry count and trailing index offset
+        constexpr size_t TrailerSize = 16;
+
+        // Previews are only looked at, they don't need capture quality
+        constexpr int PreviewQuality = 85;
+    }
+
+    /*
+    *   Capture storage, either standalone JPEG files or per-day pack files of every task.
+    *   Captures are saved in background by file writer: save() only buffers them and commit() hands them over,
+    *   its completion is called once they are durable. flush() waits for that instead.
+    *   Pack file is [header][frame header][JPEG]...[frame header][JPEG], frames are only appended.
+    *   Once its day is over, the pack is sealed: trailing index of its frames and a trailer are appended,
+    *   so the file never changes again and can be backed up as one sequential file.
+    *   Index entries of packed captures point directly at JPEG data, no extraction is needed to read them.
+    *   Previews of captures are standalone JPEG files in every storage type, one directory per task day.
+    */
+    class Storage {
+    public:
+        struct Location {
+            std::string path;       // Capture or pack file path relative to working directory
+            uint64_t offset = 0;    // Offset of capture data inside pack file, 0 for standalone capture files
+            uint64_t size = 0;      // Capture size in bytes
+        };
+
+        // Encoded previews, one per pyramid level
+        using Previews = std::array<Jpeg::SharedBuffer, Pyramid::LevelCount>;
+
+        // Called by the writer thread once captures of a commit are durable, with locations of those that couldn't be saved
+        using Completion = std::function<void(std::vector<Location> failed)>;
+
+    private:
+        // Trailing index entry of sealed packs
+        struct PackEntry {
+            Event::Timestamp timestamp;
+            uint64_t offset;
+            uint64_t size;
+        };
+        static_assert(sizeof(PackEntry) == StorageConst::PackEntrySize, "Pack entry size is a part of pack file format");
+
+        struct Pack {
+            dt::date date;
+            std::string path;
+            bool open = false;
+            uint64_t size = 0;
+            std::vector<PackEntry> entries;
+        };
+
+    public:
+        /*
+        *   Writer of a replacement for an existing pack, used to recompress captures of a sealed pack.
+        *   The new pack is written under temporary name and is sealed and put in place of the old one by finish().
+        */
+        class PackRewriter {
+        private:
+            std::string m_path;
+            std::string m_temporaryPath;
+            std::FILE* m_file = nullptr;
+            uint64_t m_size = 0;
+            std::vector<PackEntry> m_entries;
+
+        public:
+            /// @brief Create temporary pack
+            /// @param task Task of the pack
+            /// @param path Path of the pack to replace
+            /// @throw std::runtime_error if temporary pack couldn't be created
+            PackRewriter(TaskId task, const std::string& path);
+
+            /// @brief Remove temporary pack if it wasn't finished
+            ~PackRewriter();
+
+            PackRewriter(const PackRewriter&) = delete;
+
+            PackRewriter& operator=(const PackRewriter&) = delete;
+
+        public:
+            /// @brief Append capture to the new pack
+            /// @param timestamp Event timestamp
+            /// @param data Capture JPEG data
+            /// @throw std::runtime_error if capture couldn't be written
+            /// @return Location of the capture in the new pack
+            Location append(Event::Timestamp timestamp, const Jpeg::Buffer& data);
+
+            /// @brief Seal the new pack, flush it and replace the old one
+            /// @throw std::runtime_error if the pack couldn't be sealed or replaced
+            void finish();
+        };
+
+    public:
+        /// @brief Get path of the file containing a capture
+        /// @param task Captured task
+        /// @param entry Capture index entry
+        /// @return Capture or pack file path relative to working directory
+        static std::string Path(TaskId task, const Index::Entry& entry);
+
+        /// @brief Read capture data
+        /// @param task Captured task
+        /// @param entry Capture index entry
+        /// @throw std::runtime_error if capture couldn't be read
+        /// @return Capture JPEG data
+        static Jpeg::Buffer Read(TaskId task, const Index::Entry& entry);
+
+        /// @brief Replace standalone capture file atomically
+        /// @param task Captured task
+        /// @param entry Capture index entry
+        /// @param data New capture JPEG data
+        /// @throw std::runtime_error if capture couldn't be replaced
+        /// @return New location of the capture
+        static Location Replace(TaskId task, const Index::Entry& entry, const Jpeg::Buffer& data);
+
+        /// @brief Delete capture file. Packed captures are deleted together with their whole pack
+        /// @param task Captured task
+        /// @param entry Capture index entry
+        /// @return Size of deleted file in bytes, 0 if it didn't exist
+        static uint64_t Remove(TaskId task, const Index::Entry& entry);
+
+        /// @brief Read capture preview
+        /// @param task Captured task
+        /// @param timestamp Capture timestamp
+        /// @param level Pyramid level of the preview
+        /// @throw std::runtime_error if the preview doesn't exist or couldn't be read
+        /// @return Preview JPEG data
+        static Jpeg::Buffer ReadPreview(TaskId task, Event::Timestamp timestamp, Pyramid::Level level);
+
+        /// @brief Delete all previews of a capture
+        /// @param task Captured task
+        /// @param timestamp Capture timestamp
+        /// @return Total size of deleted files in bytes
+        static uint64_t RemovePreviews(TaskId task, Event::Timestamp timestamp);
+
+    private:
+        // Find frame of a packed capture in opened pack, by the entry or by its timestamp if the pack was rewritten
+        static std::optional<PackEntry> LocateFrame(std::ifstream& file, const Index::Entry& entry);
+
+    private:
+        spdlog::logger m_logger;
+        Config::CaptureStorage m_type;
+        std::array<Pack, Tasks.size()> m_packs;
+        std::mutex m_mutex;
+        std::vector<Location> m_failedFrames;   // Reported by completions, discarded from packs by the next call of storage
+        FileWriter m_writer;
+
+    public:
+        /// @brief Initialize storage, remove files left by torn writes and seal packs of previous days left unsealed
+        /// @param type Storage type
+        /// @throw std::runtime_error if an unsealed pack couldn't be sealed
+        Storage(Config::CaptureStorage type);
+
+        Storage(const Storage&) = delete;
+
+        Storage& operator=(const Storage&) = delete;
+
+    private:
+        // Read entries of existing pack, skipping damaged frames, truncating torn tail and removing trailer of sealed pack
+        std::vector<PackEntry> recoverPack(const std::string& path);
+
+        // Drop entry of a frame that couldn't be written, its space is given back if it's the last frame of the pack
+        void discardFrame(Pack& pack, uint64_t offset);
+
+        // Discard failed frames of packs, from the last one
+        void discardFrames(const std::vector<Location>& failed);
+
+        // Discard failed frames reported by completions so far
+        void discardFailedFrames();
+
+        Pack& openPack(TaskId task, dt::date date);
+
+        void sealPack(Pack& pack);
+
+    public:
+        /// @brief Buffer capture to be saved by the next commit
+        /// @param task Captured task
+        /// @param timestamp Event timestamp
+        /// @param data Capture JPEG data
+        /// @throw std::runtime_error if pack file couldn't be opened
+        /// @return Location the capture will be saved at
+        Location save(TaskId task, pt::ptime timestamp, Jpeg::SharedBuffer data);
+
+        /// @brief Buffer capture previews to be saved by the next commit
+        /// @param task Captured task
+        /// @param timestamp Event timestamp
+        /// @param previews Encoded previews
+        void savePreviews(TaskId task, pt::ptime timestamp, const Previews& previews);
+
+        /// @brief Start saving buffered captures in background
+        /// @param completion Function called by the writer thread once the captures are durable. It must not wait for storage
+        void commit(Completion completion = {});
+
+        /// @brief Commit buffered captures and wait until everything committed so far is written and flushed, and completions are called.
+        ///        Failed packed captures are left out of their pack's trailing index
+        /// @return Locations of captures and previews of commits without completion that couldn't be saved since the last flush
+        std::vector<Location> flush();
+
+        /// @brief Seal open packs of days before a date
+        /// @param date The first day not to seal
+        /// @throw std::runtime_error if a pack couldn't be sealed
+        void seal(dt::date date);
+    };
+}
+
+} // namespace cp
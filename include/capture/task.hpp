@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include <boost/date_time.hpp>
+namespace dt = boost::gregorian;
+namespace pt = boost::posix_time;
+
+namespace cp {
+
+namespace Capture {
+    class Schedule;
+
+    enum class TaskId : uint8_t {
+        Main,
+        Midnight,
+        Midday,
+        Sunrise,
+        Sunset,
+        Day,
+        Night,
+        Start,  // Not a real task: marks the moment capture filesystem was created
+    };
+
+    struct Task {
+        /*
+        *   Per-day context shared by all generators.
+        *   Sunrise and sunset are calculated once per day instead of once per task.
+        */
+        struct Day {
+            dt::date date;
+            pt::ptime sunrise;
+            pt::ptime sunset;
+        };
+
+        using Generator = void (*)(const Day& day, Schedule& schedule);
+
+        TaskId id;
+        const char* name;
+        const char* shortName;
+        const char* directory;  // Directory inside capture directory, nullptr if task is never captured
+        Generator generate;     // Events generator, nullptr if task is never scheduled
+    };
+
+    namespace Generators {
+        void Main(const Task::Day& day, Schedule& schedule);
+
+        void Midnight(const Task::Day& day, Schedule& schedule);
+
+        void Midday(const Task::Day& day, Schedule& schedule);
+
+        void Sunrise(const Task::Day& day, Schedule& schedule);
+
+        void Sunset(const Task::Day& day, Schedule& schedule);
+
+        void Day(const Task::Day& day, Schedule& schedule);
+
+        void Night(const Task::Day& day, Schedule& schedule);
+    }
+
+    /*
+    *   Compile-time task registry.
+    *   Entries are ordered by TaskId so that a task is looked up by plain indexing.
+    */
+    inline constexpr std::array<Task, 8> Tasks = {{
+        { TaskId::Main,     "Main",     "MA", "Main",     &Generators::Main },
+        { TaskId::Midnight, "Midnight", "MN", "Midnight", &Generators::Midnight },
+        { TaskId::Midday,   "Midday",   "MD", "Midday",   &Generators::Midday },
+        { TaskId::Sunrise,  "Sunrise",  "SR", "Sunrise",  &Generators::Sunrise },
+        { TaskId::Sunset,   "Sunset",   "SS", "Sunset",   &Generators::Sunset },
+        { TaskId::Day,      "Day",      "DA", "Day",      &Generators::Day },
+        { TaskId::Night,    "Night",    "NI", "Night",    &Generators::Night },
+        { TaskId::Start,    "Start",    "ST", nullptr,    nullptr },
+    }};
+
+    static_assert([]() {
+        for (size_t index = 0; index < Tasks.size(); ++index) {
+            if (static_cast<size_t>(Tasks[index].id) != index) {
+                return false;
+            }
+        }
+        return true;
+    }(), "Tasks registry must be ordered by TaskId");
+
+    constexpr const Task& GetTask(TaskId id) {
+        return Tasks[static_cast<size_t>(id)];
+    }
+
+    constexpr const Task* FindTask(std::string_view name) {
+        for (const Task& task : Tasks) {
+            if (name == task.name) {
+                return &task;
+            }
+        }
+        return nullptr;
+    }
+}
+
+} // namespace cp
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "capture/event.hpp"
+#include "capture/task.hpp"
+#include "common/file_writer.hpp"
+#include "common/jpeg.hpp"
+#include "common/pyramid.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace TimelapseConst {
+        // Timelapses are "<capture directory>/<timelapse directory>/<task directory>.<number>.avi"
+        constexpr const char* TimelapseDirectory = "Timelapse";
+        constexpr const char* TimelapseExtension = "avi";
+
+        // Captures in timelapses of every task, "<capture directory>/<timelapse directory>/<coverage file>"
+        constexpr const char* CoverageFile = "coverage.json";
+
+        constexpr int FrameRate = 60;
+
+        // Frames are previews of this level, so they are never encoded again
+        constexpr Pyramid::Level FrameLevel = Pyramid::Level::Half;
+
+        // Offsets in AVI 1.0 index are 32-bit, new file is started before the limit is reached
+        constexpr uint64_t MaxFileSize = 1024ull * 1024 * 1024;
+
+        // RIFF header, "hdrl" list and "movi" list header: frames start right after
+        constexpr uint64_t HeaderSize = 224;
+    }
+
+    /*
+    *   Incremental MJPEG AVI timelapse of every task.
+    *   Frames are appended as "00dc" chunks of "movi" list, followed by "idx1" index which is rewritten after every frame,
+    *   together with the header. Every committed append leaves a complete, playable file.
+    *   A file torn by power loss is recovered on open by scanning its frame chunks.
+    */
+    class Timelapse {
+    public:
+        // Captures between the first and the last one (inclusive) are all in timelapse of the task, none was skipped
+        struct Range {
+            Event::Timestamp first = 0;
+            Event::Timestamp last = 0;
+        };
+
+    private:
+        // "idx1" entry
+        struct IndexEntry {
+            uint32_t chunkId;
+            uint32_t flags;
+            uint32_t offset;    // Chunk offset relative to "movi" list type
+            uint32_t size;      // Frame size
+        };
+        static_assert(sizeof(IndexEntry) == 16, "Index entry size is a part of AVI format");
+
+        struct Video {
+            std::string path;
+            int number = 0;
+            int width = 0;
+            int height = 0;
+            uint64_t moviEnd = TimelapseConst::HeaderSize;  // End of the last frame chunk
+            uint32_t maxFrameSize = 0;
+            std::vector<IndexEntry> index;
+        };
+
+    private:
+        spdlog::logger m_logger;
+        std::array<std::optional<Video>, Tasks.size()> m_videos;
+        std::vector<std::pair<TaskId, std::optional<Event::Timestamp>>> m_appended;    // Captures since the last commit, empty timestamp if skipped
+
+        /*
+        *   Used by writer thread only. Every run starts a new range of every task, frames captured while timelapse
+        *   was disabled aren't in any. A failed write may leave a hole that recovery cuts the rest of the video at,
+        *   so nothing is counted after it.
+        */
+        std::array<std::vector<Range>, Tasks.size()> m_coverage;
+        std::array<bool, Tasks.size()> m_extending = {};
+        bool m_failed = false;
+
+        FileWriter m_writer;
+
+    public:
+        /// @brief Initialize timelapse builder, videos are opened on the first append
+        Timelapse();
+
+        Timelapse(const Timelapse&) = delete;
+
+        Timelapse& operator=(const Timelapse&) = delete;
+
+    private:
+        std::string path(TaskId task, int number) const;
+
+        // Open the latest video of a task, recovering it if needed. Empty if the latest video isn't valid or there is none
+        std::optional<Video> openVideo(TaskId task, int& lastNumber);
+
+        Video createVideo(TaskId task, int number, int width, int height);
+
+        // Buffer writes of "idx1" index and the header of current video state
+        void writeTail(const Video& video);
+
+        // Called by writer thread once a commit is written
+        void updateCoverage(const std::vector<std::pair<TaskId, std::optional<Event::Timestamp>>>& appended, bool failed);
+
+        void saveCoverage();
+
+    public:
+        /// @brief Buffer frame to be appended to task timelapse by the next commit
+        /// @param task Captured task
+        /// @param timestamp Capture timestamp
+        /// @param frame JPEG frame
+        /// @throw std::runtime_error if the video couldn't be opened or created
+        void append(TaskId task, Event::Timestamp timestamp, Jpeg::SharedBuffer frame);
+
+        /// @brief Let timelapse know a capture of a task has no frame to append
+        /// @param task Captured task
+        void skip(TaskId task);
+
+        /// @brief Start writing buffered frames in background
+        void commit();
+
+        /// @brief Read which captures of a task are in its timelapse. Only frames that reached storage are counted
+        /// @param task Task to read coverage of
+        /// @return Ranges of captures in the timelapse, oldest first
+        static std::vector<Range> Coverage(TaskId task);
+    };
+}
+
+} // namespace cp
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <spdlog/spdlog.h>
+
+#include "common/camera.hpp"
+#include "common/jpeg.hpp"
+
+namespace cp {
+
+namespace Capture {
+    namespace ViewfinderConst {
+        // Frames are captured and encoded at most this often
+        constexpr int MaxFrameRate = 5;
+
+        constexpr int Quality = 70;
+
+        // While the viewfinder is paused, the last frame is repeated this often to keep viewer connections alive
+        constexpr std::chrono::seconds KeepAliveInterval(2);
+
+        // Camera is given this long to recover after a failed frame
+        constexpr std::chrono::seconds ErrorDelay(5);
+    }
+
+    /*
+    *   Live preview of a camera: low resolution viewfinder frames encoded once and shared by all viewers.
+    *   The camera is only streaming while somebody watches, and it's released for scheduled captures by pause().
+    */
+    class Viewfinder {
+    public:
+        // Called by the viewfinder thread with every new frame, has to return quickly
+        using Listener = std::function<void(Jpeg::SharedBuffer frame)>;
+
+        // Viewer is subscribed to frames as long as its subscription exists
+        class Subscription {
+        private:
+            Viewfinder& m_viewfinder;
+            uint64_t m_id;
+
+        public:
+            Subscription(Viewfinder& viewfinder, uint64_t id);
+
+            ~Subscription();
+
+            Subscription(const Subscription&) = delete;
+
+            Subscription& operator=(const Subscription&) = delete;
+        };
+
+        // Viewfinder is paused as long as its pause exists
+        class Pause {
+        private:
+            Viewfinder& m_viewfinder;
+
+        public:
+            Pause(Viewfinder& viewfinder);
+
+            ~Pause();
+
+            Pause(const Pause&) = delete;
+
+            Pause& operator=(const Pause&) = delete;
+        };
+
+    private:
+        spdlog::logger m_logger;
+        Camera& m_camera;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::map<uint64_t, Listener> m_listeners;
+        uint64_t m_nextListener = 0;
+        Jpeg::SharedBuffer m_lastFrame;
+        size_t m_pauses = 0;
+        bool m_cameraOn = false;
+        bool m_stopping = false;
+        std::thread m_thread;
+
+    public:
+        /// @brief Start viewfinder job, it's idle until there is a viewer
+        /// @param camera The camera, has to outlive the viewfinder
+        Viewfinder(Camera& camera);
+
+        /// @brief Stop viewfinder job and release the camera
+        ~Viewfinder();
+
+        Viewfinder(const Viewfinder&) = delete;
+
+        Viewfinder& operator=(const Viewfinder&) = delete;
+
+    private:
+        void viewfinderFunction();
+
+        // Hand the frame over to all viewers, the mutex has to be locked and is unlocked meanwhile
+        void publish(std::unique_lock<std::mutex>& lock, Jpeg::SharedBuffer frame);
+
+        void unsubscribe(uint64_t id);
+
+        void pause();
+
+        void resume();
+
+    public:
+        /// @brief Subscribe to frames. The last frame is delivered right away if there is one
+        /// @param listener Function called with every frame
+        /// @return Subscription, the listener isn't called anymore once it's destroyed
+        std::unique_ptr<Subscription> subscribe(Listener listener);
+
+    public:
+        inline const Camera& camera() const {
+            return m_camera;
+        }
+    };
+}
+
+} // namespace cp
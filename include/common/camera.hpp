@@ -1,21 +1,12 @@
 #pragma once
 
 #include <memory>
-#include <mutex>
-#include <condition_variable>
-
-#ifdef __unix__
-    #include <libcamera/libcamera.h>
-    namespace lc = libcamera;
-#endif
-
-#define cimg_display 0
-#define cimg_use_jpeg 1
-#include "external/CImg.h"
-namespace cimg = cimg_library;
+#include <string>
 
 #include <spdlog/spdlog.h>
 
+#include "common/config.hpp"
+#include "common/image.hpp"
 #include "sensors/recorder.hpp"
 
 namespace cp {
@@ -24,6 +15,10 @@ namespace CameraConst {
     constexpr int CaptureWidth = 4056;
     constexpr int CaptureHeight = 3040;
 
+    // Viewfinder stream, configured alongside the still stream
+    constexpr int PreviewWidth = 640;
+    constexpr int PreviewHeight = 480;
+
     namespace Ui {
         constexpr uint8_t BlackColor[] = { 0, 0, 0 };
         constexpr int InfoBarHeight = 160;
@@ -36,9 +31,14 @@ namespace CameraConst {
     }
 }
 
+/*
+*   Camera backend interface. Every camera captures its own set of tasks,
+*   several cameras are triggered at once when their events fall on the same moment.
+*/
 class Camera {
 public:
-    using Image = cimg::CImg<uint8_t>;
+    using Image = cp::Image;
+    using Pointer = std::unique_ptr<Camera>;
 
     struct UiInfo {
         std::string task;
@@ -46,39 +46,57 @@ public:
         Sensors::Recorder::Record trend;
     };
 
-private:
-    spdlog::logger m_logger;
-    std::mutex m_mutex;
-    std::condition_variable m_cv;
-
-    bool m_on = false;
-    Image* m_image = nullptr;
-
-#ifdef __unix__
-    std::unique_ptr<lc::CameraManager> m_manager;
-    std::shared_ptr<lc::Camera> m_camera;
-    std::unique_ptr<lc::CameraConfiguration> m_cameraConfig;
-    std::unique_ptr<lc::FrameBufferAllocator> m_allocator;
-#endif
-
 public:
-    Camera();
+    /// @brief Create camera of configured backend. It's turned off until turnOn() is called
+    /// @param config Camera configuration
+    /// @return The camera
+    static Pointer Create(const Config::CameraConfig& config);
 
-    ~Camera();
+protected:
+    spdlog::logger m_logger;
+    std::string m_name;
 
-private:
-#ifdef __unix__
-    void requestCompleted(lc::Request* request);
-#endif
+protected:
+    Camera(const std::string& name);
 
 public:
-    void turnOn();
+    virtual ~Camera() = default;
 
-    void turnOff();
+    Camera(const Camera&) = delete;
 
-    Image capture();
+    Camera& operator=(const Camera&) = delete;
 
+public:
+    /// @brief Acquire and configure the camera, does nothing if it's on
+    /// @throw std::runtime_error if the camera couldn't be turned on
+    virtual void turnOn() = 0;
+
+    /// @brief Release the camera, does nothing if it's off
+    virtual void turnOff() = 0;
+
+    /// @brief Capture a frame
+    /// @throw std::invalid_argument if the camera is off
+    /// @throw std::runtime_error if the frame couldn't be captured
+    /// @return RGB frame
+    virtual Image capture() = 0;
+
+    /// @brief Capture a low resolution frame of the viewfinder stream, the camera keeps streaming until the next capture
+    /// @throw std::invalid_argument if the camera is off
+    /// @throw std::runtime_error if the frame couldn't be captured
+    /// @return RGB frame
+    virtual Image preview() = 0;
+
+    /// @brief Capture a frame with info bar burned into it
+    /// @param info Information to show
+    /// @throw std::invalid_argument if the camera is off
+    /// @throw std::runtime_error if the frame couldn't be captured
+    /// @return RGB frame
     Image capture(const UiInfo& info);
+
+public:
+    inline const std::string& name() const {
+        return m_name;
+    }
 };
 
 } // namespace cp
@@ -1,13 +1,27 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
+
+#include "common/region.hpp"
 
 namespace cp {
 
+// Settings are kept per task, the task registry itself isn't needed here
+namespace Capture {
+    enum class TaskId : uint8_t;
+}
+
 namespace ConfigConst {
     constexpr const char* ConfigFile = "config.json";
 
+    // Count of tasks in the task registry, checked against it where it's defined
+    constexpr size_t TaskCount = 8;
+
     namespace Objects {
         constexpr const char* Common = "common";
         constexpr const char* HttpPort = "http_port";
@@ -24,6 +38,49 @@ namespace ConfigConst {
         constexpr const char* Sun = "sun";
         constexpr const char* SunriseAngle = "sunrise_angle";
         constexpr const char* SunsetAngle = "sunset_angle";
+
+        constexpr const char* Capture = "capture";
+        constexpr const char* Layout = "layout";
+        constexpr const char* Storage = "storage";
+
+        constexpr const char* Retention = "retention";
+        constexpr const char* RecompressAfter = "recompress_after";
+        constexpr const char* Quality = "quality";
+        constexpr const char* Scale = "scale";
+        constexpr const char* DeleteAfter = "delete_after";
+        constexpr const char* DeleteTimelapsedAfter = "delete_timelapsed_after";
+
+        constexpr const char* TargetSize = "target_size";
+
+        constexpr const char* Regions = "regions";
+        constexpr const char* X = "x";
+        constexpr const char* Y = "y";
+
+        constexpr const char* Timelapse = "timelapse";
+
+        constexpr const char* Overlay = "overlay";
+
+        constexpr const char* Cameras = "cameras";
+        constexpr const char* Name = "name";
+        constexpr const char* Backend = "backend";
+        constexpr const char* Id = "id";
+        constexpr const char* Width = "width";
+        constexpr const char* Height = "height";
+        constexpr const char* Tasks = "tasks";
+    }
+
+    namespace Values {
+        constexpr const char* FlatLayout = "flat";
+        constexpr const char* ShardedLayout = "sharded";
+
+        constexpr const char* FilesStorage = "files";
+        constexpr const char* PackStorage = "pack";
+
+        constexpr const char* BurnedOverlay = "burned";
+        constexpr const char* MetadataOverlay = "metadata";
+
+        constexpr const char* LibcameraBackend = "libcamera";
+        constexpr const char* SyntheticBackend = "synthetic";
     }
 
     namespace Defaults {
@@ -38,6 +95,25 @@ namespace ConfigConst {
 
         constexpr double SunriseAngle = 90.833;
         constexpr double SunsetAngle = 90.833;
+
+        constexpr const char* Layout = Values::FlatLayout;
+        constexpr const char* Storage = Values::FilesStorage;
+
+        constexpr int RecompressAfter = 0;
+        constexpr int Quality = 75;
+        constexpr int Scale = 1;
+        constexpr int DeleteAfter = 0;
+        constexpr int DeleteTimelapsedAfter = 0;
+
+        constexpr bool Timelapse = true;
+
+        constexpr const char* Overlay = Values::BurnedOverlay;
+
+        constexpr const char* CameraName = "camera";
+        constexpr const char* Backend = Values::LibcameraBackend;
+        constexpr const char* Id = "";
+        constexpr int Width = 0;
+        constexpr int Height = 0;
     }
 }
 
@@ -45,6 +121,42 @@ class Config {
 public:
     static const std::unique_ptr<Config> Instance;
 
+    enum class CaptureLayout {
+        Flat,       // Capture/<Task>/<file>
+        Sharded,    // Capture/<Task>/<YYYY>/<MM>/<DD>/<file>
+    };
+
+    enum class CaptureStorage {
+        Files,      // Every capture is a standalone JPEG file
+        Pack,       // Captures are appended to per-day pack files of their tasks
+    };
+
+    enum class CaptureOverlay {
+        Burned,     // Info bar is drawn over the bottom of every capture
+        Metadata,   // Info bar is stored as XMP metadata of clean captures and drawn when they are served
+    };
+
+    enum class CameraBackend {
+        Libcamera,  // Camera connected to the board
+        Synthetic,  // Generated test frames, no hardware needed
+    };
+
+    struct CameraConfig {
+        std::string name = ConfigConst::Defaults::CameraName;
+        CameraBackend backend = CameraBackend::Libcamera;
+        std::string id = ConfigConst::Defaults::Id;     // Libcamera camera ID, empty to use the only connected camera
+        int width = ConfigConst::Defaults::Width;       // Frame width of synthetic camera, 0 for capture width
+        int height = ConfigConst::Defaults::Height;     // Frame height of synthetic camera, 0 for capture height
+    };
+
+    struct RetentionPolicy {
+        int recompressAfter = ConfigConst::Defaults::RecompressAfter;   // Age in days captures are recompressed at, 0 to never recompress
+        int quality = ConfigConst::Defaults::Quality;                   // JPEG quality of recompressed captures
+        int scale = ConfigConst::Defaults::Scale;                       // Resolution divider of recompressed captures: 1, 2, 4 or 8
+        int deleteAfter = ConfigConst::Defaults::DeleteAfter;           // Age in days captures are deleted at, 0 to keep forever
+        int deleteTimelapsedAfter = ConfigConst::Defaults::DeleteTimelapsedAfter;   // Age in days captures in timelapse are deleted at, 0 to keep them
+    };
+
 public:
     static void GenerateSampleFile();
 
@@ -58,6 +170,15 @@ private:
     double m_longitude;
     double m_sunriseAngle;
     double m_sunsetAngle;
+    CaptureLayout m_captureLayout = CaptureLayout::Flat;
+    CaptureStorage m_captureStorage = CaptureStorage::Files;
+    CaptureOverlay m_captureOverlay = CaptureOverlay::Burned;
+    std::vector<CameraConfig> m_cameras = { CameraConfig() };
+    std::array<size_t, ConfigConst::TaskCount> m_taskCameras = {};
+    std::array<RetentionPolicy, ConfigConst::TaskCount> m_retentionPolicies = {};
+    std::array<size_t, ConfigConst::TaskCount> m_targetSizes = {};
+    std::array<std::optional<Region>, ConfigConst::TaskCount> m_regions = {};
+    bool m_timelapse = ConfigConst::Defaults::Timelapse;
 
 private:
     Config();
@@ -98,6 +219,46 @@ public:
     inline double sunsetAngle() const {
         return m_sunsetAngle;
     }
+
+    inline CaptureLayout captureLayout() const {
+        return m_captureLayout;
+    }
+
+    inline CaptureStorage captureStorage() const {
+        return m_captureStorage;
+    }
+
+    inline CaptureOverlay captureOverlay() const {
+        return m_captureOverlay;
+    }
+
+    inline const std::vector<CameraConfig>& cameras() const {
+        return m_cameras;
+    }
+
+    // Index of the camera capturing a task
+    inline size_t taskCamera(Capture::TaskId task) const {
+        return m_taskCameras[static_cast<size_t>(task)];
+    }
+
+    inline const RetentionPolicy& retentionPolicy(Capture::TaskId task) const {
+        return m_retentionPolicies[static_cast<size_t>(task)];
+    }
+
+    // Target capture size of a task in bytes, 0 if captures are encoded with fixed quality
+    inline size_t targetSize(Capture::TaskId task) const {
+        return m_targetSizes[static_cast<size_t>(task)];
+    }
+
+    // Region of the frame a task captures, the whole frame if empty
+    inline const std::optional<Region>& region(Capture::TaskId task) const {
+        return m_regions[static_cast<size_t>(task)];
+    }
+
+    // Whether captures are appended to timelapse videos of their tasks
+    inline bool timelapse() const {
+        return m_timelapse;
+    }
 };
 
 } // namespace cp
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#ifdef CP_USE_IO_URING
+    #include <liburing.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace cp {
+
+namespace FileWriterConst {
+    // Files are written under this suffix and renamed when they are complete and flushed
+    constexpr const char* TemporarySuffix = ".tmp";
+
+    // Submission queue size of io_uring, every file uses an entry per write and one for fsync
+    constexpr unsigned QueueDepth = 64;
+}
+
+/*
+*   Background file writer.
+*   Writes are buffered by write() and handed to the writer thread as one batch by commit(), so the caller never waits for storage.
+*   The batch is written with io_uring if it is available (pwritev() otherwise), and every file is flushed before it's published.
+*   Writes into the same existing file are flushed together, once per batch.
+*   New files are preallocated and written under temporary name, then renamed: a torn write never leaves a half-file with the final name.
+*   A commit may have a completion, which is called by the writer thread with the failures of its writes once they are done.
+*   Failed writes of commits without completion are kept until they are taken, so that callers can tell which data isn't durable.
+*/
+class FileWriter {
+public:
+    using Data = std::shared_ptr<const std::vector<uint8_t>>;
+
+    // Write that wasn't completely written and flushed
+    struct Failure {
+        std::string path;
+        uint64_t offset = 0;
+        bool create = false;
+    };
+
+    // Called by the writer thread once writes of a commit are written and flushed, with failures of these writes
+    using Completion = std::function<void(std::vector<Failure> failures)>;
+
+private:
+    struct Job {
+        std::string path;
+        uint64_t offset = 0;
+        std::vector<Data> parts;    // Written consecutively from the offset with one system call
+        bool create = false;        // Whether a new file is published, or data is written into existing file
+    };
+
+    // Commit with completion, covering jobs of the queue in range [begin, end)
+    struct Commit {
+        size_t begin = 0;
+        size_t end = 0;
+        Completion completion;
+    };
+
+private:
+    spdlog::logger m_logger;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::condition_variable m_doneCv;
+    std::vector<Job> m_pending;
+    std::vector<Job> m_queue;
+    std::vector<Commit> m_commits;
+    std::vector<Failure> m_failures;
+    bool m_busy = false;
+    bool m_stopping = false;
+#ifdef CP_USE_IO_URING
+    io_uring m_ring = {};
+    bool m_ringReady = false;
+#endif
+    std::thread m_thread;
+
+public:
+    /// @brief Start writer thread
+    FileWriter();
+
+    /// @brief Write everything buffered and stop writer thread
+    ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+
+    FileWriter& operator=(const FileWriter&) = delete;
+
+private:
+    void writerFunction();
+
+    // Returns indices of failed jobs in ascending order
+    std::vector<size_t> writeBatch(std::vector<Job>& batch);
+
+    void complete(const std::vector<Job>& batch, std::vector<Commit>& commits, const std::vector<size_t>& failedJobs);
+
+public:
+    /// @brief Buffer creation of a new file (existing file is replaced)
+    /// @param path File path
+    /// @param data File contents
+    void write(const std::string& path, Data data);
+
+    /// @brief Buffer write into existing file
+    /// @param path File path
+    /// @param offset Offset to write data at
+    /// @param data Data to write
+    void write(const std::string& path, uint64_t offset, Data data);
+
+    /// @brief Buffer write of consecutive parts into existing file
+    /// @param path File path
+    /// @param offset Offset to write the first part at
+    /// @param parts Data to write
+    void write(const std::string& path, uint64_t offset, std::vector<Data> parts);
+
+    /// @brief Hand buffered writes to writer thread as one batch
+    /// @param completion Function called by the writer thread once the writes are written and flushed.
+    ///        It must not wait for the writer
+    void commit(Completion completion = {});
+
+    /// @brief Commit buffered writes and wait until everything is written and flushed, and completions are called
+    void flush();
+
+    /// @brief Take failed writes of commits without completion written so far
+    /// @return The failures, in the order the writes were buffered
+    std::vector<Failure> takeFailures();
+};
+
+} // namespace cp
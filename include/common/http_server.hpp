@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <functional>
 
@@ -12,11 +14,38 @@ namespace asio = boost::asio;
 #include <spdlog/spdlog.h>
 
 #include "capture/master.hpp"
+#include "common/image_cache.hpp"
 #include "display/ui.hpp"
+#include "sensors/charts.hpp"
 #include "sensors/recorder.hpp"
 
 namespace cp {
 
+namespace HttpServerConst {
+    // Resized captures are cached in "<capture directory>/<image cache directory>/"
+    constexpr const char* ImageCacheDirectory = "Cache";
+
+    // Images are resized by worker threads, so that requests aren't blocked meanwhile
+    constexpr size_t WorkerThreads = 2;
+
+    // Narrowest resized capture
+    constexpr int MinResizedWidth = 16;
+
+    constexpr int ResizedQuality = 85;
+
+    // Captures with metadata overlay drawn are encoded with the quality captures are
+    constexpr int OverlayQuality = JpegConst::DefaultQuality;
+
+    // Connection is closed if nothing was sent for this long
+    constexpr std::chrono::seconds Timeout(10);
+
+    // Files are sent by sendfile() in chunks of this size
+    constexpr size_t SendfileChunkSize = 1024 * 1024;
+
+    // Separates frames of preview stream
+    constexpr const char* PreviewBoundary = "frame";
+}
+
 class HttpServer {
 public:
     using Logger = std::shared_ptr<spdlog::logger>;
@@ -42,19 +71,40 @@ public:
         LogMessageFunction m_logMessage;
         Display::Ui::Pointer m_displayUi;
         Capture::Master::Pointer m_captureMaster;
+        std::shared_ptr<ImageCache> m_imageCache;
+        std::shared_ptr<Sensors::Charts> m_charts;
+        asio::thread_pool& m_workers;
         asio::ip::tcp::socket m_socket;
         beast::flat_buffer m_buffer;
         beast::http::request<beast::http::dynamic_body> m_request;
         beast::http::response<beast::http::dynamic_body> m_response;
+        beast::http::response<beast::http::buffer_body> m_imageResponse;
+        Jpeg::SharedBuffer m_image;
+        int m_file = -1;
+        uint64_t m_fileOffset = 0;
+        uint64_t m_fileRemaining = 0;
+        std::string m_fileHeader;
+        Capture::Viewfinder* m_viewfinder = nullptr;
+        std::unique_ptr<Capture::Viewfinder::Subscription> m_previewSubscription;
+        Jpeg::SharedBuffer m_previewFrame;
+        Jpeg::SharedBuffer m_nextPreviewFrame;
+        std::string m_previewHeader;
+        bool m_previewWriting = false;
         asio::steady_timer m_timeout;
+        bool m_deferred = false;
 
     public:
         /// @brief Initialize connection
         /// @param logger HTTP server logger
         /// @param displayUi Initialized display UI
         /// @param captureMaster Initialized capture master
+        /// @param imageCache Cache of resized captures
+        /// @param charts Cache of sensors history charts
+        /// @param workers Thread pool resizing captures and rendering charts
         /// @param socket Connection socket
-        Connection(Logger logger, Display::Ui::Pointer displayUi, Capture::Master::Pointer captureMaster, asio::ip::tcp::socket& socket);
+        Connection(Logger logger, Display::Ui::Pointer displayUi, Capture::Master::Pointer captureMaster, std::shared_ptr<ImageCache> imageCache, std::shared_ptr<Sensors::Charts> charts, asio::thread_pool& workers, asio::ip::tcp::socket& socket);
+
+        ~Connection();
 
     private:
         // "404 Not Found"
@@ -63,6 +113,33 @@ public:
         // "405 Method Not Allowed"
         void methodNotAllowed();
 
+        // "400 Bad Request"
+        void badRequest(const std::string& what, int indentation);
+
+        // "503 Service Unavailable", capture index isn't opened yet
+        void indexUnavailable(int indentation);
+
+        // "500 Internal Server Error", capture couldn't be read
+        void captureUnreadable(const std::string& error, int indentation);
+
+        // "500 Internal Server Error", chart couldn't be rendered
+        void chartUnrenderable(const std::string& error, int indentation);
+
+        // "200 OK" with image body sent straight from the shared buffer, or "304 Not Modified" if client has the same image
+        void sendImage(Jpeg::SharedBuffer image, const std::string& etag, const char* contentType = "image/jpeg");
+
+        // Image cache callback sending the image from the connection's thread, the key is its ETag
+        ImageCache::Callback imageSender(const std::string& key, int indentation);
+
+        // Generate image by a worker through image cache and send it when it's done, the key is its ETag
+        void generateImage(const std::string& key, ImageCache::Generator generator, int indentation);
+
+        // Read capture by a worker and send it when it's done, with its metadata overlay drawn unless the overlay isn't requested
+        void readCapture(Capture::TaskId task, Capture::Index::Entry entry, bool overlay, int indentation);
+
+        // Send capture, with its metadata overlay drawn unless the overlay isn't requested
+        void sendCapture(Capture::TaskId task, Capture::Event::Timestamp timestamp, Jpeg::SharedBuffer data, bool overlay, int indentation);
+
         // GET /api/<location>
         void getSensors(Sensors::Location location, int indentation);
 
@@ -72,6 +149,30 @@ public:
         // GET "/api/<location>/history"
         void getHistory(Sensors::Location location, int itemsCount, HistoryFields fields);
 
+        // GET "/api/<location>/history/chart.png[?hours=<hours>][&fields=<fields>]"
+        void getHistoryChart(Sensors::Location location, const std::string& query, int indentation);
+
+        // GET "/api/captures?task=<task>[&from=<from>][&to=<to>][&offset=<offset>][&limit=<limit>][&min_change=<fraction>]"
+        void getCaptures(const std::string& query, int indentation);
+
+        // GET "/api/scene/history?task=<task>[&count=<count>]"
+        void getSceneHistory(const std::string& query, int indentation);
+
+        // GET "/api/capture/latest[?task=<task>][&overlay=false]"
+        void getLatestCapture(const std::string& query, int indentation);
+
+        // GET "/api/capture/<task>/<timestamp>[?w=<width>][&overlay=false]"
+        void getCapture(const std::string& resource, const std::string& query, int indentation);
+
+        // GET "/api/contact_sheet/<YYYY-MM-DD>"
+        void getContactSheet(const std::string& resource, int indentation);
+
+        // GET "/Capture/<path>", with optional "Range" header
+        void getFile(const std::string& resource, int indentation);
+
+        // GET "/api/preview.mjpeg[?camera=<name>]"
+        void getPreviewStream(const std::string& query, int indentation);
+
         // GET "/api/display"
         void getDisplay(int indentation);
 
@@ -87,6 +188,18 @@ public:
         void produceResponse();
 
         void sendResponse();
+
+        // Send the rest of file body with sendfile()
+        void sendFile();
+
+        // Queue viewfinder frame, viewers too slow for the frame rate skip frames instead of falling behind
+        void sendPreviewFrame(Jpeg::SharedBuffer frame);
+
+        void writePreviewFrame();
+
+        void stopPreview();
+
+        void finishResponse();
     
     public:
         void handleRequest();
@@ -96,6 +209,9 @@ private:
     Logger m_logger;
     Display::Ui::Pointer m_displayUi;
     Capture::Master::Pointer m_captureMaster;
+    std::shared_ptr<ImageCache> m_imageCache;
+    std::shared_ptr<Sensors::Charts> m_charts;
+    asio::thread_pool m_workers;
     boost::asio::io_context m_context;
     asio::ip::tcp::acceptor m_acceptor;
     asio::ip::tcp::socket m_socket;
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#define cimg_display 0
+#define cimg_use_jpeg 1
+#include "external/CImg.h"
+namespace cimg = cimg_library;
+
+#include "common/region.hpp"
+
+namespace cp {
+
+// Planar 8-bit image, RGB images have spectrum of 3
+using Image = cimg::CImg<uint8_t>;
+
+// Region covering the whole image
+inline Region FullRegion(const Image& image) {
+    return { 0, 0, image.width(), image.height() };
+}
+
+// Whether the region is non-empty and lies within the image
+inline bool Contains(const Image& image, const Region& region) {
+    return region.width > 0 && region.height > 0 && region.x >= 0 && region.y >= 0 &&
+        region.x + region.width <= image.width() && region.y + region.height <= image.height();
+}
+
+} // namespace cp
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "common/jpeg.hpp"
+
+namespace cp {
+
+namespace ImageCacheConst {
+    // Total size of images kept in memory
+    constexpr size_t MemoryLimit = 32 * 1024 * 1024;
+
+    // Total size of images kept on disk
+    constexpr size_t DiskLimit = 512 * 1024 * 1024;
+
+    constexpr const char* CacheExtension = "jpeg";
+}
+
+/*
+*   Size-bounded LRU cache of generated images, kept both in memory and on disk.
+*   Images evicted from memory are still found on disk, disk cache survives restarts.
+*   Concurrent requests of the same image are coalesced: it's generated once, and the others are completed with it
+*   when it's done, without blocking their threads.
+*/
+class ImageCache {
+public:
+    using Generator = std::function<Jpeg::Buffer()>;
+
+    // Called with the image, or with an empty image and the error if it couldn't be generated
+    using Callback = std::function<void(Jpeg::SharedBuffer image, const std::string& error)>;
+
+private:
+    template <typename Value>
+    struct Lru {
+        using Item = std::pair<std::string, Value>;
+
+        std::list<Item> items;  // The most recently used first
+        std::unordered_map<std::string, typename std::list<Item>::iterator> positions;
+        size_t size = 0;
+    };
+
+private:
+    spdlog::logger m_logger;
+    std::string m_directory;
+    std::mutex m_mutex;
+    Lru<Jpeg::SharedBuffer> m_memory;
+    Lru<size_t> m_disk;
+    std::unordered_map<std::string, std::vector<Callback>> m_pending;   // Callbacks of images being generated
+
+public:
+    /// @brief Open disk cache, removing incomplete files and files over the limit
+    /// @param directory Disk cache directory, created on first store
+    ImageCache(const std::string& directory);
+
+    ImageCache(const ImageCache&) = delete;
+
+    ImageCache& operator=(const ImageCache&) = delete;
+
+private:
+    std::string path(const std::string& key) const;
+
+    Jpeg::SharedBuffer readDisk(const std::string& key);
+
+    bool writeDisk(const std::string& key, const Jpeg::Buffer& image);
+
+    // Add image to memory cache and, if it's on disk, to disk cache. The lock must be held
+    void remember(const std::string& key, const Jpeg::SharedBuffer& image, bool onDisk);
+
+public:
+    /// @brief Get cached image or generate it. If the image is being generated already, returns right away
+    ///        and the callback is called by the thread generating it
+    /// @param key Image key, used as file name on disk
+    /// @param generator Function generating the image if it's not cached
+    /// @param callback Function called with the image when it's available
+    void get(const std::string& key, const Generator& generator, Callback callback);
+};
+
+} // namespace cp
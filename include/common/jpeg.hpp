@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/image.hpp"
+
+namespace cp {
+
+namespace JpegConst {
+    // Same quality CImg::save_jpeg() uses by default, so captures don't change
+    constexpr int DefaultQuality = 100;
+
+    // APP1 segment is XMP if its payload starts with this null-terminated namespace
+    constexpr char XmpSignature[] = "http://ns.adobe.com/xap/1.0/";
+
+    // Segment length field counts itself and is 16-bit
+    constexpr size_t MaxSegmentLength = 65535;
+}
+
+namespace Jpeg {
+    using Buffer = std::vector<uint8_t>;
+    using SharedBuffer = std::shared_ptr<const Buffer>;
+
+    struct Dimensions {
+        int width = 0;
+        int height = 0;
+    };
+
+    /// @brief Encode image to JPEG in memory
+    /// @param image Grayscale or RGB image to encode
+    /// @param quality JPEG quality [1; 100]
+    /// @throw std::runtime_error if image couldn't be encoded
+    /// @return Encoded image
+    Buffer Encode(const Image& image, int quality = JpegConst::DefaultQuality);
+
+    /// @brief Encode region of an image to JPEG in memory. Scanlines are read from the image's buffer, the region isn't copied
+    /// @param image Grayscale or RGB image
+    /// @param region Region to encode, has to lie within the image
+    /// @param quality JPEG quality [1; 100]
+    /// @throw std::invalid_argument if the region doesn't lie within the image
+    /// @throw std::runtime_error if image couldn't be encoded
+    /// @return Encoded region
+    Buffer Encode(const Image& image, const Region& region, int quality = JpegConst::DefaultQuality);
+
+    /// @brief Read image dimensions from JPEG header without decoding the image
+    /// @param data JPEG data
+    /// @param size JPEG data size
+    /// @throw std::runtime_error if JPEG header couldn't be read
+    /// @return Image dimensions
+    Dimensions ReadDimensions(const uint8_t* data, size_t size);
+
+    /// @brief Decode JPEG from memory, optionally scaling it down in DCT domain
+    /// @param data JPEG data
+    /// @param size JPEG data size
+    /// @param scale Resolution divider: 1, 2, 4 or 8. Scaled image is decoded without decoding full resolution first
+    /// @throw std::runtime_error if JPEG couldn't be decoded
+    /// @return Decoded RGB image
+    Image Decode(const uint8_t* data, size_t size, int scale = 1);
+
+    /// @brief Decode JPEG from memory at the smallest DCT scale (1/8 to 1) that is at least as wide as requested
+    /// @param data JPEG data
+    /// @param size JPEG data size
+    /// @param width Minimum width of decoded image, full resolution is decoded if the image is narrower
+    /// @throw std::runtime_error if JPEG couldn't be decoded
+    /// @return Decoded RGB image
+    Image DecodeToWidth(const uint8_t* data, size_t size, int width);
+
+    /// @brief Insert XMP packet into JPEG as APP1 segment. Entropy-coded data is copied as is, nothing is re-encoded
+    /// @param data JPEG data
+    /// @param size JPEG data size
+    /// @param packet XMP packet
+    /// @throw std::runtime_error if data isn't JPEG or the packet doesn't fit into one segment
+    /// @return JPEG data with XMP packet
+    Buffer InsertXmp(const uint8_t* data, size_t size, const std::string& packet);
+
+    /// @brief Find XMP packet of JPEG
+    /// @param data JPEG data
+    /// @param size JPEG data size
+    /// @return XMP packet, if JPEG has one
+    std::optional<std::string> ReadXmp(const uint8_t* data, size_t size);
+}
+
+} // namespace cp
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <condition_variable>
+
+#ifdef __unix__
+    #include <libcamera/libcamera.h>
+    namespace lc = libcamera;
+#endif
+
+#include "common/camera.hpp"
+
+namespace cp {
+
+/*
+*   Camera connected to the board, driven by libcamera.
+*   Camera manager is shared by all cameras, libcamera allows only one per process.
+*   Still and viewfinder streams are configured together: the camera keeps streaming between preview frames
+*   and is stopped for a still capture.
+*/
+class LibcameraCamera : public Camera {
+private:
+    std::string m_id;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    bool m_on = false;
+    bool m_streaming = false;
+    Image* m_image = nullptr;
+
+#ifdef __unix__
+    std::shared_ptr<lc::CameraManager> m_manager;
+    std::shared_ptr<lc::Camera> m_camera;
+    std::unique_ptr<lc::CameraConfiguration> m_cameraConfig;
+    std::unique_ptr<lc::FrameBufferAllocator> m_allocator;
+#endif
+
+public:
+    /// @brief Initialize camera, it's turned off
+    /// @param name Camera name
+    /// @param id Libcamera camera ID, empty to use the only connected camera
+    LibcameraCamera(const std::string& name, const std::string& id);
+
+    ~LibcameraCamera() override;
+
+private:
+#ifdef __unix__
+    void requestCompleted(lc::Request* request);
+
+    // Queue request for a frame of the stream and wait until it's completed, the camera has to be started
+    Image request(std::unique_lock<std::mutex>& lock, lc::Stream* stream);
+
+    void stop();
+#endif
+
+public:
+    void turnOn() override;
+
+    void turnOff() override;
+
+    Image capture() override;
+
+    Image preview() override;
+};
+
+} // namespace cp
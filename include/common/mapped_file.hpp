@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cp {
+
+/*
+*   File mapped into memory.
+*   On Unix the file is mapped with mmap(), elsewhere it's read into memory and written back on flush().
+*/
+class MappedFile {
+private:
+    std::string m_path;
+    bool m_writable = false;
+    int m_fd = -1;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+#ifndef __unix__
+    std::vector<uint8_t> m_buffer;
+#endif
+
+public:
+    /// @brief Map file into memory
+    /// @param path Path to the file
+    /// @param writable Whether the mapping is writable. Writable file is created if it doesn't exist
+    /// @throw std::runtime_error if the file couldn't be opened or mapped
+    MappedFile(const std::string& path, bool writable = false);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+    void map();
+
+    void unmap();
+
+public:
+    /// @brief Change file size and remap it. Pointers to old mapping are invalidated
+    /// @param size New file size in bytes
+    /// @throw std::runtime_error if the file couldn't be resized or remapped
+    void resize(size_t size);
+
+    /// @brief Write changes back to the file
+    void flush();
+
+public:
+    inline const std::string& path() const {
+        return m_path;
+    }
+
+    inline uint8_t* data() {
+        return m_data;
+    }
+
+    inline const uint8_t* data() const {
+        return m_data;
+    }
+
+    inline size_t size() const {
+        return m_size;
+    }
+};
+
+} // namespace cp
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "common/camera.hpp"
+#include "common/image.hpp"
+#include "common/jpeg.hpp"
+
+namespace cp {
+
+namespace OverlayConst {
+    // Namespace of overlay properties in XMP packet
+    constexpr const char* XmpNamespace = "copaipy:ns:overlay/1.0/";
+}
+
+/*
+*   Info bar overlay: task, timestamp and sensor readings over the bottom of a frame.
+*   It's either burned into captures or stored as XMP metadata and drawn only when the capture is looked at.
+*/
+namespace Overlay {
+    /// @brief Draw info bar over the bottom of a frame. Frames narrower than capture get proportionally smaller bar
+    /// @param image The frame
+    /// @param info Information to show
+    /// @throw std::runtime_error if text couldn't be rendered
+    void Draw(Image& image, const Camera::UiInfo& info);
+
+    /// @brief Serialize overlay information to XMP packet
+    /// @param info Information to serialize
+    /// @return XMP packet
+    std::string ToXmp(const Camera::UiInfo& info);
+
+    /// @brief Parse overlay information from XMP packet
+    /// @param packet XMP packet
+    /// @return Overlay information, if the packet has it
+    std::optional<Camera::UiInfo> FromXmp(const std::string& packet);
+
+    /// @brief Read overlay information stored in JPEG
+    /// @param data JPEG data
+    /// @return Overlay information, if the JPEG has it
+    std::optional<Camera::UiInfo> Read(const Jpeg::Buffer& data);
+}
+
+} // namespace cp
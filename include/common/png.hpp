@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/image.hpp"
+
+namespace cp {
+
+namespace PngConst {
+    // Generated images are mostly flat colour, the default zlib level compresses them well
+    constexpr int CompressionLevel = 6;
+}
+
+/*
+*   Minimal PNG encoder for generated images such as charts, which JPEG would blur.
+*/
+namespace Png {
+    using Buffer = std::vector<uint8_t>;
+    using SharedBuffer = std::shared_ptr<const Buffer>;
+
+    /// @brief Encode image to PNG in memory
+    /// @param image Grayscale or RGB image to encode
+    /// @throw std::invalid_argument if the image is neither grayscale nor RGB
+    /// @throw std::runtime_error if image couldn't be compressed
+    /// @return Encoded image
+    Buffer Encode(const Image& image);
+}
+
+} // namespace cp
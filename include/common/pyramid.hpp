@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+
+#include "common/image.hpp"
+
+namespace cp {
+
+namespace PyramidConst {
+    // Width of the smallest pyramid level
+    constexpr int ThumbnailWidth = 320;
+}
+
+/*
+*   Resolution pyramid of a frame: 1/2, 1/4 and 1/8 of its resolution and a thumbnail.
+*   Every level is a 2x2 box filter of the previous one, so the full frame is read only once.
+*/
+namespace Pyramid {
+    enum class Level {
+        Half,
+        Quarter,
+        Eighth,
+        Thumbnail,
+    };
+    constexpr size_t LevelCount = 4;
+
+    using Levels = std::array<Image, LevelCount>;
+
+    /// @brief Get name of a pyramid level
+    /// @param level The level
+    /// @return Level name
+    const char* LevelName(Level level);
+
+    /// @brief Halve image resolution with 2x2 box filter. Odd last row and column are dropped
+    /// @param image Image to halve
+    /// @return Halved image
+    Image Halve(const Image& image);
+
+    /// @brief Halve resolution of an image region with 2x2 box filter, the region is read from the image's buffer
+    /// @param image The image
+    /// @param region Region to halve, has to lie within the image
+    /// @return Halved region
+    Image Halve(const Image& image, const Region& region);
+
+    /// @brief Resize image down with area filter
+    /// @param image Image to resize
+    /// @param width Width of resized image, not greater than image width
+    /// @param height Height of resized image, not greater than image height
+    /// @return Resized image
+    Image Shrink(const Image& image, int width, int height);
+
+    /// @brief Build resolution pyramid of a frame
+    /// @param image The frame
+    /// @return Pyramid levels, from the largest to the smallest
+    Levels Build(const Image& image);
+
+    /// @brief Build resolution pyramid of a frame region
+    /// @param image The frame
+    /// @param region Region of the frame, has to lie within it
+    /// @return Pyramid levels of the region, from the largest to the smallest
+    Levels Build(const Image& image, const Region& region);
+}
+
+} // namespace cp
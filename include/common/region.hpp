@@ -0,0 +1,15 @@
+#pragma once
+
+namespace cp {
+
+// Rectangle of an image in pixels, used as a view into the image's own buffer
+struct Region {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    auto operator<=>(const Region&) const = default;
+};
+
+} // namespace cp
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <limits>
+
+#include "common/image.hpp"
+
+namespace cp {
+
+namespace SceneConst {
+    // Upper part of the frame is treated as sky
+    constexpr double SkyShare = 0.5;
+
+    // Below this mean luma it's too dark to tell clouds or colour
+    constexpr float MinLuma = 20.0f;
+
+    // Sky is split into square blocks of this size to find cloud edges
+    constexpr int BlockSize = 8;
+
+    // Block with luma standard deviation above this contains cloud edges
+    constexpr float CloudContrast = 6.0f;
+
+    // Clear sky is blue, clouds are grey or white: their red to blue ratio is higher than this
+    constexpr float CloudRedBlueRatio = 0.8f;
+}
+
+/*
+*   Cheap scene metrics of a capture, measured on its smallest pyramid level.
+*   They let weather be correlated with captures without decoding them.
+*/
+namespace Scene {
+    struct Metrics {
+        float skyLuma = std::numeric_limits<float>::quiet_NaN();            // Mean luma of the sky [0; 255]
+        float cloudCover = std::numeric_limits<float>::quiet_NaN();         // Estimated fraction of the sky covered by clouds [0; 1], NaN at night
+        float colorTemperature = std::numeric_limits<float>::quiet_NaN();   // Correlated colour temperature in kelvins, NaN at night
+    };
+
+    /// @brief Calculate luma plane of the top rows of an RGB image
+    /// @param image RGB image
+    /// @param height Count of rows from the top, not greater than image height
+    /// @return Single-channel luma image
+    Image Luma(const Image& image, int height);
+
+    /// @brief Measure scene metrics of a frame
+    /// @param image RGB frame, a small pyramid level is enough
+    /// @param height Count of rows to measure from the top, the rest (such as info bar) is ignored
+    /// @return Scene metrics, all of them are NaN if the image isn't RGB or is empty
+    Metrics Measure(const Image& image, int height);
+}
+
+} // namespace cp
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "common/camera.hpp"
+
+namespace cp {
+
+/*
+*   Camera generating test frames: sky and ground lit by the time of day, a sun crossing the sky and sensor noise.
+*   Frames change every capture and encode like real ones, so the whole capture pipeline can run without hardware.
+*/
+class SyntheticCamera : public Camera {
+private:
+    int m_width;
+    int m_height;
+    std::mutex m_mutex;
+    bool m_on = false;
+    uint64_t m_frame = 0;
+
+public:
+    /// @brief Initialize camera, it's turned off
+    /// @param name Camera name
+    /// @param width Frame width
+    /// @param height Frame height
+    SyntheticCamera(const std::string& name, int width, int height);
+
+private:
+    Image render(int width, int height);
+
+public:
+    void turnOn() override;
+
+    void turnOff() override;
+
+    Image capture() override;
+
+    Image preview() override;
+};
+
+} // namespace cp
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "common/image.hpp"
+
+namespace cp {
+
+/*
+*   Text rendering with the embedded font.
+*   FreeType face is shared, rendering is serialized so that text can be rendered from any thread.
+*/
+namespace Text {
+    /// @brief Render white text on black background
+    /// @param string Text to render
+    /// @param height Text height in pixels
+    /// @throw std::runtime_error if FreeType couldn't be initialized or a character couldn't be rendered
+    /// @return RGB image of the text
+    Image Render(const std::u32string& string, uint32_t height);
+}
+
+} // namespace cp
@@ -33,6 +33,10 @@ namespace Utility {
 
     int ToUnixTimestamp(pt::ptime timestamp);
 
+    int64_t ToUnixMicroseconds(pt::ptime timestamp);
+
+    pt::ptime FromUnixMicroseconds(int64_t microseconds);
+
     bool IsDaylight(pt::ptime timestamp);
 
     std::string ToString(dt::date date);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 #include <deque>
@@ -39,7 +40,7 @@ namespace Display {
 
     private:
         std::deque<Message> m_queue;
-        Capture::Event::Pointer m_nextEvent;
+        std::optional<Capture::Event> m_nextEvent;
 
         mutable std::mutex m_mutex;
         std::mutex m_updateMutex;
@@ -69,7 +70,7 @@ namespace Display {
 
         void showMessage(const Message& message);
 
-        void updateNextEvent(Capture::Event* event);
+        void updateNextEvent(const Capture::Event* event);
 
     public:
         inline operator bool() const {
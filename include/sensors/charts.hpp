@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "common/png.hpp"
+#include "sensors/recorder.hpp"
+
+namespace cp {
+
+namespace Sensors {
+    namespace ChartsConst {
+        constexpr int Width = 800;
+        constexpr int Height = 480;
+
+        // Charts cover at most the whole recorder history, one record is recorded every minute
+        constexpr int MaxHours = RecorderConst::MaxHistorySize / 60;
+        constexpr int DefaultHours = 24;
+
+        // Charts are only invalidated by a new record, so the count of kept ones is bounded instead
+        constexpr size_t MaxCachedCharts = 32;
+
+        constexpr int Margin = 8;
+        constexpr int TextSize = 16;
+
+        // Consecutive records further apart than this aren't connected
+        constexpr int MaxGapMinutes = 5;
+    }
+
+    /*
+    *   PNG charts of recorder history, one panel per field.
+    *   Rendered charts are kept until the recorder appends a record, so repeated requests are served from memory.
+    */
+    class Charts {
+    public:
+        struct Fields {
+            bool temperature = true;
+            bool alternative = true;
+            bool humidity = true;
+            bool pressure = true;
+
+            auto operator<=>(const Fields&) const = default;
+        };
+
+        struct Chart {
+            Png::SharedBuffer data;
+            uint64_t generation = 0;    // Recorder history generation the chart was rendered from
+        };
+
+    private:
+        std::mutex m_mutex;
+        std::map<std::tuple<Location, int, Fields>, Chart> m_charts;
+
+    public:
+        /// @brief Get chart of recorder history, rendered unless it's cached for the current history.
+        ///        Waits for the first record if there is none yet
+        /// @param location Sensors location
+        /// @param hours Charted time window before the last record, in hours [1; MaxHours]
+        /// @param fields Charted fields, at least one
+        /// @throw std::invalid_argument if the window or fields are invalid
+        /// @throw std::runtime_error if the chart couldn't be rendered
+        /// @return The chart
+        Chart get(Location location, int hours, Fields fields);
+    };
+}
+
+} // namespace cp
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
+#include <array>
 #include <memory>
-#include <deque>
 #include <optional>
+#include <span>
+#include <vector>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
@@ -13,6 +16,7 @@ namespace pt = boost::posix_time;
 
 #include <spdlog/spdlog.h>
 
+#include "common/utility.hpp"
 #include "sensors/sensors.hpp"
 
 namespace cp {
@@ -45,11 +49,108 @@ namespace Sensors {
             Record operator-(const Record& other) const;
         };
 
-        using History = std::deque<Record>;
+        /*
+        *   Fixed-capacity ring of records stored by columns: timestamps, a float column per location and field,
+        *   and a validity bitmask per location. Nothing is allocated after construction, the oldest record is overwritten.
+        *   Indices are logical, from the oldest record. A range of a column is at most two contiguous segments,
+        *   split at the same index in every column, so that scans over them vectorize.
+        */
+        class History {
+        public:
+            enum class Field {
+                Temperature,    // BMP280 temperature
+                Alternative,    // AHT20 temperature
+                Humidity,
+                Pressure,
+            };
+
+            static constexpr size_t FieldsCount = 4;
+            static constexpr size_t LocationsCount = 2;
+
+            // The second segment continues the first one, either may be empty
+            template<typename T>
+            using Segments = std::array<std::span<const T>, 2>;
+
+        private:
+            size_t m_capacity;
+            size_t m_first = 0;
+            size_t m_size = 0;
+            std::vector<int64_t> m_timestamps;      // Unix microseconds of local time
+            std::array<std::array<std::vector<float>, FieldsCount>, LocationsCount> m_columns;  // NaN where not valid
+            std::array<std::vector<uint64_t>, LocationsCount> m_valid;
+
+        public:
+            /// @brief Allocate the history
+            /// @param capacity Maximum count of records
+            explicit History(size_t capacity);
+
+            /// @brief Append record, overwriting the oldest one if the history is full
+            /// @param record The record
+            void push(const Record& record);
+
+            /// @brief Reassemble record
+            /// @param index Index of the record, less than size()
+            /// @return The record
+            Record operator[](size_t index) const;
+
+            /// @brief Find the first record not older than the timestamp
+            /// @param timestamp The timestamp
+            /// @return Index of the record, size() if there is none
+            size_t lowerBound(pt::ptime timestamp) const;
+
+            /// @brief Get timestamps of a range of records
+            /// @param first Index of the first record
+            /// @param count Count of records, first + count is at most size()
+            /// @return Unix microseconds of local time
+            Segments<int64_t> timestamps(size_t first, size_t count) const;
+
+            /// @brief Get values of a field in a range of records
+            /// @param location Sensors location
+            /// @param field The field
+            /// @param first Index of the first record
+            /// @param count Count of records, first + count is at most size()
+            /// @return The values, NaN where the location wasn't measured
+            Segments<float> column(Location location, Field field, size_t first, size_t count) const;
+
+            inline pt::ptime timestamp(size_t index) const {
+                return Utility::FromUnixMicroseconds(m_timestamps[physical(index)]);
+            }
+
+            inline bool valid(Location location, size_t index) const {
+                size_t slot = physical(index);
+                return (m_valid[static_cast<size_t>(location)][slot / 64] >> (slot % 64)) & 1;
+            }
+
+            inline Record back() const {
+                return (*this)[m_size - 1];
+            }
+
+            inline size_t size() const {
+                return m_size;
+            }
+
+            inline bool empty() const {
+                return m_size == 0;
+            }
+
+            inline size_t capacity() const {
+                return m_capacity;
+            }
+
+        private:
+            inline size_t physical(size_t index) const {
+                index += m_first;
+                return index >= m_capacity ? index - m_capacity : index;
+            }
+
+            template<typename T>
+            Segments<T> segments(const std::vector<T>& column, size_t first, size_t count) const;
+        };
 
         struct HistoryHandle {
             std::unique_lock<std::mutex> lock;
             const History& history;
+            uint64_t generation;    // Count of records appended since start, the history only changes with it
         };
 
     private:
@@ -62,10 +163,12 @@ namespace Sensors {
     private:
         spdlog::logger m_logger;
         std::mutex m_mutex;
-        std::thread m_thread;
+        std::array<std::mutex, 2> m_busMutexes;    // Recording and snapshots don't use a bus at the same time
         ThreadStatus m_threadStatus = ThreadStatus::Idle;
         std::condition_variable m_cv;
         History m_history;
+        uint64_t m_generation = 0;
+        std::thread m_thread;   // Started last, the other members are initialized by then
 
     private:
         Recorder();
@@ -83,6 +186,10 @@ namespace Sensors {
     public:
         Record last();
 
+        /// @brief Measure both locations now, in parallel, without recording it to the history
+        /// @return The measurement, an optional is empty if its location couldn't be measured
+        Record snapshot();
+
         Record trend(int interval = 60);
 
         HistoryHandle historyHandle();
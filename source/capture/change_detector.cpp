@@ -0,0 +1,99 @@
+#include "capture/change_detector.hpp"
+using namespace cp::Capture::ChangeDetectorConst;
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#include "common/scene.hpp"
+
+namespace cp {
+
+// Sum of absolute differences of two rows of bytes
+static uint32_t SadRow(const uint8_t* left, const uint8_t* right, int width) {
+    int x = 0;
+    uint32_t sum = 0;
+
+#if defined(__ARM_NEON)
+    uint32x4_t accumulator = vdupq_n_u32(0);
+    for (; x + 16 <= width; x += 16) {
+        accumulator = vpadalq_u16(accumulator, vpaddlq_u8(vabdq_u8(vld1q_u8(left + x), vld1q_u8(right + x))));
+    }
+    uint64x2_t pairs = vpaddlq_u32(accumulator);
+    sum = static_cast<uint32_t>(vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+#elif defined(__SSE2__)
+    __m128i accumulator = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i leftVector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + x));
+        __m128i rightVector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + x));
+        accumulator = _mm_add_epi64(accumulator, _mm_sad_epu8(leftVector, rightVector));
+    }
+    sum = static_cast<uint32_t>(_mm_cvtsi128_si32(accumulator) + _mm_cvtsi128_si32(_mm_srli_si128(accumulator, 8)));
+#endif
+
+    for (; x < width; ++x) {
+        sum += static_cast<uint32_t>(std::abs(left[x] - right[x]));
+    }
+    return sum;
+}
+
+Image Capture::ChangeDetector::Prepare(const Image& thumbnail, int height) {
+    height = std::min(height, thumbnail.height());
+    if (thumbnail.spectrum() != 3 || height < MaskSize || thumbnail.width() < MaskSize) {
+        return {};
+    }
+
+    Image luma = Scene::Luma(thumbnail, height);
+    uint64_t sum = 0;
+    for (uint8_t value : luma) {
+        sum += value;
+    }
+
+    // Gain is 8.8 fixed point
+    uint64_t pixels = luma.size();
+    uint32_t gain = static_cast<uint32_t>(std::clamp<uint64_t>((NormalizedLuma * pixels * 256) / std::max<uint64_t>(sum, 1), 256 / MaxGain, 256 * MaxGain));
+    for (uint8_t& value : luma) {
+        value = static_cast<uint8_t>(std::min<uint32_t>((value * gain + 128) >> 8, 255));
+    }
+    return luma;
+}
+
+Capture::ChangeDetector::Change Capture::ChangeDetector::update(TaskId task, const Image& frame) {
+    Change change;
+    Image& previous = m_previousFrames[static_cast<size_t>(task)];
+    if (frame.is_empty()) {
+        return change;
+    }
+    if (previous.width() != frame.width() || previous.height() != frame.height()) {
+        previous = frame;
+        return change;
+    }
+
+    int changed = 0;
+    for (int cellY = 0; cellY < MaskSize; ++cellY) {
+        int top = cellY * frame.height() / MaskSize, bottom = (cellY + 1) * frame.height() / MaskSize;
+        for (int cellX = 0; cellX < MaskSize; ++cellX) {
+            int left = cellX * frame.width() / MaskSize, right = (cellX + 1) * frame.width() / MaskSize;
+            uint64_t sad = 0;
+            for (int y = top; y < bottom; ++y) {
+                sad += SadRow(frame.data(left, y), previous.data(left, y), right - left);
+            }
+
+            if (sad > CellThreshold * (right - left) * (bottom - top)) {
+                change.mask |= Mask(1) << (cellY * MaskSize + cellX);
+                ++changed;
+            }
+        }
+    }
+    change.score = static_cast<float>(changed) / (MaskSize * MaskSize);
+
+    previous = frame;
+    return change;
+}
+
+} // namespace cp
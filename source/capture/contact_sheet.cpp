@@ -0,0 +1,242 @@
+#include "capture/contact_sheet.hpp"
+using namespace cp::Capture::ContactSheetConst;
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <fmt/xchar.h>
+
+#include "capture/layout.hpp"
+#include "capture/storage.hpp"
+#include "common/file_writer.hpp"
+#include "common/stopwatch.hpp"
+#include "common/text.hpp"
+#include "common/utility.hpp"
+
+namespace cp {
+
+static constexpr uint8_t MissingColor[] = { 48, 48, 48 };
+
+// Thumbnail preview of a capture, or the capture itself shrunk if its previews were never saved
+static Image LoadThumbnail(const Capture::ContactSheet::Tile& tile) {
+    Image thumbnail;
+    try {
+        Jpeg::Buffer data = Capture::Storage::ReadPreview(tile.task, tile.entry.timestamp, Pyramid::Level::Thumbnail);
+        thumbnail = Jpeg::Decode(data.data(), data.size());
+    }
+    catch (const std::runtime_error&) {
+        Jpeg::Buffer data = Capture::Storage::Read(tile.task, tile.entry);
+        thumbnail = Jpeg::DecodeToWidth(data.data(), data.size(), TileWidth);
+    }
+
+    if (thumbnail.width() >= TileWidth && thumbnail.height() >= TileHeight) {
+        return thumbnail.width() == TileWidth && thumbnail.height() == TileHeight ? thumbnail : Pyramid::Shrink(thumbnail, TileWidth, TileHeight);
+    }
+    return thumbnail.resize(TileWidth, TileHeight, 1, 3, 3);
+}
+
+static std::u32string CreateLabel(const Capture::ContactSheet::Tile& tile) {
+    pt::time_duration time = Utility::FromUnixMicroseconds(tile.entry.timestamp).time_of_day();
+    std::string task = tile.task == Capture::TaskId::Main ? "" : fmt::format("{} ", Capture::GetTask(tile.task).name);
+    return fmt::format(
+        U"{}{:#02d}:{:#02d}:{:#02d}",
+        std::u32string(task.begin(), task.end()),
+        time.hours(),
+        time.minutes(),
+        time.seconds()
+    );
+}
+
+std::vector<Capture::ContactSheet::Tile> Capture::ContactSheet::Tiles(const Index& index, dt::date date) {
+    Event::Timestamp from = Utility::ToUnixMicroseconds(pt::ptime(date));
+    Event::Timestamp to = Utility::ToUnixMicroseconds(pt::ptime(date + dt::days(1))) - 1;
+
+    std::vector<Tile> tiles;
+    for (TaskId task : SheetTasks) {
+        for (const Index::Entry& entry : index.query(task, from, to, 0, IndexConst::MaxQueryLimit).entries) {
+            tiles.push_back({ task, entry });
+        }
+    }
+
+    std::sort(tiles.begin(), tiles.end(), [](const Tile& left, const Tile& right) {
+        return left.entry.timestamp < right.entry.timestamp;
+    });
+    return tiles;
+}
+
+Jpeg::Buffer Capture::ContactSheet::Generate(const std::vector<Tile>& tiles, dt::date date) {
+    int rows = static_cast<int>((tiles.size() + Columns - 1) / Columns);
+    Image sheet(Margin + Columns * (TileWidth + Margin), TitleHeight + rows * (TileHeight + LabelHeight + Margin) + Margin, 1, 3, 0);
+
+    std::array<size_t, Tasks.size()> counts = {};
+    for (const Tile& tile : tiles) {
+        ++counts[static_cast<size_t>(tile.task)];
+    }
+    std::u32string title = fmt::format(
+        U"{:#02d}.{:#02d}.{:#04d}",
+        static_cast<int>(date.day()),
+        date.month().as_number(),
+        static_cast<int>(date.year())
+    );
+    for (TaskId task : SheetTasks) {
+        std::string count = fmt::format("  {}: {}", GetTask(task).name, counts[static_cast<size_t>(task)]);
+        title += std::u32string(count.begin(), count.end());
+    }
+    Image titleText = Text::Render(title, TitleTextSize);
+    sheet.draw_image(Margin, (TitleHeight - titleText.height()) / 2, titleText);
+
+    /*
+    *   Every tile covers its own part of the sheet, so tiles are drawn by several threads without locking.
+    *   A capture that can't be read leaves a blank tile, the rest of the day is still worth reviewing.
+    */
+    std::atomic<size_t> next = 0;
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+    auto tileFunction = [&]() {
+        for (size_t index = next++; index < tiles.size(); index = next++) {
+            int x = Margin + static_cast<int>(index % Columns) * (TileWidth + Margin);
+            int y = TitleHeight + static_cast<int>(index / Columns) * (TileHeight + LabelHeight + Margin);
+            try {
+                try {
+                    sheet.draw_image(x, y, LoadThumbnail(tiles[index]));
+                }
+                catch (const std::runtime_error&) {
+                    sheet.draw_rectangle(x, y, x + TileWidth - 1, y + TileHeight - 1, MissingColor);
+                }
+
+                Image label = Text::Render(CreateLabel(tiles[index]), LabelTextSize);
+                sheet.draw_image(x, y + TileHeight + (LabelHeight - label.height()) / 2, label);
+            }
+            catch (...) {
+                std::lock_guard lock(exceptionMutex);
+                exception = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t threadCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::max<size_t>(tiles.size(), 1));
+    for (size_t index = 0; index < threadCount; ++index) {
+        threads.emplace_back(tileFunction);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+    return Jpeg::Encode(sheet, Quality);
+}
+
+Capture::ContactSheet::ContactSheet(std::shared_ptr<Index> index)
+    : m_logger(Utility::CreateLogger("contact_sheet"))
+    , m_index(std::move(index)) {
+    m_thread = std::thread(&ContactSheet::contactSheetFunction, this);
+}
+
+Capture::ContactSheet::~ContactSheet() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void Capture::ContactSheet::contactSheetFunction() {
+    try {
+        dt::date sheetDay;
+        while (true) {
+            dt::date currentDay;
+            {
+                std::unique_lock lock(m_mutex);
+                m_cv.wait(lock, [this, &sheetDay]() { return m_stopping || (!m_currentDay.is_not_a_date() && m_currentDay != sheetDay); });
+                if (m_stopping) {
+                    return;
+                }
+                currentDay = m_currentDay;
+            }
+
+            // Days missed while the capture wasn't running are caught up once, the oldest first
+            dt::date day = sheetDay.is_not_a_date() ? currentDay - dt::days(CatchUpDays) : sheetDay;
+            for (; day < currentDay; day += dt::days(1)) {
+                try {
+                    save(day);
+                }
+                catch (const std::runtime_error& error) {
+                    m_logger.error("Couldn't generate contact sheet of {}: \"{}\"", Utility::ToString(day), error.what());
+                }
+
+                std::lock_guard lock(m_mutex);
+                if (m_stopping) {
+                    return;
+                }
+            }
+            sheetDay = currentDay;
+        }
+    }
+    catch (const std::exception& error) {
+        m_logger.critical("Contact sheet thread exception: \"{}\"", error.what());
+        m_logger.critical("Contact sheet thread is terminating");
+    }
+}
+
+bool Capture::ContactSheet::save(dt::date date) {
+    namespace fs = std::filesystem;
+
+    std::string path = Layout::ContactSheetPath(date);
+    if (fs::exists(path)) {
+        return true;
+    }
+
+    std::vector<Tile> tiles = Tiles(*m_index, date);
+    if (tiles.empty()) {
+        return false;
+    }
+
+    Stopwatch stopwatch;
+    Jpeg::Buffer data = Generate(tiles, date);
+
+    fs::create_directories(fs::path(path).parent_path());
+    std::string temporaryPath = path + FileWriterConst::TemporarySuffix;
+    std::ofstream file(temporaryPath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.close();
+
+    std::error_code error;
+    if (file) {
+        fs::rename(temporaryPath, path, error);
+    }
+    if (!file || error) {
+        fs::remove(temporaryPath, error);
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::ContactSheet::save(): "
+            "Couldn't write contact sheet \"{}\"",
+            path
+        ));
+    }
+
+    m_logger.info(
+        "Generated contact sheet \"{}\" of {} capture{} [{}] in {:.1f} s",
+        path, tiles.size(), tiles.size() == 1 ? "" : "s", Utility::ToReadableSize(data.size()), stopwatch.seconds()
+    );
+    return true;
+}
+
+void Capture::ContactSheet::setCurrentDay(dt::date date) {
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_currentDay == date) {
+            return;
+        }
+        m_currentDay = date;
+    }
+    m_cv.notify_all();
+}
+
+} // namespace cp
@@ -1,6 +1,7 @@
 #include "capture/event.hpp"
 using namespace cp::Capture::EventConst;
 
+#include <algorithm>
 #include <fstream>
 #include <stdexcept>
 
@@ -10,98 +11,28 @@ using nlohmann::json;
 #include <fmt/format.h>
 
 #include "common/astronomy.hpp"
-#include "common/config.hpp"
 #include "common/utility.hpp"
 
 namespace cp {
 
-void Capture::Event::Generate(dt::date date, Queue& queue) {
-    /*
-    *   "Main" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 1 real day.
-    *       -> Capture: Evenly, 60 captures every day (one every 24 minutes).
-    */
-    pt::time_duration step = pt::time_duration(24, 0, 0) / 60;
-    for (pt::ptime timestamp = pt::ptime(date) + step / 2; timestamp.date() == date; timestamp += step) {
-        queue.emplace_back(std::make_unique<Event>("Main", "MA", timestamp));
-    }
-
-    /*
-    *   "Midnight" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 60 real days.
-    *       -> Capture: Every midnight, 1 capture every day (one every 24 hours).
-    */
-    queue.emplace_back(std::make_unique<Event>("Midnight", "MN", pt::ptime(date)));
-
-    /*
-    *   "Midday" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 60 real days.
-    *       -> Capture: Every midday, 1 capture every day (one every 24 hours).
-    */
-    queue.emplace_back(std::make_unique<Event>("Midday", "MD", pt::ptime(date, pt::time_duration(12, 0, 0))));
-
-    /*
-    *   "Sunrise" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 60 real days.
-    *       -> Capture: Every sunrise, 1 capture every day.
-    */
-    pt::ptime sunrise = Astronomy::CalculateSunrise(date);
-    queue.emplace_back(std::make_unique<Event>("Sunrise", "SR", sunrise));
-
-    /*
-    *   "Sunset" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 60 real days.
-    *       -> Capture: Every sunset, 1 capture every day.
-    */
-    pt::ptime sunset = Astronomy::CalculateSunset(date);
-    queue.emplace_back(std::make_unique<Event>("Sunset", "SS", sunset));
-
-    /*
-    *   "Day" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 10 real days.
-    *       -> Capture: Evenly between sunrises and sunsets, 6 captures every day.
-    */
-    step = (sunset - sunrise) / 6;
-    for (pt::ptime timestamp = sunrise + step / 2; timestamp < sunset; timestamp += step) {
-        queue.emplace_back(std::make_unique<Event>("Day", "DA", timestamp));
-    }
-
-    /*
-    *   "Night" task:
-    *       -> Target: 60 FPS timelapse where 1 second = 10 real days.
-    *       -> Capture: Evenly between sunsets and sunrises, 6 captures every day.
-    */
-    step = (pt::time_duration(24, 0, 0) - (sunset - sunrise)) / 6;
-    for (pt::ptime timestamp = sunrise - step / 2; timestamp.date().day() == sunrise.date().day(); timestamp -= step) {
-        queue.emplace_back(std::make_unique<Event>("Night", "NI", timestamp));
-    }
-    for (pt::ptime timestamp = sunset + step / 2; timestamp.date().day() == sunset.date().day(); timestamp += step) {
-        queue.emplace_back(std::make_unique<Event>("Night", "NI", timestamp));
-    }
-}
-
-const Capture::Event::Tasks& Capture::Event::GetTasks() {
-    static Tasks tasks;
-    if (tasks.empty()) {
-        Queue queue;
-        Generate(dt::day_clock::local_day(), queue);
-        for (const Event::Pointer& event : queue) {
-            tasks.insert(event->name());
+void Capture::Event::Generate(dt::date date, Schedule& schedule) {
+    const Task::Day day = { date, Astronomy::CalculateSunrise(date), Astronomy::CalculateSunset(date) };
+    for (const Task& task : Tasks) {
+        if (task.generate) {
+            task.generate(day, schedule);
         }
     }
-    return tasks;
 }
 
-Capture::Event::Event(const std::string& name, const std::string& shortName, pt::ptime timestamp)
-    : m_name(name)
-    , m_shortName(shortName)
-    , m_timestamp(timestamp) {}
+Capture::Event::Event(TaskId task, pt::ptime timestamp)
+    : m_timestamp(Utility::ToUnixMicroseconds(timestamp))
+    , m_task(task) {}
 
 Capture::Event::Event(const std::string& filename) {
     std::ifstream file(filename);
     if (!file) {
         throw std::runtime_error(fmt::format(
-            "cp::Capture::Event::save(): "
+            "cp::Capture::Event::Event(): "
             "Couldn't open file \"{}\"",
             filename
         ));
@@ -109,9 +40,16 @@ Capture::Event::Event(const std::string& filename) {
 
     try {
         const json eventJson = json::parse(file);
-        m_name = eventJson.at(Objects::Name);
-        m_shortName = eventJson.at(Objects::ShortName);
-        m_timestamp = pt::from_iso_extended_string(eventJson.at(Objects::Timestamp));
+        const Task* task = FindTask(eventJson.at(Objects::Name).get<std::string>());
+        if (!task) {
+            throw std::runtime_error(fmt::format(
+                "cp::Capture::Event::Event(): "
+                "Unknown event task \"{}\"",
+                eventJson.at(Objects::Name).get<std::string>()
+            ));
+        }
+        m_task = task->id;
+        m_timestamp = Utility::ToUnixMicroseconds(pt::from_iso_extended_string(eventJson.at(Objects::Timestamp)));
     }
     catch (const json::exception&) {
         throw std::runtime_error(fmt::format(
@@ -127,26 +65,12 @@ Capture::Event::Event(const std::string& filename) {
     }
 }
 
-void Capture::Event::save(const std::string& filename) const
-{
-    std::ofstream file(filename);
-    if (!file) {
-        throw std::runtime_error(fmt::format(
-            "cp::Capture::Event::save(): "
-            "Couldn't create file \"{}\"",
-            filename
-        ));
-    }
-
-    json eventJson;
-    eventJson[Objects::Name] = m_name;
-    eventJson[Objects::ShortName] = m_shortName;
-    eventJson[Objects::Timestamp] = pt::to_iso_extended_string(m_timestamp);
-    file << eventJson.dump(4) << '\n';
+pt::ptime Capture::Event::timestamp() const {
+    return Utility::FromUnixMicroseconds(m_timestamp);
 }
 
 std::string Capture::Event::summary(int length) const {
-    std::string result = fmt::format("[#{} {}]", m_id, m_name);
+    std::string result = fmt::format("[#{} {}]", m_id, name());
     if (length <= 0) {
         return result;
     }
@@ -158,8 +82,82 @@ std::string Capture::Event::summary(int length) const {
 
     return fmt::format(
         "[#{} {:>{}}]",
-        m_id, Utility::Truncate(m_name, length - minLength), length - minLength
+        m_id, Utility::Truncate(name(), length - minLength), length - minLength
     );
 }
 
+void Capture::Schedule::push(TaskId task, pt::ptime timestamp) {
+    if (m_end == m_events.size()) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Schedule::push(): "
+            "Schedule is full ({} events)",
+            m_events.size()
+        ));
+    }
+    m_events[m_end++] = Event(task, timestamp);
+}
+
+void Capture::Schedule::sort() {
+    std::sort(begin(), end(), [](const Event& left, const Event& right) { return left.rawTimestamp() < right.rawTimestamp(); });
+    for (size_t index = m_begin; index < m_end; ++index) {
+        m_events[index].setId(static_cast<int>(index - m_begin + 1));
+    }
+}
+
+size_t Capture::Schedule::dropUntil(Event::Timestamp timestamp) {
+    size_t dropped = 0;
+    while (m_begin < m_end && m_events[m_begin].rawTimestamp() <= timestamp) {
+        ++m_begin;
+        ++dropped;
+    }
+    return dropped;
+}
+
+size_t Capture::Schedule::group(int timeReserve) {
+    size_t mapped = 0;
+    for (size_t leader = m_begin; leader < m_end;) {
+        size_t next = leader + 1;
+        for (; next < m_end; ++next) {
+            Event::Timestamp eventsDelta = m_events[next].rawTimestamp() - m_events[leader].rawTimestamp();
+            if (eventsDelta / 1000 > timeReserve)
+                break;
+        }
+
+        m_events[leader].setOverlapping(next - leader - 1);
+        mapped += next - leader - 1;
+        leader = next;
+    }
+    return mapped;
+}
+
+void Capture::Schedule::pop() {
+    if (!empty()) {
+        m_begin += 1 + m_events[m_begin].overlapping();
+    }
+}
+
+size_t Capture::Schedule::size() const {
+    size_t groups = 0;
+    for (size_t index = m_begin; index < m_end; index += 1 + m_events[index].overlapping()) {
+        ++groups;
+    }
+    return groups;
+}
+
+Capture::Schedule::Group Capture::Schedule::operator[](size_t index) const {
+    size_t position = m_begin;
+    for (; index && position < m_end; --index) {
+        position += 1 + m_events[position].overlapping();
+    }
+
+    if (position >= m_end) {
+        throw std::out_of_range(fmt::format(
+            "cp::Capture::Schedule::operator[](): "
+            "Group index is out of range (groups: {})",
+            size()
+        ));
+    }
+    return { m_events.data() + position, 1 + m_events[position].overlapping() };
+}
+
 } // namespace cp
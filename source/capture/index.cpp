@@ -0,0 +1,239 @@
+#include "capture/index.hpp"
+using namespace cp::Capture::IndexConst;
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "capture/journal.hpp"
+#include "common/utility.hpp"
+
+namespace cp {
+
+static bool CompareTimestamps(const Capture::Index::Entry& left, const Capture::Index::Entry& right) {
+    return left.timestamp < right.timestamp;
+}
+
+Capture::Index::Index(const std::string& directory)
+    : m_logger(Utility::CreateLogger("index")) {
+    for (const Task& task : Tasks) {
+        if (!task.directory) {
+            continue;
+        }
+
+        std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>(fmt::format("{}/{}.{}", directory, task.directory, IndexExtension), true);
+        bool valid = false;
+        if (file->size() >= HeaderSize) {
+            const Header* header = reinterpret_cast<const Header*>(file->data());
+            bool legacy = (header->magic == Magic && header->version == LegacyVersion && header->entrySize == LegacyEntrySize);
+            if (legacy && HeaderSize + header->count * LegacyEntrySize <= file->size()) {
+                migrate(*file);
+                header = reinterpret_cast<const Header*>(file->data());
+            }
+
+            valid = (header->magic == Magic && header->version == Version && header->entrySize == sizeof(Entry));
+            valid = valid && (HeaderSize + header->count * sizeof(Entry) <= file->size());
+            if (!valid) {
+                m_logger.warn("Index file \"{}\" is incompatible or corrupted, it will be rebuilt", file->path());
+            }
+        }
+
+        if (!valid) {
+            file->resize(HeaderSize + GrowthEntries * sizeof(Entry));
+            std::memset(file->data(), 0, file->size());
+            Header* header = reinterpret_cast<Header*>(file->data());
+            header->magic = Magic;
+            header->version = Version;
+            header->entrySize = sizeof(Entry);
+            header->count = 0;
+        }
+        m_files[static_cast<size_t>(task.id)] = std::move(file);
+    }
+}
+
+void Capture::Index::migrate(MappedFile& file) {
+    // Entries are copied out first, the file is remapped by resizing
+    size_t count = reinterpret_cast<const Header*>(file.data())->count;
+    std::vector<uint8_t> legacyEntries(file.data() + HeaderSize, file.data() + HeaderSize + count * LegacyEntrySize);
+
+    // Fields missing from old entries keep their defaults
+    size_t capacity = (count / GrowthEntries + 1) * GrowthEntries;
+    file.resize(HeaderSize + capacity * sizeof(Entry));
+    Entry* migrated = reinterpret_cast<Entry*>(file.data() + HeaderSize);
+    for (size_t index = 0; index < count; ++index) {
+        Entry entry;
+        std::memcpy(reinterpret_cast<uint8_t*>(&entry), legacyEntries.data() + index * LegacyEntrySize, LegacyEntrySize);
+        migrated[index] = entry;
+    }
+
+    Header* header = reinterpret_cast<Header*>(file.data());
+    header->version = Version;
+    header->entrySize = sizeof(Entry);
+    m_logger.info("Index file \"{}\" was migrated to version {}", file.path(), Version);
+}
+
+Capture::Index::Header& Capture::Index::header(TaskId task) const {
+    const std::unique_ptr<MappedFile>& file = m_files[static_cast<size_t>(task)];
+    if (!file) {
+        throw std::invalid_argument(fmt::format(
+            "cp::Capture::Index::header(): "
+            "Task \"{}\" is not indexed",
+            GetTask(task).name
+        ));
+    }
+    return *reinterpret_cast<Header*>(file->data());
+}
+
+Capture::Index::Entry* Capture::Index::entries(TaskId task) const {
+    return reinterpret_cast<Entry*>(m_files[static_cast<size_t>(task)]->data() + HeaderSize);
+}
+
+void Capture::Index::append(TaskId task, const Entry& entry) {
+    std::lock_guard lock(m_mutex);
+    size_t count = header(task).count;
+    MappedFile& file = *m_files[static_cast<size_t>(task)];
+    if (HeaderSize + (count + 1) * sizeof(Entry) > file.size()) {
+        file.resize(file.size() + GrowthEntries * sizeof(Entry));
+    }
+
+    // Captures are appended in order, but keep the index sorted if they aren't
+    Entry* begin = entries(task);
+    Entry* position = std::upper_bound(begin, begin + count, entry, CompareTimestamps);
+    std::memmove(position + 1, position, (begin + count - position) * sizeof(Entry));
+    *position = entry;
+    header(task).count = count + 1;
+}
+
+bool Capture::Index::update(TaskId task, const Entry& entry) {
+    std::lock_guard lock(m_mutex);
+    Entry* begin = entries(task);
+    Entry* end = begin + header(task).count;
+    Entry* position = std::lower_bound(begin, end, entry, CompareTimestamps);
+    if (position == end || position->timestamp != entry.timestamp) {
+        return false;
+    }
+
+    *position = entry;
+    return true;
+}
+
+bool Capture::Index::erase(TaskId task, Event::Timestamp timestamp) {
+    std::lock_guard lock(m_mutex);
+    size_t count = header(task).count;
+    Entry* begin = entries(task);
+    Entry* position = std::lower_bound(begin, begin + count, Entry{ timestamp }, CompareTimestamps);
+    if (position == begin + count || position->timestamp != timestamp) {
+        return false;
+    }
+
+    std::memmove(position, position + 1, (begin + count - position - 1) * sizeof(Entry));
+    header(task).count = count - 1;
+    return true;
+}
+
+size_t Capture::Index::synchronize(const std::string& journalPath) {
+    std::array<Event::Timestamp, Tasks.size()> lastTimestamps = {};
+    for (const Task& task : Tasks) {
+        if (task.directory) {
+            std::optional<Entry> entry = last(task.id);
+            lastTimestamps[static_cast<size_t>(task.id)] = entry ? entry->timestamp : 0;
+        }
+    }
+
+    size_t added = 0;
+    Journal::Read(journalPath, [this, &lastTimestamps, &added](const Journal::Record& record) {
+        if (!GetTask(record.task).directory) {
+            return;
+        }
+
+        switch (record.type) {
+            case Journal::RecordType::Capture: {
+                if (record.scheduled > lastTimestamps[static_cast<size_t>(record.task)]) {
+                    append(record.task, { record.scheduled, record.size, record.offset });
+                    ++added;
+                }
+                break;
+            }
+            case Journal::RecordType::Recompressed: {
+                std::optional<Entry> entry = find(record.task, record.scheduled);
+                if (entry && (entry->size != record.size || entry->offset != record.offset)) {
+                    entry->size = record.size;
+                    entry->offset = record.offset;
+                    update(record.task, *entry);
+                }
+                break;
+            }
+            case Journal::RecordType::Removed: {
+                erase(record.task, record.scheduled);
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    });
+
+    if (added) {
+        m_logger.info("Restored {} entr{} from capture journal", added, added == 1 ? "y" : "ies");
+    }
+    return added;
+}
+
+std::optional<Capture::Index::Entry> Capture::Index::find(TaskId task, Event::Timestamp timestamp) const {
+    std::lock_guard lock(m_mutex);
+    const Entry* begin = entries(task);
+    const Entry* end = begin + header(task).count;
+    const Entry* position = std::lower_bound(begin, end, Entry{ timestamp }, CompareTimestamps);
+    if (position == end || position->timestamp != timestamp) {
+        return {};
+    }
+    return *position;
+}
+
+std::optional<Capture::Index::Entry> Capture::Index::last(TaskId task) const {
+    std::lock_guard lock(m_mutex);
+    size_t count = header(task).count;
+    if (count == 0) {
+        return {};
+    }
+    return entries(task)[count - 1];
+}
+
+Capture::Index::QueryResult Capture::Index::query(TaskId task, Event::Timestamp from, Event::Timestamp to, size_t offset, size_t limit, const Filter& filter) const {
+    std::lock_guard lock(m_mutex);
+    const Entry* begin = entries(task);
+    const Entry* end = begin + header(task).count;
+    const Entry* first = std::lower_bound(begin, end, Entry{ from }, CompareTimestamps);
+    const Entry* last = std::upper_bound(first, end, Entry{ to }, CompareTimestamps);
+
+    QueryResult result;
+    if (filter) {
+        // Filtered range has to be scanned to count its entries
+        limit = std::min(limit, MaxQueryLimit);
+        for (const Entry* entry = first; entry != last; ++entry) {
+            if (!filter(*entry)) {
+                continue;
+            }
+            if (result.total >= offset && result.entries.size() < limit) {
+                result.entries.push_back(*entry);
+            }
+            ++result.total;
+        }
+        return result;
+    }
+
+    result.total = static_cast<size_t>(last - first);
+    if (offset >= result.total) {
+        return result;
+    }
+
+    first += offset;
+    last = first + std::min({ limit, MaxQueryLimit, static_cast<size_t>(last - first) });
+    result.entries.assign(first, last);
+    return result;
+}
+
+} // namespace cp
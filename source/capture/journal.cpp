@@ -0,0 +1,427 @@
+#include "capture/journal.hpp"
+using namespace cp::Capture::JournalConst;
+
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef __unix__
+    #include <unistd.h>
+    #include <errno.h>
+#endif
+
+#include <boost/crc.hpp>
+
+#include <fmt/format.h>
+
+#include "common/utility.hpp"
+
+namespace cp {
+
+namespace SensorsFlags {
+    constexpr uint8_t Present = 0b001;
+    constexpr uint8_t External = 0b010;
+    constexpr uint8_t Internal = 0b100;
+}
+
+template <typename Value>
+static void Put(std::vector<uint8_t>& buffer, Value value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(Value));
+}
+
+static void PutMeasurement(std::vector<uint8_t>& buffer, const std::optional<Sensors::Measurement>& measurement) {
+    Sensors::Measurement value = measurement.value_or(Sensors::Measurement{});
+    Put<float>(buffer, static_cast<float>(value.aht20.temperature));
+    Put<float>(buffer, static_cast<float>(value.aht20.humidity));
+    Put<float>(buffer, static_cast<float>(value.bmp280.temperature));
+    Put<float>(buffer, static_cast<float>(value.bmp280.pressure));
+}
+
+/*
+*   Payload reader tolerant to short payloads:
+*   fields missing in records written by older versions are read as zero.
+*/
+class PayloadReader {
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_position = 0;
+
+public:
+    PayloadReader(const uint8_t* data, size_t size)
+        : m_data(data)
+        , m_size(size)
+    {}
+
+public:
+    template <typename Value>
+    Value get() {
+        Value value = {};
+        if (m_position + sizeof(Value) <= m_size) {
+            std::memcpy(&value, m_data + m_position, sizeof(Value));
+        }
+        m_position += sizeof(Value);
+        return value;
+    }
+
+    std::string getString(size_t length) {
+        if (m_position + length > m_size) {
+            m_position = m_size;
+            return {};
+        }
+        std::string string(reinterpret_cast<const char*>(m_data + m_position), length);
+        m_position += length;
+        return string;
+    }
+
+    Sensors::Measurement getMeasurement() {
+        Sensors::Measurement measurement;
+        measurement.aht20.temperature = get<float>();
+        measurement.aht20.humidity = get<float>();
+        measurement.bmp280.temperature = get<float>();
+        measurement.bmp280.pressure = get<float>();
+        measurement.round();
+        return measurement;
+    }
+};
+
+static std::vector<uint8_t> SerializeRecord(const Capture::Journal::Record& record) {
+    std::vector<uint8_t> payload;
+    payload.reserve(128 + record.path.size());
+    Put<uint8_t>(payload, static_cast<uint8_t>(record.type));
+    Put<uint8_t>(payload, static_cast<uint8_t>(record.task));
+    Put<uint16_t>(payload, record.id);
+    Put<int64_t>(payload, record.scheduled);
+    Put<int64_t>(payload, record.actual);
+    Put<uint64_t>(payload, record.size);
+    Put<uint32_t>(payload, record.timings.capture);
+    Put<uint32_t>(payload, record.timings.save);
+
+    uint8_t sensorsFlags = 0;
+    if (record.sensors) {
+        sensorsFlags |= SensorsFlags::Present;
+        sensorsFlags |= record.sensors->external ? SensorsFlags::External : 0;
+        sensorsFlags |= record.sensors->internal ? SensorsFlags::Internal : 0;
+    }
+    Put<uint8_t>(payload, sensorsFlags);
+    Put<int64_t>(payload, record.sensors ? Utility::ToUnixMicroseconds(record.sensors->timestamp) : 0);
+    PutMeasurement(payload, record.sensors ? record.sensors->external : std::nullopt);
+    PutMeasurement(payload, record.sensors ? record.sensors->internal : std::nullopt);
+
+    Put<uint16_t>(payload, static_cast<uint16_t>(record.path.size()));
+    payload.insert(payload.end(), record.path.begin(), record.path.end());
+    Put<uint64_t>(payload, record.offset);
+    Put<uint8_t>(payload, record.quality);
+    return payload;
+}
+
+static Capture::Journal::Record DeserializeRecord(const uint8_t* data, size_t size) {
+    PayloadReader reader(data, size);
+    Capture::Journal::Record record;
+    record.type = static_cast<Capture::Journal::RecordType>(reader.get<uint8_t>());
+    record.task = static_cast<Capture::TaskId>(reader.get<uint8_t>());
+    record.id = reader.get<uint16_t>();
+    record.scheduled = reader.get<int64_t>();
+    record.actual = reader.get<int64_t>();
+    record.size = reader.get<uint64_t>();
+    record.timings.capture = reader.get<uint32_t>();
+    record.timings.save = reader.get<uint32_t>();
+
+    uint8_t sensorsFlags = reader.get<uint8_t>();
+    int64_t sensorsTimestamp = reader.get<int64_t>();
+    Sensors::Measurement external = reader.getMeasurement();
+    Sensors::Measurement internal = reader.getMeasurement();
+    if (sensorsFlags & SensorsFlags::Present) {
+        record.sensors.emplace();
+        record.sensors->timestamp = Utility::FromUnixMicroseconds(sensorsTimestamp);
+        if (sensorsFlags & SensorsFlags::External) {
+            record.sensors->external = external;
+        }
+        if (sensorsFlags & SensorsFlags::Internal) {
+            record.sensors->internal = internal;
+        }
+    }
+
+    record.path = reader.getString(reader.get<uint16_t>());
+    record.offset = reader.get<uint64_t>();
+    record.quality = reader.get<uint8_t>();
+    return record;
+}
+
+// Whether the record is about an event, rather than about an existing capture
+static bool IsEventRecord(const Capture::Journal::Record& record) {
+    return record.type == Capture::Journal::RecordType::Start
+        || record.type == Capture::Journal::RecordType::Capture
+        || record.type == Capture::Journal::RecordType::Expired;
+}
+
+static uint32_t Checksum(const uint8_t* data, size_t size) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+}
+
+/*
+*   Reads records starting at current file position until the first invalid one.
+*   Returns file offset right after the last valid record.
+*/
+static uint64_t ReadRecords(std::ifstream& file, const std::function<void(const Capture::Journal::Record&)>& callback) {
+    std::vector<uint8_t> payload;
+    uint64_t validSize = static_cast<uint64_t>(file.tellg());
+    while (true) {
+        uint32_t length = 0, checksum = 0, trailingLength = 0;
+        if (!file.read(reinterpret_cast<char*>(&length), sizeof(length)) || length > MaxPayloadSize) {
+            break;
+        }
+
+        payload.resize(length);
+        file.read(reinterpret_cast<char*>(payload.data()), length);
+        file.read(reinterpret_cast<char*>(&checksum), sizeof(checksum));
+        file.read(reinterpret_cast<char*>(&trailingLength), sizeof(trailingLength));
+        if (!file || trailingLength != length || Checksum(payload.data(), length) != checksum) {
+            break;
+        }
+
+        callback(DeserializeRecord(payload.data(), length));
+        validSize += FramingSize + length;
+    }
+    return validSize;
+}
+
+static void ReadHeader(std::ifstream& file, const std::string& filePath) {
+    uint32_t header[2] = {};
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != Magic) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal: "
+            "File \"{}\" is not a capture journal",
+            filePath
+        ));
+    }
+
+    if (header[1] > Version) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal: "
+            "Journal \"{}\" version {} is not supported (latest: {})",
+            filePath, header[1], Version
+        ));
+    }
+}
+
+void Capture::Journal::Read(const std::string& filePath, const std::function<void(const Record&)>& callback) {
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::Read(): "
+            "Couldn't open journal file \"{}\"",
+            filePath
+        ));
+    }
+
+    ReadHeader(file, filePath);
+    ReadRecords(file, callback);
+}
+
+Capture::Event Capture::Journal::Record::event() const {
+    Event event(task, Utility::FromUnixMicroseconds(scheduled));
+    event.setId(id);
+    return event;
+}
+
+Capture::Journal::Journal(const std::string& filePath)
+    : m_logger(Utility::CreateLogger("journal"))
+    , m_filePath(filePath) {
+    if (!std::filesystem::exists(m_filePath) || std::filesystem::file_size(m_filePath) == 0) {
+        std::FILE* file = std::fopen(m_filePath.c_str(), "wb");
+        if (!file) {
+            throw std::runtime_error(fmt::format(
+                "cp::Capture::Journal::Journal(): "
+                "Couldn't create journal file \"{}\"",
+                m_filePath
+            ));
+        }
+
+        const uint32_t header[] = { Magic, Version };
+        size_t written = std::fwrite(header, sizeof(header), 1, file);
+        std::fclose(file);
+        if (written != 1) {
+            throw std::runtime_error(fmt::format(
+                "cp::Capture::Journal::Journal(): "
+                "Couldn't write journal file \"{}\" header",
+                m_filePath
+            ));
+        }
+    }
+    else {
+        recover();
+    }
+
+    m_file = std::fopen(m_filePath.c_str(), "ab");
+    if (!m_file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::Journal(): "
+            "Couldn't open journal file \"{}\"",
+            m_filePath
+        ));
+    }
+}
+
+Capture::Journal::~Journal() {
+    try {
+        commit();
+    }
+    catch (const std::runtime_error& error) {
+        m_logger.error("Couldn't commit pending records: {}", error.what());
+    }
+
+    if (m_file) {
+        std::fclose(m_file);
+    }
+}
+
+void Capture::Journal::recover() {
+    std::ifstream file(m_filePath, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::recover(): "
+            "Couldn't open journal file \"{}\"",
+            m_filePath
+        ));
+    }
+
+    uint64_t fileSize = std::filesystem::file_size(m_filePath);
+    ReadHeader(file, m_filePath);
+
+    // Fast path: the tail is intact, only the last record is read
+    std::vector<uint8_t> payload;
+    if (fileSize >= HeaderSize + FramingSize) {
+        uint32_t trailer[2] = {};
+        file.seekg(fileSize - sizeof(trailer));
+        file.read(reinterpret_cast<char*>(trailer), sizeof(trailer));
+
+        uint32_t length = trailer[1];
+        if (file && length <= MaxPayloadSize && HeaderSize + FramingSize + length <= fileSize) {
+            uint32_t leadingLength = 0;
+            payload.resize(length);
+            file.seekg(fileSize - sizeof(trailer) - length - sizeof(leadingLength));
+            file.read(reinterpret_cast<char*>(&leadingLength), sizeof(leadingLength));
+            file.read(reinterpret_cast<char*>(payload.data()), length);
+            if (file && leadingLength == length && Checksum(payload.data(), length) == trailer[0]) {
+                Record record = DeserializeRecord(payload.data(), length);
+                if (IsEventRecord(record)) {
+                    m_last = record;
+                    return;
+                }
+            }
+        }
+    }
+    else if (fileSize == HeaderSize) {
+        return;
+    }
+
+    // Slow path: the tail is torn or isn't an event record, the file is scanned to find the last valid event record
+    file.clear();
+    file.seekg(HeaderSize);
+    uint64_t validSize = ReadRecords(file, [this](const Record& record) {
+        if (IsEventRecord(record)) {
+            m_last = record;
+        }
+    });
+    file.close();
+
+    if (validSize == fileSize) {
+        return;
+    }
+    m_logger.warn(
+        "Journal tail is torn, truncating {} from \"{}\"",
+        Utility::ToReadableSize(fileSize - validSize), m_filePath
+    );
+    std::filesystem::resize_file(m_filePath, validSize);
+}
+
+void Capture::Journal::append(const Record& record) {
+    std::vector<uint8_t> payload = SerializeRecord(record);
+    std::lock_guard lock(m_mutex);
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    Put<uint32_t>(m_pending, length);
+    m_pending.insert(m_pending.end(), payload.begin(), payload.end());
+    Put<uint32_t>(m_pending, Checksum(payload.data(), payload.size()));
+    Put<uint32_t>(m_pending, length);
+
+    m_pendingRecords += 1;
+    if (IsEventRecord(record)) {
+        m_last = record;
+    }
+}
+
+void Capture::Journal::rollback(uint64_t size) {
+    // Closing the file settles bytes of the failed write still buffered by stdio, so none of them land after the truncation
+    std::fclose(m_file);
+    m_file = nullptr;
+
+    std::error_code error;
+    std::filesystem::resize_file(m_filePath, size, error);
+    if (error) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::rollback(): "
+            "Couldn't truncate journal \"{}\" back to {} [error: \"{}\"]",
+            m_filePath, Utility::ToReadableSize(size), error.message()
+        ));
+    }
+
+    m_file = std::fopen(m_filePath.c_str(), "ab");
+    if (!m_file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::rollback(): "
+            "Couldn't reopen journal \"{}\"",
+            m_filePath
+        ));
+    }
+}
+
+void Capture::Journal::commit() {
+    std::lock_guard lock(m_mutex);
+    if (m_pending.empty()) {
+        return;
+    }
+    if (!m_file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::commit(): "
+            "Journal \"{}\" isn't open",
+            m_filePath
+        ));
+    }
+
+    /*
+    *   A failed commit is rolled back to the size the journal had before it, so that the records are written again
+    *   by the next commit as a whole, instead of after a torn copy of themselves.
+    */
+    uint64_t size = std::filesystem::file_size(m_filePath);
+    if (std::fwrite(m_pending.data(), m_pending.size(), 1, m_file) != 1 || std::fflush(m_file) != 0) {
+        rollback(size);
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::commit(): "
+            "Couldn't write {} record{} to journal \"{}\"",
+            m_pendingRecords, m_pendingRecords == 1 ? "" : "s", m_filePath
+        ));
+    }
+
+#ifdef __unix__
+    if (fdatasync(fileno(m_file)) == -1) {
+        int error = errno;
+        rollback(size);
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Journal::commit(): "
+            "Couldn't flush journal \"{}\" [errno: {}]",
+            m_filePath, error
+        ));
+    }
+#endif
+
+    m_pending.clear();
+    m_pendingRecords = 0;
+}
+
+} // namespace cp
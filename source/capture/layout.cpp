@@ -0,0 +1,206 @@
+#include "capture/layout.hpp"
+using namespace cp::Capture::LayoutConst;
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+#include <fmt/format.h>
+
+#include "common/utility.hpp"
+
+namespace cp {
+
+std::string Capture::Layout::TaskDirectory(TaskId task) {
+    return fmt::format("{}/{}", CaptureDirectory, GetTask(task).directory);
+}
+
+std::string Capture::Layout::CapturePath(TaskId task, pt::ptime timestamp) {
+    return CapturePath(Config::Instance->captureLayout(), task, timestamp);
+}
+
+std::string Capture::Layout::CapturePath(Config::CaptureLayout layout, TaskId task, pt::ptime timestamp) {
+    if (layout == Config::CaptureLayout::Sharded) {
+        return fmt::format(
+            "{}/{:#04d}/{:#02d}/{:#02d}/{}.{}",
+            TaskDirectory(task),
+            static_cast<int>(timestamp.date().year()),
+            timestamp.date().month().as_number(),
+            static_cast<int>(timestamp.date().day()),
+            Utility::ToFilename(timestamp),
+            CaptureExtension
+        );
+    }
+
+    return fmt::format(
+        "{}/{}.{}",
+        TaskDirectory(task),
+        Utility::ToFilename(timestamp),
+        CaptureExtension
+    );
+}
+
+std::string Capture::Layout::PackPath(TaskId task, dt::date date) {
+    return PackPath(Config::Instance->captureLayout(), task, date);
+}
+
+std::string Capture::Layout::PackPath(Config::CaptureLayout layout, TaskId task, dt::date date) {
+    std::string filename = fmt::format(
+        "{:#04d}.{:#02d}.{:#02d}.{}",
+        static_cast<int>(date.year()),
+        date.month().as_number(),
+        static_cast<int>(date.day()),
+        PackExtension
+    );
+
+    if (layout == Config::CaptureLayout::Sharded) {
+        return fmt::format(
+            "{}/{:#04d}/{:#02d}/{:#02d}/{}",
+            TaskDirectory(task),
+            static_cast<int>(date.year()),
+            date.month().as_number(),
+            static_cast<int>(date.day()),
+            filename
+        );
+    }
+    return fmt::format("{}/{}", TaskDirectory(task), filename);
+}
+
+std::string Capture::Layout::PreviewDayDirectory(TaskId task, dt::date date) {
+    return fmt::format(
+        "{}/{}/{}/{:#04d}/{:#02d}/{:#02d}",
+        CaptureDirectory,
+        PreviewDirectory,
+        GetTask(task).directory,
+        static_cast<int>(date.year()),
+        date.month().as_number(),
+        static_cast<int>(date.day())
+    );
+}
+
+std::string Capture::Layout::PreviewPath(TaskId task, pt::ptime timestamp, Pyramid::Level level) {
+    return fmt::format(
+        "{}/{}.{}.{}",
+        PreviewDayDirectory(task, timestamp.date()),
+        Utility::ToFilename(timestamp),
+        Pyramid::LevelName(level),
+        CaptureExtension
+    );
+}
+
+std::string Capture::Layout::ContactSheetPath(dt::date date) {
+    return fmt::format(
+        "{}/{}/{:#04d}.{:#02d}.{:#02d}.{}",
+        CaptureDirectory,
+        ContactSheetDirectory,
+        static_cast<int>(date.year()),
+        date.month().as_number(),
+        static_cast<int>(date.day()),
+        CaptureExtension
+    );
+}
+
+Capture::Layout::MigrationResult Capture::Layout::Migrate(Config::CaptureLayout layout, spdlog::logger& logger) {
+    namespace fs = std::filesystem;
+    const boost::regex filenameRegex(R"(^(\d{4})\.(\d{2})\.(\d{2})[ .].+)");
+
+    MigrationResult result;
+    std::vector<std::pair<fs::path, fs::path>> moves;
+    std::vector<fs::path> taskDirectories;
+    for (const Task& task : Tasks) {
+        if (!task.directory) {
+            continue;
+        }
+
+        fs::path taskDirectory = TaskDirectory(task.id);
+        if (!fs::is_directory(taskDirectory)) {
+            continue;
+        }
+        taskDirectories.push_back(taskDirectory);
+
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(taskDirectory)) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+
+            boost::smatch matches;
+            std::string filename = entry.path().filename().string();
+            if (!boost::regex_match(filename, matches, filenameRegex)) {
+                ++result.skipped;
+                continue;
+            }
+
+            fs::path target = taskDirectory;
+            if (layout == Config::CaptureLayout::Sharded) {
+                target /= fs::path(matches.str(1)) / matches.str(2) / matches.str(3);
+            }
+            target /= filename;
+
+            if (target != entry.path()) {
+                moves.emplace_back(entry.path(), target);
+            }
+        }
+    }
+
+    logger.info("Moving {} capture file{}", moves.size(), moves.size() == 1 ? "" : "s");
+    std::atomic<size_t> next = 0, moved = 0, failed = 0;
+    auto moveFunction = [&]() {
+        for (size_t index = next++; index < moves.size(); index = next++) {
+            const auto& [source, target] = moves[index];
+            std::error_code error;
+            fs::create_directories(target.parent_path(), error);
+            if (!error && fs::exists(target)) {
+                error = std::make_error_code(std::errc::file_exists);
+            }
+            if (!error) {
+                fs::rename(source, target, error);
+            }
+
+            if (error) {
+                logger.error("Couldn't move \"{}\" to \"{}\": {}", source.string(), target.string(), error.message());
+                ++failed;
+                continue;
+            }
+            ++moved;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t threadCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::max<size_t>(moves.size(), 1));
+    for (size_t index = 0; index < threadCount; ++index) {
+        threads.emplace_back(moveFunction);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // Remove shard directories left empty, the deepest first
+    std::vector<fs::path> directories;
+    for (const fs::path& taskDirectory : taskDirectories) {
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(taskDirectory)) {
+            if (entry.is_directory()) {
+                directories.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(directories.begin(), directories.end(), [](const fs::path& left, const fs::path& right) {
+        return std::distance(left.begin(), left.end()) > std::distance(right.begin(), right.end());
+    });
+    for (const fs::path& directory : directories) {
+        std::error_code error;
+        if (fs::is_empty(directory, error) && !error) {
+            fs::remove(directory, error);
+        }
+    }
+
+    result.moved = moved;
+    result.failed = failed;
+    return result;
+}
+
+} // namespace cp
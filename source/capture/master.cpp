@@ -1,17 +1,32 @@
 #include "capture/master.hpp"
 using namespace cp::Capture::MasterConst;
+using namespace cp::Capture::LayoutConst;
 
 #include <algorithm>
 #include <filesystem>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <tuple>
+
+#include <boost/asio/post.hpp>
 
 #include "common/config.hpp"
+#include "common/jpeg.hpp"
+#include "common/overlay.hpp"
+#include "common/pyramid.hpp"
+#include "common/scene.hpp"
 #include "common/stopwatch.hpp"
 #include "common/utility.hpp"
 
 namespace cp {
 
-static Capture::Event::Pointer CreateCaptureFilesystem() {
-    if (!std::filesystem::create_directory(CaptureDirectory)) {
+static void CreateCaptureFilesystem() {
+    std::error_code error;
+    std::filesystem::create_directories(CaptureDirectory, error);
+    if (!std::filesystem::is_directory(CaptureDirectory)) {
         throw std::runtime_error(fmt::format(
             "cp::CreateCaptureFilesystem(): "
             "Couldn't create capture directory \"{}/\"",
@@ -19,9 +34,14 @@ static Capture::Event::Pointer CreateCaptureFilesystem() {
         ));
     }
 
-    for (const std::string& task : Capture::Event::GetTasks()) {
-        std::string eventDirectory = fmt::format("{}/{}", CaptureDirectory, task);
-        if (!std::filesystem::create_directory(eventDirectory)) {
+    for (const Capture::Task& task : Capture::Tasks) {
+        if (!task.directory) {
+            continue;
+        }
+
+        std::string eventDirectory = fmt::format("{}/{}", CaptureDirectory, task.directory);
+        std::filesystem::create_directories(eventDirectory, error);
+        if (!std::filesystem::is_directory(eventDirectory)) {
             throw std::runtime_error(fmt::format(
                 "cp::CreateCaptureFilesystem(): "
                 "Couldn't create event directory \"{}/\"",
@@ -29,18 +49,138 @@ static Capture::Event::Pointer CreateCaptureFilesystem() {
             ));
         }
     }
+}
+
+/*
+*   Exposure statistics are sampled on a sparse grid: precise enough for the index and costs almost nothing.
+*   The info bar is excluded if it's burned into the frame.
+*/
+static Capture::Index::Entry CalculateExposure(const Camera::Image& image, bool infoBar) {
+    constexpr int Step = 16;
+    constexpr int ClippedLuma = 250;
+
+    Capture::Index::Entry entry;
+    int height = std::max(image.height() - (infoBar ? CameraConst::Ui::InfoBarHeight : 0), 0);
+    if (image.spectrum() < 3 || height == 0) {
+        return entry;
+    }
+
+    size_t samples = 0, clipped = 0;
+    double lumaSum = 0.0;
+    for (int y = Step / 2; y < height; y += Step) {
+        const uint8_t* red = image.data(0, y, 0, 0);
+        const uint8_t* green = image.data(0, y, 0, 1);
+        const uint8_t* blue = image.data(0, y, 0, 2);
+        for (int x = Step / 2; x < image.width(); x += Step) {
+            int luma = (77 * red[x] + 150 * green[x] + 29 * blue[x]) >> 8;
+            lumaSum += luma;
+            clipped += (luma >= ClippedLuma);
+            ++samples;
+        }
+    }
+
+    if (samples) {
+        entry.meanLuma = static_cast<float>(lumaSum / samples);
+        entry.clipped = static_cast<float>(clipped) / samples;
+    }
+    return entry;
+}
+
+// Overlay metadata is inserted into encoded frame as is, the frame isn't encoded again
+static Jpeg::SharedBuffer AttachOverlay(Jpeg::Buffer data, const std::string& packet) {
+    if (!packet.empty()) {
+        data = Jpeg::InsertXmp(data.data(), data.size(), packet);
+    }
+    return std::make_shared<const Jpeg::Buffer>(std::move(data));
+}
 
-    Capture::Event::Pointer lastEvent = std::make_unique<Capture::Event>("Start", "ST", pt::second_clock::local_time());
-    lastEvent->save(fmt::format("{}/{}", CaptureDirectory, LastEventFile));
-    return lastEvent;
+template <typename Function>
+static std::future<std::invoke_result_t<Function>> Submit(asio::thread_pool& pool, Function function) {
+    std::packaged_task<std::invoke_result_t<Function>()> task(std::move(function));
+    std::future<std::invoke_result_t<Function>> future = task.get_future();
+    asio::post(pool, std::move(task));
+    return future;
 }
 
-static size_t CountOverlappingEvents(const Capture::Event::Pointer& event) {
-    size_t overlappingEvents = 0;
-    for (Capture::Event* overlapping = event->overlapping().get(); overlapping; overlapping = overlapping->overlapping().get()) {
-        ++overlappingEvents;
+// Region of the frame a task captures, the whole frame if the task has none or its region doesn't fit the frame
+static Region TaskRegion(spdlog::logger& logger, Capture::TaskId task, const Image& image) {
+    const std::optional<Region>& region = Config::Instance->region(task);
+    if (!region) {
+        return FullRegion(image);
+    }
+
+    if (!Contains(image, *region)) {
+        logger.error(
+            "Region {}x{}+{}+{} of task \"{}\" doesn't fit frame of {}x{}, the whole frame is captured",
+            region->width, region->height, region->x, region->y, Capture::GetTask(task).name, image.width(), image.height()
+        );
+        return FullRegion(image);
+    }
+    return *region;
+}
+
+// Thumbnail rows of a region analyzed by scene metrics and stabilizer: the info bar is excluded if it's burned into the frame
+static int AnalyzedRows(const Image& thumbnail, const Image& image, const Region& region, bool infoBar) {
+    int visibleRows = region.height;
+    if (infoBar) {
+        int infoBarTop = std::max(image.height() - CameraConst::Ui::InfoBarHeight, 0);
+        visibleRows -= std::clamp(region.y + region.height - infoBarTop, 0, region.height);
+    }
+    return static_cast<int>(static_cast<int64_t>(thumbnail.height()) * visibleRows / std::max(region.height, 1));
+}
+
+// After restart, the first frame of a task is compared with the thumbnail of its latest stored capture
+static void LoadPreviousFrame(spdlog::logger& logger, Capture::ChangeDetector& detector, const Capture::Index& index, Capture::TaskId task, int rows) {
+    std::optional<Capture::Index::Entry> last = index.last(task);
+    if (!last) {
+        return;
+    }
+
+    try {
+        Jpeg::Buffer data = Capture::Storage::ReadPreview(task, last->timestamp, Pyramid::Level::Thumbnail);
+        detector.update(task, Capture::ChangeDetector::Prepare(Jpeg::Decode(data.data(), data.size()), rows));
+    }
+    catch (const std::exception& error) {
+        logger.warn("Couldn't read previous frame of task \"{}\" for change detection: \"{}\"", Capture::GetTask(task).name, error.what());
+    }
+}
+
+// After restart, the reference of a task is rebuilt from thumbnails of its latest stored captures, so corrections continue the previous run
+static void LoadReference(spdlog::logger& logger, Capture::Stabilizer& stabilizer, const Capture::Index& index, Capture::TaskId task, int rows, const Region& region) {
+    constexpr Capture::Event::Timestamp Earliest = std::numeric_limits<Capture::Event::Timestamp>::min();
+    constexpr Capture::Event::Timestamp Latest = std::numeric_limits<Capture::Event::Timestamp>::max();
+    size_t total = index.query(task, Earliest, Latest, 0, 0).total;
+    size_t count = std::min<size_t>(total, Capture::StabilizerConst::ReferenceFrames);
+    for (const Capture::Index::Entry& entry : index.query(task, Earliest, Latest, total - count, count).entries) {
+        try {
+            Jpeg::Buffer data = Capture::Storage::ReadPreview(task, entry.timestamp, Pyramid::Level::Thumbnail);
+            stabilizer.update(task, Capture::Stabilizer::Analyze(Jpeg::Decode(data.data(), data.size()), rows, region));
+        }
+        catch (const std::exception& error) {
+            logger.warn("Couldn't read previous frame of task \"{}\" for stabilization: \"{}\"", Capture::GetTask(task).name, error.what());
+        }
+    }
+}
+
+// Cameras capturing events of a group
+static std::vector<size_t> GroupCameras(Capture::Schedule::Group group) {
+    std::vector<size_t> cameras;
+    for (const Capture::Event& event : group) {
+        size_t camera = Config::Instance->taskCamera(event.task());
+        if (std::find(cameras.begin(), cameras.end(), camera) == cameras.end()) {
+            cameras.push_back(camera);
+        }
     }
-    return overlappingEvents;
+    return cameras;
+}
+
+static Capture::Journal::Record CreateStartRecord(const Capture::Event& event) {
+    Capture::Journal::Record record;
+    record.type = Capture::Journal::RecordType::Start;
+    record.task = event.task();
+    record.id = static_cast<uint16_t>(event.id());
+    record.scheduled = event.rawTimestamp();
+    return record;
 }
 
 static void LogGenerationResult(spdlog::logger& logger, const Capture::Master::GenerationResult& result) {
@@ -79,7 +219,12 @@ static void LogGenerationResult(spdlog::logger& logger, const Capture::Master::G
 Capture::Master::Master(Display::Ui::Pointer displayUi)
     : m_logger(Utility::CreateLogger("master"))
     , m_displayUi(displayUi)
-{}
+    , m_workers(std::max(std::thread::hardware_concurrency(), 1u)) {
+    for (const Config::CameraConfig& camera : Config::Instance->cameras()) {
+        m_cameras.push_back(Camera::Create(camera));
+        m_viewfinders.push_back(std::make_unique<Viewfinder>(*m_cameras.back()));
+    }
+}
 
 Capture::Master::~Master() {
     disable();
@@ -87,14 +232,25 @@ Capture::Master::~Master() {
 
 void Capture::Master::captureFunction() {
     try {
+        // Retention job and storage completions of the previous run use the journal that is about to be reopened
+        m_retention.reset();
+        m_storage.reset();
+
         if (!std::filesystem::is_directory(CaptureDirectory)) {
             m_logger.info("Creating capture filesystem");
-            m_lastEvent = CreateCaptureFilesystem();
-            generateEvents(m_lastEvent->timestamp().date());
+            CreateCaptureFilesystem();
+            m_journal = std::make_unique<Journal>(fmt::format("{}/{}", CaptureDirectory, JournalConst::JournalFile));
+            m_lastEvent = Event(TaskId::Start, pt::second_clock::local_time());
+            m_journal->append(CreateStartRecord(m_lastEvent));
+            m_journal->commit();
         }
         else {
-            for (const std::string& task : Event::GetTasks()) {
-                std::string eventDirectory = fmt::format("{}/{}", CaptureDirectory, task);
+            for (const Task& task : Tasks) {
+                if (!task.directory) {
+                    continue;
+                }
+
+                std::string eventDirectory = fmt::format("{}/{}", CaptureDirectory, task.directory);
                 if (!std::filesystem::is_directory(eventDirectory)) {
                     throw std::runtime_error(fmt::format(
                         "cp::Capture::Master::Master(): "
@@ -103,79 +259,114 @@ void Capture::Master::captureFunction() {
                     ));
                 }
             }
-            m_lastEvent = std::make_unique<Event>(fmt::format("{}/{}", CaptureDirectory, LastEventFile));
 
-            for (dt::date date = m_lastEvent->timestamp().date(), today = dt::day_clock::local_day(); date <= today; date += dt::days(1)) {
-                generateEvents(date);
-                if (date == today) {
-                    LogGenerationResult(m_logger, m_lastGenerationResult);
-                }
-                else if (m_lastGenerationResult.expired) {
-                    m_logger.warn(
-                        "{} event{} expired for [{}]",
-                        m_lastGenerationResult.expired,
-                        m_lastGenerationResult.expired == 1 ? " is" : "s are",
-                        Utility::ToString(date)
-                    );
-                }
+            m_journal = std::make_unique<Journal>(fmt::format("{}/{}", CaptureDirectory, JournalConst::JournalFile));
+            if (m_journal->last()) {
+                m_lastEvent = m_journal->last()->event();
+            }
+            else {
+                std::string legacyFile = fmt::format("{}/{}", CaptureDirectory, LegacyLastEventFile);
+                m_lastEvent = Event(legacyFile);
+                m_journal->append(CreateStartRecord(m_lastEvent));
+                m_journal->commit();
+                m_logger.info("Migrated last event from \"{}\" to capture journal", legacyFile);
             }
         }
 
+        m_storage = std::make_unique<Storage>(Config::Instance->captureStorage());
+        m_timelapse = Config::Instance->timelapse() ? std::make_unique<Timelapse>() : nullptr;
+        {
+            std::shared_ptr<Index> index = std::make_shared<Index>(CaptureDirectory);
+            index->synchronize(fmt::format("{}/{}", CaptureDirectory, JournalConst::JournalFile));
+            std::lock_guard lock(m_mutex);
+            m_index = std::move(index);
+        }
+        catchUp();
+        m_retention = std::make_unique<Retention>(m_index, *m_journal);
+        m_contactSheet = std::make_unique<ContactSheet>(m_index);
+
         while (true) {
-            Event::Pointer& event = m_queue[0];
-            pt::time_duration toEvent = event->timestamp() - pt::microsec_clock::local_time();
+            Schedule::Group group = m_queue.front();
+            const Event& event = group.front();
+            pt::time_duration toEvent = event.timestamp() - pt::microsec_clock::local_time();
             if (toEvent.total_milliseconds() <= Config::Instance->timeReserve()) {
                 m_logger.error(
                     "Event [#{} \"{}\"] is expired, can't sleep [{}]!",
-                    event->id(), event->name(), Utility::ToString(toEvent)
+                    event.id(), event.name(), Utility::ToString(toEvent)
                 );
 
-                capture(std::move(event), true);
-                m_queue.pop_front();
+                expire(group);
+                m_queue.pop();
+                m_journal->commit();
                 continue;
             }
 
             m_logger.info(
                 "Sleeping [{}] to next event [#{} \"{}\"]",
-                Utility::ToString(toEvent), event->id(), event->name()
+                Utility::ToString(toEvent), event.id(), event.name()
             );
-            m_displayUi->updateNextEvent(event.get());
+            m_displayUi->updateNextEvent(&event);
+
+            // Nothing is captured for previous days anymore, their packs and contact sheets are complete
+            m_storage->seal(event.timestamp().date());
+            m_contactSheet->setCurrentDay(event.timestamp().date());
+            m_retention->setNextCapture(event.timestamp());
 
-            if (!sleepToTimestamp(event->timestamp(), true)) {
+            if (!sleepToTimestamp(event.timestamp(), true)) {
                 m_displayUi->updateNextEvent(nullptr);
                 return;
             }
 
-            /* Preparation for capture */
-            m_camera.turnOn();
+            /*
+            *   Preparation for capture.
+            *   Recorder samples once a minute, so sensors are measured again while cameras warm up.
+            *   The snapshot is never waited for: if the previous one is still running, no new one is started.
+            */
+            if (m_snapshot.valid() && m_snapshot.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                m_logger.warn("Previous sensors snapshot isn't finished, no new snapshot is taken");
+            }
+            else {
+                m_snapshot = std::async(std::launch::async, []() {
+                    return Sensors::Recorder::Instance->snapshot();
+                });
+            }
+
+            std::vector<size_t> cameras = GroupCameras(group);
+            std::list<Viewfinder::Pause> pauses;
+            for (size_t camera : cameras) {
+                pauses.emplace_back(*m_viewfinders[camera]);
+                m_cameras[camera]->turnOn();
+            }
 
-            if (!sleepToTimestamp(event->timestamp())) {
+            if (!sleepToTimestamp(event.timestamp())) {
                 m_displayUi->updateNextEvent(nullptr);
                 return;
             }
 
-            size_t overlappingEvents = CountOverlappingEvents(event);
-            if (overlappingEvents) {
+            if (event.overlapping()) {
                 m_logger.info(
                     "Capturing event [#{} \"{}\"] and {} overlapping",
-                    event->id(), event->name(), overlappingEvents
+                    event.id(), event.name(), event.overlapping()
                 );
             }
             else {
                 m_logger.info(
                     "Capturing event [#{} \"{}\"]",
-                    event->id(), event->name()
+                    event.id(), event.name()
                 );
             }
 
             /* The capture */
-            CaptureResult result = capture(std::move(event));
-            m_camera.turnOff();
-            m_queue.pop_front();
+            CaptureResult result = capture(group);
+            for (size_t camera : cameras) {
+                m_cameras[camera]->turnOff();
+            }
+            pauses.clear();
+            m_queue.pop();
 
             Display::Ui::Message message = {
                 {
-                    m_lastEvent->summary(16),
+                    m_lastEvent.summary(16),
                     "Event captured \1"
                 },
                 {
@@ -186,18 +377,19 @@ void Capture::Master::captureFunction() {
                     ),
                     fmt::format(
                         "{:#02d}.{:#02d}.{:#04d} {:#02d}:{:#02d}",
-                        static_cast<int>(m_lastEvent->timestamp().date().day()),
-                        m_lastEvent->timestamp().date().month().as_number(),
-                        static_cast<int>(m_lastEvent->timestamp().date().year()),
-                        m_lastEvent->timestamp().time_of_day().hours(),
-                        m_lastEvent->timestamp().time_of_day().minutes()
+                        static_cast<int>(m_lastEvent.timestamp().date().day()),
+                        m_lastEvent.timestamp().date().month().as_number(),
+                        static_cast<int>(m_lastEvent.timestamp().date().year()),
+                        m_lastEvent.timestamp().time_of_day().hours(),
+                        m_lastEvent.timestamp().time_of_day().minutes()
                     )
                 }
             };
 
             bool justGenerated = false;
             if (m_queue.empty()) {
-                generateEvents(m_lastEvent->timestamp().date() + dt::days(1));
+                generateEvents(m_lastEvent.timestamp().date() + dt::days(1));
+                m_journal->commit();
                 LogGenerationResult(m_logger, m_lastGenerationResult);
                 justGenerated = true;
 
@@ -211,31 +403,32 @@ void Capture::Master::captureFunction() {
                 });
             }
 
-            if (m_queue.size() == 1) {
-                toEvent = m_queue[0]->timestamp() - m_lastEvent->timestamp();
+            size_t groupsLeft = m_queue.size();
+            if (groupsLeft == 1) {
+                toEvent = m_queue[0].front().timestamp() - m_lastEvent.timestamp();
                 message.push_back({
                     fmt::format("LAST {:>11}", fmt::format("in {:#02d}:{:#02d}", toEvent.hours(), toEvent.minutes())),
-                    m_queue[0]->summary(16)
+                    m_queue[0].front().summary(16)
                 });
             }
             else {
                 if (!justGenerated) {
                     message.push_back({
                         "Events left for",
-                        fmt::format("{}:{:>7}", Utility::ToString(m_lastGenerationResult.date), m_queue.size())
+                        fmt::format("{}:{:>7}", Utility::ToString(m_lastGenerationResult.date), groupsLeft)
                     });
                 }
 
-                toEvent = m_queue[0]->timestamp() - m_lastEvent->timestamp();
+                toEvent = m_queue[0].front().timestamp() - m_lastEvent.timestamp();
                 message.push_back({
                     fmt::format("NEXT   in  {:#02d}:{:#02d}", toEvent.hours(), toEvent.minutes()),
-                    m_queue[0]->summary(16)
+                    m_queue[0].front().summary(16)
                 });
 
-                toEvent = m_queue[1]->timestamp() - m_lastEvent->timestamp();
+                toEvent = m_queue[1].front().timestamp() - m_lastEvent.timestamp();
                 message.push_back({
                     fmt::format("THEN   in  {:#02d}:{:#02d}", toEvent.hours(), toEvent.minutes()),
-                    m_queue[1]->summary(16)
+                    m_queue[1].front().summary(16)
                 });
             }
 
@@ -265,89 +458,409 @@ bool Capture::Master::sleepToTimestamp(pt::ptime timestamp, bool subtractTimeRes
     return !(sleepSeconds > 0 && Utility::InterSleep(lock, m_cv, sleepSeconds));
 }
 
-Capture::Master::CaptureResult Capture::Master::capture(Event::Pointer&& event, bool expired) {
+Capture::Master::CaptureResult Capture::Master::capture(Schedule::Group group) {
     CaptureResult result = {};
     Stopwatch stopwatch;
-    Camera::Image image = expired ? Camera::Image() : m_camera.capture({ event->name(), Sensors::Recorder::Instance->last(), Sensors::Recorder::Instance->trend() });
-    for (Event* captureEvent = event.get(); captureEvent; captureEvent = captureEvent->overlapping().get()) {
-        std::string filePath;
-        if (expired) {
-            filePath = fmt::format(
-                "{}/{}/{}.event",
-                CaptureDirectory,
-                captureEvent->name(),
-                Utility::ToFilename(captureEvent->timestamp())
-            );
-            captureEvent->save(filePath);
+    Event::Timestamp captureTimestamp = Utility::ToUnixMicroseconds(pt::microsec_clock::local_time());
+    Sensors::Recorder::Record sensors = Sensors::Recorder::Instance->last();
+    Sensors::Recorder::Record trend = Sensors::Recorder::Instance->trend();
+
+    // Capture isn't delayed by the snapshot, a location it failed to measure keeps the recorded measurement
+    if (m_snapshot.valid() && m_snapshot.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        Sensors::Recorder::Record fresh = m_snapshot.get();
+        sensors.timestamp = fresh.timestamp;
+        if (fresh.external) {
+            sensors.external = fresh.external;
         }
-        else {
-            filePath = fmt::format(
-                "{}/{}/{}.jpeg",
-                CaptureDirectory,
-                captureEvent->name(),
-                Utility::ToFilename(captureEvent->timestamp())
-            );
-            image.save_jpeg(filePath.c_str());
+        if (fresh.internal) {
+            sensors.internal = fresh.internal;
         }
-        
-        result.savedSize += std::filesystem::file_size(filePath);
+    }
+    else {
+        m_logger.warn("Sensors snapshot isn't finished, capturing with the last recorded measurement");
+    }
+
+    // Metadata overlay keeps the frame clean, the info bar is only drawn when the capture is served
+    bool metadata = (Config::Instance->captureOverlay() == Config::CaptureOverlay::Metadata);
+
+    // Overlapping events share the frame, so it's encoded only once per target size and region
+    struct Encoding {
+        Jpeg::SharedBuffer data;
+        int quality = JpegConst::DefaultQuality;
+        size_t time = 0;
+    };
+
+    // Previews of a region and its analysis
+    struct Preview {
+        Storage::Previews levels;
+        int rows = 0;
+        Scene::Metrics scene;
+        Stabilizer::Frame frame;
+        Image luma;
+    };
+
+    // Every camera captures once for all of its events in the group
+    struct Shot {
+        Camera* camera = nullptr;
+        std::vector<const Event*> events;
+        std::vector<Region> regions;
+        Camera::UiInfo info;
+        std::string overlay;
+        Camera::Image image;
+        Index::Entry exposure;
+        std::map<Region, std::future<Preview>> previews;
+        std::map<std::pair<size_t, Region>, std::future<Encoding>> encodings;
+
+        // Workers refer to the shot, so it outlives them even if the capture fails
+        Shot() = default;
+        Shot(Shot&&) = default;
+        ~Shot() {
+            for (auto& [region, preview] : previews) {
+                if (preview.valid()) {
+                    preview.wait();
+                }
+            }
+            for (auto& [key, encoding] : encodings) {
+                if (encoding.valid()) {
+                    encoding.wait();
+                }
+            }
+        }
+    };
+    std::vector<Shot> shots;
+    for (const Event& event : group) {
+        Camera* camera = m_cameras[Config::Instance->taskCamera(event.task())].get();
+        auto shot = std::find_if(shots.begin(), shots.end(), [camera](const Shot& shot) { return shot.camera == camera; });
+        if (shot == shots.end()) {
+            shots.emplace_back();
+            shot = std::prev(shots.end());
+            shot->camera = camera;
+            shot->info = { event.name(), sensors, trend };
+        }
+        shot->events.push_back(&event);
+    }
+
+    // Cameras are triggered at the same moment, each by its own thread
+    std::vector<std::future<Camera::Image>> frames;
+    for (Shot& shot : shots) {
+        frames.push_back(std::async(std::launch::async, [&shot, metadata]() {
+            return metadata ? shot.camera->capture() : shot.camera->capture(shot.info);
+        }));
+    }
+    for (size_t index = 0; index < shots.size(); ++index) {
+        shots[index].image = frames[index].get();
+    }
+
+    Journal::Timings timings;
+    timings.capture = static_cast<uint32_t>(stopwatch.microseconds());
+
+    /*
+    *   Previews and captures of all cameras are encoded by the shared worker pool, frames are never copied:
+    *   regions of tasks are encoded straight from the frame.
+    *   Rate control keeps separate state for every task and a task is captured by one camera only,
+    *   so concurrent encodings never share it.
+    */
+    for (Shot& shot : shots) {
+        shot.overlay = metadata ? Overlay::ToXmp(shot.info) : std::string();
+        shot.exposure = CalculateExposure(shot.image, !metadata);
+        for (const Event* captureEvent : shot.events) {
+            shot.regions.push_back(TaskRegion(m_logger, captureEvent->task(), shot.image));
+        }
+
+        for (const Region& region : shot.regions) {
+            if (shot.previews.count(region)) {
+                continue;
+            }
+
+            shot.previews[region] = Submit(m_workers, [&shot, region, metadata]() {
+                Preview preview;
+                Pyramid::Levels levels = Pyramid::Build(shot.image, region);
+                for (size_t level = 0; level < levels.size(); ++level) {
+                    preview.levels[level] = AttachOverlay(Jpeg::Encode(levels[level], StorageConst::PreviewQuality), shot.overlay);
+                }
+                const Image& thumbnail = levels[static_cast<size_t>(Pyramid::Level::Thumbnail)];
+                preview.rows = AnalyzedRows(thumbnail, shot.image, region, !metadata);
+                preview.scene = Scene::Measure(thumbnail, preview.rows);
+                preview.frame = Stabilizer::Analyze(thumbnail, preview.rows, region);
+                preview.luma = ChangeDetector::Prepare(thumbnail, preview.rows);
+                return preview;
+            });
+        }
+
+        for (size_t index = 0; index < shot.events.size(); ++index) {
+            TaskId task = shot.events[index]->task();
+            size_t targetSize = Config::Instance->targetSize(task);
+            Region region = shot.regions[index];
+            if (shot.encodings.count({ targetSize, region })) {
+                continue;
+            }
+
+            shot.encodings[{ targetSize, region }] = Submit(m_workers, [this, &shot, task, targetSize, region]() {
+                Stopwatch encodeStopwatch;
+                Encoding encoding;
+                if (targetSize) {
+                    RateControl::Result encoded = m_rateControl.encode(task, shot.image, region, targetSize);
+                    encoding.quality = encoded.quality;
+                    encoding.data = AttachOverlay(std::move(encoded.data), shot.overlay);
+                    m_logger.info(
+                        "Encoded with quality {} to {} (target {}, predicted {})",
+                        encoding.quality,
+                        Utility::ToReadableSize(encoding.data->size()),
+                        Utility::ToReadableSize(targetSize),
+                        Utility::ToReadableSize(encoded.predictedSize)
+                    );
+                }
+                else {
+                    encoding.data = AttachOverlay(Jpeg::Encode(shot.image, region), shot.overlay);
+                }
+                encoding.time = encodeStopwatch.microseconds();
+                return encoding;
+            });
+        }
+    }
+
+    // Scene metrics go to the index with captures, the capture is saved even if its previews couldn't be made
+    std::map<std::pair<const Shot*, Region>, Preview> previews;
+    for (Shot& shot : shots) {
+        for (auto& [region, preview] : shot.previews) {
+            try {
+                previews[{ &shot, region }] = preview.get();
+            }
+            catch (const std::exception& error) {
+                m_logger.error("Couldn't make capture previews of camera \"{}\": \"{}\"", shot.camera->name(), error.what());
+            }
+        }
+    }
+
+    // Captures are only journaled and indexed once they are durable, their events are gone from the queue by then
+    struct Saved {
+        Event event;
+        Storage::Location location;
+        Journal::Record record;
+        Index::Entry entry;
+        Jpeg::SharedBuffer data;
+    };
+    std::vector<Saved> saved;
+
+    // Captures are handed over to storage in event order
+    std::map<std::tuple<const Shot*, size_t, Region>, Encoding> encodings;
+    for (const Event& captureEvent : group) {
+        Shot& shot = *std::find_if(shots.begin(), shots.end(), [&captureEvent](const Shot& shot) {
+            return std::find(shot.events.begin(), shot.events.end(), &captureEvent) != shot.events.end();
+        });
+        size_t eventIndex = std::find(shot.events.begin(), shot.events.end(), &captureEvent) - shot.events.begin();
+        size_t targetSize = Config::Instance->targetSize(captureEvent.task());
+        Region region = shot.regions[eventIndex];
+        auto [iterator, inserted] = encodings.try_emplace({ &shot, targetSize, region });
+        if (inserted) {
+            iterator->second = shot.encodings.at({ targetSize, region }).get();
+        }
+        const Encoding& encoding = iterator->second;
+
+        Stopwatch saveStopwatch;
+        Storage::Location location = m_storage->save(captureEvent.task(), captureEvent.timestamp(), encoding.data);
+        timings.save = static_cast<uint32_t>(encoding.time + saveStopwatch.microseconds());
+
+        Journal::Record record;
+        record.type = Journal::RecordType::Capture;
+        record.task = captureEvent.task();
+        record.id = static_cast<uint16_t>(captureEvent.id());
+        record.scheduled = captureEvent.rawTimestamp();
+        record.actual = captureTimestamp;
+        record.size = location.size;
+        record.timings = timings;
+        record.sensors = sensors;
+        record.path = location.path;
+        record.offset = location.offset;
+        record.quality = static_cast<uint8_t>(encoding.quality);
+
+        Index::Entry entry = shot.exposure;
+        entry.timestamp = captureEvent.rawTimestamp();
+        entry.size = location.size;
+        entry.offset = location.offset;
+        if (auto preview = previews.find({ &shot, region }); preview != previews.end()) {
+            entry.skyLuma = preview->second.scene.skyLuma;
+            entry.cloudCover = preview->second.scene.cloudCover;
+            entry.colorTemperature = preview->second.scene.colorTemperature;
+
+            if (!m_stabilizer.hasPrevious(captureEvent.task()) && !preview->second.frame.spectrum.empty()) {
+                LoadReference(m_logger, m_stabilizer, *m_index, captureEvent.task(), preview->second.rows, region);
+            }
+            Stabilizer::Correction correction = m_stabilizer.update(captureEvent.task(), preview->second.frame);
+            entry.gain = correction.gain;
+            entry.shiftX = correction.shiftX;
+            entry.shiftY = correction.shiftY;
+
+            if (!m_changeDetector.hasPrevious(captureEvent.task()) && !preview->second.luma.is_empty()) {
+                LoadPreviousFrame(m_logger, m_changeDetector, *m_index, captureEvent.task(), preview->second.rows);
+            }
+            ChangeDetector::Change change = m_changeDetector.update(captureEvent.task(), preview->second.luma);
+            entry.change = change.score;
+            entry.changeMask = change.mask;
+        }
+        saved.push_back({ captureEvent, location, record, entry, encoding.data });
+        result.savedSize += location.size;
         result.eventsCaptured += 1;
     }
+
+    for (const Shot& shot : shots) {
+        for (size_t index = 0; index < shot.events.size(); ++index) {
+            auto preview = previews.find({ &shot, shot.regions[index] });
+            if (preview == previews.end()) {
+                continue;
+            }
+
+            try {
+                m_storage->savePreviews(shot.events[index]->task(), shot.events[index]->timestamp(), preview->second.levels);
+            }
+            catch (const std::exception& error) {
+                m_logger.error("Couldn't save capture previews of camera \"{}\": \"{}\"", shot.camera->name(), error.what());
+            }
+        }
+    }
+
+    /*
+    *   Journal must never point at capture data that didn't reach storage: captures are journaled and indexed by storage
+    *   completion once they are durable, unsaved events are journaled as expired. Capture thread doesn't wait for it.
+    */
+    m_storage->commit([this, saved = std::move(saved)](std::vector<Storage::Location> failed) {
+        size_t journaled = 0;
+        for (const Saved& capture : saved) {
+            TaskId task = capture.event.task();
+            bool unsaved = std::any_of(failed.begin(), failed.end(), [&capture](const Storage::Location& location) {
+                return location.path == capture.location.path && location.offset == capture.location.offset;
+            });
+            if (unsaved) {
+                m_logger.error("Capture of event [#{} \"{}\"] couldn't be saved to \"{}\"", capture.event.id(), capture.event.name(), capture.location.path);
+                Journal::Record record;
+                record.type = Journal::RecordType::Expired;
+                record.task = task;
+                record.id = static_cast<uint16_t>(capture.event.id());
+                record.scheduled = capture.event.rawTimestamp();
+                m_journal->append(record);
+                continue;
+            }
+
+            m_journal->append(capture.record);
+            m_index->append(task, capture.entry);
+            journaled += 1;
+
+            std::lock_guard lock(m_mutex);
+            m_latestCaptures[static_cast<size_t>(task)] = { task, capture.event.rawTimestamp(), capture.data };
+            if (journaled == 1) {
+                m_latestCapture = m_latestCaptures[static_cast<size_t>(task)];
+            }
+        }
+
+        try {
+            m_journal->commit();
+        }
+        catch (const std::runtime_error& error) {
+            m_logger.error("Couldn't journal {} capture{}: \"{}\"", saved.size(), saved.size() == 1 ? "" : "s", error.what());
+        }
+    });
+
+    if (m_timelapse) {
+        for (const Shot& shot : shots) {
+            for (size_t index = 0; index < shot.events.size(); ++index) {
+                auto preview = previews.find({ &shot, shot.regions[index] });
+                if (preview == previews.end() || !preview->second.levels[static_cast<size_t>(TimelapseConst::FrameLevel)]) {
+                    m_timelapse->skip(shot.events[index]->task());
+                    continue;
+                }
+
+                try {
+                    m_timelapse->append(shot.events[index]->task(), shot.events[index]->rawTimestamp(), preview->second.levels[static_cast<size_t>(TimelapseConst::FrameLevel)]);
+                }
+                catch (const std::runtime_error& error) {
+                    m_logger.error("Couldn't append capture to timelapse: \"{}\"", error.what());
+                }
+            }
+        }
+        m_timelapse->commit();
+    }
+
     result.timeElapsed = stopwatch.milliseconds();
 
-    m_lastEvent = std::move(event);
-    m_lastEvent->save(fmt::format("{}/{}", CaptureDirectory, LastEventFile));
+    m_lastEvent = group.front();
     return result;
 }
 
+size_t Capture::Master::expire(Schedule::Group group) {
+    // Captures of previous groups are journaled by storage completion, expirations must follow them
+    m_storage->flush();
+
+    for (const Event& event : group) {
+        Journal::Record record;
+        record.type = Journal::RecordType::Expired;
+        record.task = event.task();
+        record.id = static_cast<uint16_t>(event.id());
+        record.scheduled = event.rawTimestamp();
+        m_journal->append(record);
+    }
+
+    m_lastEvent = group.front();
+    return group.size();
+}
+
+void Capture::Master::catchUp() {
+    Stopwatch stopwatch;
+    dt::date firstDate = m_lastEvent.timestamp().date();
+    dt::date today = dt::day_clock::local_day();
+
+    /*
+    *   Every event between the last one and now is expired.
+    *   They are all collected in one pass and persisted with a single journal commit.
+    *   Generation continues past today if all of today's events are expired already.
+    */
+    size_t expired = 0;
+    dt::date date = firstDate;
+    for (;; date += dt::days(1)) {
+        generateEvents(date);
+        expired += m_lastGenerationResult.expired;
+        if (date >= today && !m_queue.empty()) {
+            break;
+        }
+    }
+    m_journal->commit();
+
+    if (expired) {
+        m_logger.warn(
+            "{} event{} expired between [{}] and [{}]",
+            expired, expired == 1 ? " is" : "s are",
+            Utility::ToString(firstDate), Utility::ToString(date)
+        );
+    }
+    LogGenerationResult(m_logger, m_lastGenerationResult);
+    m_logger.info("Caught up in {:.1f} ms", stopwatch.milliseconds());
+}
+
 void Capture::Master::generateEvents(dt::date date) {
     // Clear queue and generate events
     m_lastGenerationResult = { date, 0, 0, 0 };
     m_queue.clear();
     Event::Generate(date, m_queue);
 
-    // Sort events and assign IDs
-    std::sort(
-        m_queue.begin(),
-        m_queue.end(),
-        [](const Event::Pointer& left, const Event::Pointer& right) { return left->timestamp() < right->timestamp(); }
-    );
-    for (size_t index = 0, size = m_queue.size(); index < size; ++index) {
-        m_queue[index]->id() = static_cast<int>(index + 1);
-    }
-
-    // Erase already captured events
-    std::erase_if(m_queue, [this](const Event::Pointer& event) { return event->timestamp() <= m_lastEvent->timestamp(); });
-    m_lastGenerationResult.generated = m_queue.size();
+    // Sort events, assign IDs and drop already captured events
+    m_queue.sort();
+    m_queue.dropUntil(m_lastEvent.rawTimestamp());
+    m_lastGenerationResult.generated = m_queue.events();
     if (m_lastGenerationResult.generated == 0) {
         return;
     }
 
     // Manage overlapped events
-    for (size_t masterIndex = 0; masterIndex < m_queue.size() - 1; ++masterIndex) {
-        size_t nextMasterIndex = masterIndex + 1;
-        for (; nextMasterIndex < m_queue.size(); ++nextMasterIndex) {
-            pt::time_duration eventsDelta = m_queue[nextMasterIndex]->timestamp() - m_queue[masterIndex]->timestamp();
-            if (eventsDelta.total_milliseconds() > Config::Instance->timeReserve())
-                break;
-        }
-
-        for (size_t slaveIndex = nextMasterIndex - 1; slaveIndex > masterIndex; --slaveIndex) {
-            m_queue[slaveIndex - 1]->overlapping() = std::move(m_queue[slaveIndex]);
-            m_queue.erase(m_queue.begin() + slaveIndex);
-            ++m_lastGenerationResult.mapped;
-        }
-    }
+    m_lastGenerationResult.mapped = m_queue.group(Config::Instance->timeReserve());
 
     // Manage expired events
     while (!m_queue.empty()) {
-        Event::Pointer& event = m_queue[0];
-        pt::time_duration toEvent = event->timestamp() - pt::microsec_clock::local_time();
+        Schedule::Group group = m_queue.front();
+        pt::time_duration toEvent = group.front().timestamp() - pt::microsec_clock::local_time();
         if (toEvent.total_milliseconds() > Config::Instance->timeReserve())
             break;
 
-        m_lastGenerationResult.expired += capture(std::move(event), true).eventsCaptured;
-        m_queue.pop_front();
+        m_lastGenerationResult.expired += expire(group);
+        m_queue.pop();
     }
 }
 
@@ -359,14 +872,14 @@ void Capture::Master::printQueue() {
     }
 
     size_t eventCount = 0;
-    for (const Event::Pointer& event : m_queue) {
-        size_t overlappingCount = CountOverlappingEvents(event);
-        eventCount += 1 + overlappingCount;
+    for (size_t index = 0, size = m_queue.size(); index < size; ++index) {
+        const Event& event = m_queue[index].front();
+        eventCount += 1 + event.overlapping();
         fmt::print(
             "{:>3} {:<10} {:<16} {:>4}\n",
-            event->id(), event->name(),
-            Utility::ToString(event->timestamp()),
-            overlappingCount ? std::to_string(overlappingCount) : std::string()
+            event.id(), event.name(),
+            Utility::ToString(event.timestamp()),
+            event.overlapping() ? std::to_string(event.overlapping()) : std::string()
         );
     }
     fmt::print("{} event{}\n", eventCount, eventCount == 0 ? "" : "s");
@@ -400,6 +913,9 @@ void Capture::Master::disable() {
     m_cv.notify_one();
     if (m_thread.joinable())
         m_thread.join();
+    m_retention.reset();
+    m_contactSheet.reset();
+    m_storage.reset();
     lock.lock();
 
     m_threadStatus = ThreadStatus::Idle;
@@ -0,0 +1,96 @@
+#include "capture/rate_control.hpp"
+using namespace cp::Capture::RateControlConst;
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace cp {
+
+static Image SampleTiles(const Image& image, const Region& region) {
+    int columns = (region.width / TileSize + TileStep - 1) / TileStep;
+    int rows = (region.height / TileSize + TileStep - 1) / TileStep;
+    if (columns == 0 || rows == 0) {
+        return image.get_crop(region.x, region.y, region.x + region.width - 1, region.y + region.height - 1);
+    }
+
+    // Sampling grid starts in the middle of the first step, so it doesn't stick to the frame edges
+    Image sample(columns * TileSize, rows * TileSize, 1, image.spectrum());
+    int offset = (TileStep / 2) * TileSize;
+    for (int channel = 0; channel < image.spectrum(); ++channel) {
+        for (int row = 0; row < rows; ++row) {
+            int sourceY = region.y + std::min(offset + row * TileStep * TileSize, region.height - TileSize);
+            for (int column = 0; column < columns; ++column) {
+                int sourceX = region.x + std::min(offset + column * TileStep * TileSize, region.width - TileSize);
+                for (int y = 0; y < TileSize; ++y) {
+                    std::memcpy(
+                        sample.data(column * TileSize, row * TileSize + y, 0, channel),
+                        image.data(sourceX, sourceY + y, 0, channel),
+                        TileSize
+                    );
+                }
+            }
+        }
+    }
+    return sample;
+}
+
+Capture::RateControl::RateControl() {
+    m_calibration.fill(1.0);
+}
+
+Capture::RateControl::Result Capture::RateControl::encode(TaskId task, const Image& image, size_t targetSize) {
+    return encode(task, image, FullRegion(image), targetSize);
+}
+
+Capture::RateControl::Result Capture::RateControl::encode(TaskId task, const Image& image, const Region& region, size_t targetSize) {
+    if (!Contains(image, region)) {
+        throw std::invalid_argument(fmt::format(
+            "cp::Capture::RateControl::encode(): "
+            "Region {}x{}+{}+{} doesn't lie within frame of {}x{}",
+            region.width, region.height, region.x, region.y, image.width(), image.height()
+        ));
+    }
+
+    Image sample = SampleTiles(image, region);
+    double sampleScale = static_cast<double>(region.width) * region.height / (static_cast<double>(sample.width()) * sample.height());
+    double& calibration = m_calibration[static_cast<size_t>(task)];
+
+    // Raw estimations by quality, before calibration is applied
+    std::map<int, double> estimations;
+    auto estimate = [&](int quality) {
+        double& estimation = estimations[quality];
+        if (estimation == 0.0) {
+            estimation = Jpeg::Encode(sample, quality).size() * sampleScale;
+        }
+        return estimation * calibration;
+    };
+
+    // Size is monotonic in quality: the highest quality within target is found by binary search
+    int low = MinQuality, high = MaxQuality;
+    if (estimate(MinQuality) <= targetSize) {
+        while (low < high) {
+            int middle = (low + high + 1) / 2;
+            if (estimate(middle) <= targetSize) {
+                low = middle;
+            }
+            else {
+                high = middle - 1;
+            }
+        }
+    }
+
+    Result result;
+    result.quality = low;
+    result.predictedSize = static_cast<size_t>(estimate(low));
+    result.data = Jpeg::Encode(image, region, result.quality);
+
+    double correction = result.data.size() / estimations[low];
+    calibration = std::clamp((1.0 - CalibrationWeight) * calibration + CalibrationWeight * correction, 0.25, 4.0);
+    return result;
+}
+
+} // namespace cp
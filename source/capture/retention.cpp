@@ -0,0 +1,398 @@
+#include "capture/retention.hpp"
+using namespace cp::Capture::RetentionConst;
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#ifdef __linux__
+    #include <unistd.h>
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+#endif
+
+#include <nlohmann/json.hpp>
+using nlohmann::json;
+
+#include <fmt/format.h>
+
+#include "capture/layout.hpp"
+#include "capture/storage.hpp"
+#include "capture/timelapse.hpp"
+#include "common/jpeg.hpp"
+#include "common/stopwatch.hpp"
+#include "common/utility.hpp"
+
+namespace cp {
+
+static void LowerPriority(spdlog::logger& logger) {
+#ifdef __linux__
+    // Linux applies nice value and I/O priority to the calling thread only
+    constexpr int IoprioWhoProcess = 1;
+    constexpr int IoprioClassIdle = 3;
+    constexpr int IoprioClassShift = 13;
+
+    pid_t thread = static_cast<pid_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, thread, 19) == -1) {
+        logger.warn("Couldn't lower CPU priority [errno: {}]", errno);
+    }
+    if (syscall(SYS_ioprio_set, IoprioWhoProcess, thread, IoprioClassIdle << IoprioClassShift) == -1) {
+        logger.warn("Couldn't lower I/O priority [errno: {}]", errno);
+    }
+#endif
+}
+
+static Jpeg::Buffer Recompress(const Jpeg::Buffer& data, const Config::RetentionPolicy& policy) {
+    Image image = Jpeg::Decode(data.data(), data.size(), policy.scale);
+    Jpeg::Buffer recompressed = Jpeg::Encode(image, policy.quality);
+
+    // Overlay of captures with metadata overlay would be lost otherwise
+    std::optional<std::string> overlay = Jpeg::ReadXmp(data.data(), data.size());
+    if (overlay) {
+        recompressed = Jpeg::InsertXmp(recompressed.data(), recompressed.size(), *overlay);
+    }
+    return recompressed;
+}
+
+// Timestamp of the start of the day captures older than the age are before
+static Capture::Event::Timestamp Cutoff(int days) {
+    return Utility::ToUnixMicroseconds(pt::ptime(dt::day_clock::local_day() - dt::days(days)));
+}
+
+static Capture::Journal::Record CreateRecord(Capture::Journal::RecordType type, Capture::TaskId task, Capture::Event::Timestamp timestamp) {
+    Capture::Journal::Record record;
+    record.type = type;
+    record.task = task;
+    record.scheduled = timestamp;
+    return record;
+}
+
+Capture::Retention::Retention(std::shared_ptr<Index> index, Journal& journal)
+    : m_logger(Utility::CreateLogger("retention"))
+    , m_index(std::move(index))
+    , m_journal(journal) {
+    m_thread = std::thread(&Retention::retentionFunction, this);
+}
+
+Capture::Retention::~Retention() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void Capture::Retention::retentionFunction() {
+    try {
+        LowerPriority(m_logger);
+        loadState();
+
+        while (true) {
+            Stopwatch stopwatch;
+            Report report;
+            bool running = true;
+            for (const Task& task : Tasks) {
+                if (!task.directory) {
+                    continue;
+                }
+
+                const Config::RetentionPolicy& policy = Config::Instance->retentionPolicy(task.id);
+                try {
+                    running = (!policy.deleteAfter || removeCaptures(task.id, std::numeric_limits<Event::Timestamp>::min(), Cutoff(policy.deleteAfter) - 1, report));
+                    running = running && (!policy.deleteTimelapsedAfter || removeTimelapsed(task.id, policy, report));
+                    running = running && (!policy.recompressAfter || recompressCaptures(task.id, policy, report));
+                }
+                catch (const std::runtime_error& error) {
+                    m_logger.error("Couldn't apply retention policy of task \"{}\": \"{}\"", task.name, error.what());
+                }
+
+                if (!running) {
+                    break;
+                }
+            }
+
+            if (report.recompressed || report.removed) {
+                m_logger.info(
+                    "Recompressed {} and deleted {} capture{}, reclaimed {} in {:.1f} s",
+                    report.recompressed, report.removed, report.removed == 1 ? "" : "s",
+                    Utility::ToReadableSize(report.reclaimed), stopwatch.seconds()
+                );
+            }
+
+            if (!running || !rest(RunInterval)) {
+                return;
+            }
+        }
+    }
+    catch (const std::exception& error) {
+        m_logger.critical("Retention thread exception: \"{}\"", error.what());
+        m_logger.critical("Retention thread is terminating");
+    }
+}
+
+bool Capture::Retention::waitForWindow() {
+    std::unique_lock lock(m_mutex);
+    while (!m_stopping) {
+        if (!m_nextCapture.is_not_a_date_time()) {
+            pt::ptime windowEnd = m_nextCapture - pt::seconds(QuietPeriod) - pt::milliseconds(Config::Instance->timeReserve());
+            if (pt::microsec_clock::local_time() < windowEnd) {
+                return true;
+            }
+        }
+        m_cv.wait(lock);
+    }
+    return false;
+}
+
+bool Capture::Retention::rest(double seconds) {
+    std::unique_lock lock(m_mutex);
+    m_cv.wait_for(lock, std::chrono::microseconds(static_cast<int64_t>(seconds * 1'000'000)), [this]() { return m_stopping; });
+    return !m_stopping;
+}
+
+void Capture::Retention::loadState() {
+    std::ifstream file(fmt::format("{}/{}", LayoutConst::CaptureDirectory, StateFile));
+    if (!file) {
+        return;
+    }
+
+    try {
+        json stateJson = json::parse(file);
+        for (const Task& task : Tasks) {
+            if (task.directory) {
+                m_recompressed[static_cast<size_t>(task.id)] = stateJson.value(task.name, Event::Timestamp(0));
+            }
+        }
+    }
+    catch (const json::exception&) {
+        m_logger.warn("Couldn't parse retention state file, recompression starts over");
+    }
+}
+
+void Capture::Retention::saveState() {
+    json stateJson;
+    for (const Task& task : Tasks) {
+        if (task.directory) {
+            stateJson[task.name] = m_recompressed[static_cast<size_t>(task.id)];
+        }
+    }
+
+    std::string path = fmt::format("{}/{}", LayoutConst::CaptureDirectory, StateFile);
+    std::string temporaryPath = path + FileWriterConst::TemporarySuffix;
+    {
+        std::ofstream file(temporaryPath);
+        file << stateJson.dump(4) << '\n';
+        if (!file) {
+            m_logger.error("Couldn't write retention state file \"{}\"", temporaryPath);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        m_logger.error("Couldn't replace retention state file \"{}\": {}", path, error.message());
+    }
+}
+
+bool Capture::Retention::removeCaptures(TaskId task, Event::Timestamp from, Event::Timestamp to, Report& report) {
+    while (true) {
+        Index::QueryResult result = m_index->query(task, from, to, 0, IndexConst::MaxQueryLimit);
+        if (result.entries.empty()) {
+            return true;
+        }
+
+        for (const Index::Entry& entry : result.entries) {
+            if (!waitForWindow()) {
+                m_journal.commit();
+                return false;
+            }
+
+            report.reclaimed += Storage::Remove(task, entry);
+            report.reclaimed += Storage::RemovePreviews(task, entry.timestamp);
+            report.removed += 1;
+            m_journal.append(CreateRecord(Journal::RecordType::Removed, task, entry.timestamp));
+            m_index->erase(task, entry.timestamp);
+        }
+        m_journal.commit();
+    }
+}
+
+bool Capture::Retention::removeTimelapsed(TaskId task, const Config::RetentionPolicy& policy, Report& report) {
+    // Timelapse frames are previews: captures are only dropped once their frames reached storage
+    Event::Timestamp cutoff = Cutoff(policy.deleteTimelapsedAfter);
+    for (const Timelapse::Range& range : Timelapse::Coverage(task)) {
+        if (range.first >= cutoff) {
+            break;
+        }
+        if (!removeCaptures(task, range.first, std::min(range.last, cutoff - 1), report)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Capture::Retention::recompressCaptures(TaskId task, const Config::RetentionPolicy& policy, Report& report) {
+    // Captures that are going to be deleted right away aren't recompressed
+    if (policy.deleteAfter && policy.recompressAfter >= policy.deleteAfter) {
+        return true;
+    }
+
+    Event::Timestamp cutoff = Cutoff(policy.recompressAfter);
+    Event::Timestamp& recompressed = m_recompressed[static_cast<size_t>(task)];
+    while (true) {
+        Index::QueryResult first = m_index->query(task, recompressed + 1, cutoff - 1, 0, 1);
+        if (first.entries.empty()) {
+            return true;
+        }
+
+        // Captures are processed day by day: packs are rewritten as a whole
+        dt::date day = Utility::FromUnixMicroseconds(first.entries.front().timestamp).date();
+        Event::Timestamp dayStart = Utility::ToUnixMicroseconds(pt::ptime(day));
+        Event::Timestamp dayEnd = std::min(Utility::ToUnixMicroseconds(pt::ptime(day + dt::days(1))), cutoff);
+        std::vector<Index::Entry> entries = m_index->query(task, dayStart, dayEnd - 1, 0, IndexConst::MaxQueryLimit).entries;
+
+        try {
+            if (!recompressDay(task, policy, entries, report)) {
+                return false;
+            }
+        }
+        catch (const std::runtime_error& error) {
+            m_logger.error(
+                "Couldn't recompress captures of task \"{}\" of [{}]: \"{}\"",
+                GetTask(task).name, Utility::ToString(day), error.what()
+            );
+        }
+
+        recompressed = std::max(recompressed, entries.back().timestamp);
+        saveState();
+    }
+}
+
+bool Capture::Retention::recompressDay(TaskId task, const Config::RetentionPolicy& policy, const std::vector<Index::Entry>& entries, Report& report) {
+    Event::Timestamp& recompressed = m_recompressed[static_cast<size_t>(task)];
+    auto restAfter = [this](const Stopwatch& stopwatch, size_t written) {
+        return rest(std::max(stopwatch.seconds() * (1.0 / WorkShare - 1.0), written / MaxWriteRate));
+    };
+
+    // Standalone capture files are replaced one by one
+    for (const Index::Entry& entry : entries) {
+        if (entry.offset || entry.timestamp <= recompressed) {
+            continue;
+        }
+        if (!waitForWindow()) {
+            return false;
+        }
+
+        Stopwatch stopwatch;
+        size_t written = 0;
+        try {
+            Jpeg::Buffer data = Storage::Read(task, entry);
+            Jpeg::Buffer output = Recompress(data, policy);
+            if (output.size() < data.size()) {
+                if (!waitForWindow()) {
+                    return false;
+                }
+                Storage::Location location = Storage::Replace(task, entry, output);
+                Journal::Record record = CreateRecord(Journal::RecordType::Recompressed, task, entry.timestamp);
+                record.size = location.size;
+                record.path = location.path;
+                m_journal.append(record);
+                m_journal.commit();
+
+                Index::Entry updated = entry;
+                updated.size = location.size;
+                m_index->update(task, updated);
+
+                report.recompressed += 1;
+                report.reclaimed += data.size() - output.size();
+                written = output.size();
+            }
+        }
+        catch (const std::runtime_error& error) {
+            m_logger.warn("Couldn't recompress capture \"{}\": \"{}\"", Storage::Path(task, entry), error.what());
+        }
+
+        recompressed = entry.timestamp;
+        saveState();
+        if (!restAfter(stopwatch, written)) {
+            return false;
+        }
+    }
+
+    // Packed captures are written to a new pack that replaces the old one when it's complete
+    std::vector<Index::Entry> packed;
+    std::copy_if(entries.begin(), entries.end(), std::back_inserter(packed), [](const Index::Entry& entry) { return entry.offset != 0; });
+    if (packed.empty() || packed.back().timestamp <= recompressed) {
+        return true;
+    }
+
+    Storage::PackRewriter rewriter(task, Storage::Path(task, packed.front()));
+    std::vector<Index::Entry> updated;
+    size_t recompressedCount = 0;
+    uint64_t reclaimed = 0;
+    for (const Index::Entry& entry : packed) {
+        if (!waitForWindow()) {
+            return false;
+        }
+
+        Stopwatch stopwatch;
+        Jpeg::Buffer data = Storage::Read(task, entry);
+        Jpeg::Buffer output;
+        if (entry.timestamp > recompressed) {
+            output = Recompress(data, policy);
+        }
+        if (output.empty() || output.size() >= data.size()) {
+            output = std::move(data);
+        }
+        else {
+            recompressedCount += 1;
+            reclaimed += data.size() - output.size();
+        }
+
+        // Recompression takes a while, the window may be over before the capture is written
+        if (!waitForWindow()) {
+            return false;
+        }
+        Storage::Location location = rewriter.append(entry.timestamp, output);
+        updated.push_back(entry);
+        updated.back().offset = location.offset;
+        updated.back().size = location.size;
+        if (!restAfter(stopwatch, output.size())) {
+            return false;
+        }
+    }
+    if (!waitForWindow()) {
+        return false;
+    }
+    rewriter.finish();
+
+    for (const Index::Entry& entry : updated) {
+        Journal::Record record = CreateRecord(Journal::RecordType::Recompressed, task, entry.timestamp);
+        record.size = entry.size;
+        record.offset = entry.offset;
+        record.path = Storage::Path(task, entry);
+        m_journal.append(record);
+        m_index->update(task, entry);
+    }
+    m_journal.commit();
+
+    report.recompressed += recompressedCount;
+    report.reclaimed += reclaimed;
+    return true;
+}
+
+void Capture::Retention::setNextCapture(pt::ptime timestamp) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_nextCapture = timestamp;
+    }
+    m_cv.notify_all();
+}
+
+} // namespace cp
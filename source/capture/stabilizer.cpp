@@ -0,0 +1,181 @@
+#include "capture/stabilizer.hpp"
+using namespace cp::Capture::StabilizerConst;
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
+
+#include "common/pyramid.hpp"
+
+namespace cp {
+
+using Complex = std::complex<float>;
+
+// In-place iterative radix-2 FFT, size of the line is a power of two. Inverse transform isn't scaled
+static void Transform(Complex* line, size_t size, bool inverse) {
+    for (size_t index = 1, reversed = 0; index < size; ++index) {
+        size_t bit = size >> 1;
+        for (; reversed & bit; bit >>= 1) {
+            reversed ^= bit;
+        }
+        reversed ^= bit;
+        if (index < reversed) {
+            std::swap(line[index], line[reversed]);
+        }
+    }
+
+    for (size_t length = 2; length <= size; length <<= 1) {
+        double angle = (inverse ? 2.0 : -2.0) * std::numbers::pi / length;
+        Complex step(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+        for (size_t start = 0; start < size; start += length) {
+            Complex twiddle(1.0f, 0.0f);
+            for (size_t offset = 0; offset < length / 2; ++offset) {
+                Complex even = line[start + offset];
+                Complex odd = line[start + offset + length / 2] * twiddle;
+                line[start + offset] = even + odd;
+                line[start + offset + length / 2] = even - odd;
+                twiddle *= step;
+            }
+        }
+    }
+}
+
+// Rows first, then columns through a buffer so they are transformed contiguously
+static void Transform(std::vector<Complex>& data, int width, int height, bool inverse) {
+    for (int y = 0; y < height; ++y) {
+        Transform(data.data() + static_cast<size_t>(y) * width, width, inverse);
+    }
+
+    std::vector<Complex> column(height);
+    for (int x = 0; x < width; ++x) {
+        for (int y = 0; y < height; ++y) {
+            column[y] = data[static_cast<size_t>(y) * width + x];
+        }
+        Transform(column.data(), height, inverse);
+        for (int y = 0; y < height; ++y) {
+            data[static_cast<size_t>(y) * width + x] = column[y];
+        }
+    }
+}
+
+// Sub-pixel peak position from its neighbours by parabola fit, in [-0.5; 0.5]
+static float RefinePeak(float previous, float peak, float next) {
+    float curvature = previous - 2.0f * peak + next;
+    if (curvature >= 0.0f) {
+        return 0.0f;
+    }
+    return std::clamp(0.5f * (previous - next) / curvature, -0.5f, 0.5f);
+}
+
+Capture::Stabilizer::Frame Capture::Stabilizer::Analyze(const Image& thumbnail, int height, const Region& region) {
+    Frame frame;
+    height = std::min(height, thumbnail.height());
+    if (thumbnail.spectrum() != 3 || height < MinCorrelationSize || thumbnail.width() < MinCorrelationSize) {
+        return frame;
+    }
+
+    frame.width = static_cast<int>(std::bit_floor(static_cast<unsigned int>(std::min(thumbnail.width(), CorrelationSize))));
+    frame.height = static_cast<int>(std::bit_floor(static_cast<unsigned int>(std::min(height, CorrelationSize))));
+    frame.scaleX = static_cast<float>(region.width) / frame.width;
+    frame.scaleY = static_cast<float>(region.height) * height / thumbnail.height() / frame.height;
+
+    Image visible = (height == thumbnail.height() ? thumbnail : thumbnail.get_crop(0, 0, 0, 0, thumbnail.width() - 1, height - 1, 0, 2));
+    Image shrunk = Pyramid::Shrink(visible, frame.width, frame.height);
+
+    size_t pixels = static_cast<size_t>(frame.width) * frame.height;
+    std::vector<float> luma(pixels);
+    double lumaSum = 0.0;
+    for (int y = 0; y < frame.height; ++y) {
+        const uint8_t* red = shrunk.data(0, y, 0, 0);
+        const uint8_t* green = shrunk.data(0, y, 0, 1);
+        const uint8_t* blue = shrunk.data(0, y, 0, 2);
+        for (int x = 0; x < frame.width; ++x) {
+            float value = (77.0f * red[x] + 150.0f * green[x] + 29.0f * blue[x]) / 256.0f;
+            luma[static_cast<size_t>(y) * frame.width + x] = value;
+            lumaSum += value;
+        }
+    }
+    frame.meanLuma = static_cast<float>(lumaSum / pixels);
+
+    // Hann window keeps frame edges from correlating as a strong cross at zero shift
+    std::vector<float> windowX(frame.width), windowY(frame.height);
+    for (int x = 0; x < frame.width; ++x) {
+        windowX[x] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * x / frame.width));
+    }
+    for (int y = 0; y < frame.height; ++y) {
+        windowY[y] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * y / frame.height));
+    }
+
+    frame.spectrum.resize(pixels);
+    for (int y = 0; y < frame.height; ++y) {
+        for (int x = 0; x < frame.width; ++x) {
+            size_t index = static_cast<size_t>(y) * frame.width + x;
+            frame.spectrum[index] = (luma[index] - frame.meanLuma) * windowX[x] * windowY[y];
+        }
+    }
+    Transform(frame.spectrum, frame.width, frame.height, false);
+    return frame;
+}
+
+Capture::Stabilizer::Correction Capture::Stabilizer::update(TaskId task, const Frame& frame) {
+    Correction correction;
+    m_passed[static_cast<size_t>(task)] = true;
+    if (frame.spectrum.empty() || frame.meanLuma < MinLuma) {
+        return correction;
+    }
+
+    std::optional<Reference>& reference = m_references[static_cast<size_t>(task)];
+    if (!reference || reference->width != frame.width || reference->height != frame.height) {
+        reference = Reference{ frame.width, frame.height, std::log(frame.meanLuma), frame.spectrum };
+        return { 1.0f, 0.0f, 0.0f };
+    }
+
+    double logLuma = std::log(frame.meanLuma);
+    correction.gain = static_cast<float>(std::clamp(std::exp(reference->logLuma - logLuma), 1.0 / MaxGain, static_cast<double>(MaxGain)));
+
+    // Normalized cross-power spectrum has a single peak at the translation of the frame
+    std::vector<Complex> correlation(frame.spectrum.size());
+    for (size_t index = 0; index < correlation.size(); ++index) {
+        Complex product = frame.spectrum[index] * std::conj(reference->spectrum[index]);
+        float magnitude = std::abs(product);
+        correlation[index] = magnitude > 1e-6f ? product / magnitude : Complex();
+    }
+    Transform(correlation, frame.width, frame.height, true);
+
+    size_t peak = 0;
+    for (size_t index = 1; index < correlation.size(); ++index) {
+        if (correlation[index].real() > correlation[peak].real()) {
+            peak = index;
+        }
+    }
+
+    int peakX = static_cast<int>(peak % frame.width), peakY = static_cast<int>(peak / frame.width);
+    auto at = [&](int x, int y) {
+        x = (x + frame.width) % frame.width;
+        y = (y + frame.height) % frame.height;
+        return correlation[static_cast<size_t>(y) * frame.width + x].real();
+    };
+    float shiftX = peakX + RefinePeak(at(peakX - 1, peakY), at(peakX, peakY), at(peakX + 1, peakY));
+    float shiftY = peakY + RefinePeak(at(peakX, peakY - 1), at(peakX, peakY), at(peakX, peakY + 1));
+
+    // Correlation is periodic, shifts past the half are negative
+    if (shiftX >= frame.width / 2.0f) {
+        shiftX -= frame.width;
+    }
+    if (shiftY >= frame.height / 2.0f) {
+        shiftY -= frame.height;
+    }
+    correction.shiftX = shiftX * frame.scaleX;
+    correction.shiftY = shiftY * frame.scaleY;
+
+    // Spectrum is linear, so averaging spectra averages the frames
+    constexpr float Weight = 2.0f / (ReferenceFrames + 1);
+    reference->logLuma += Weight * (logLuma - reference->logLuma);
+    for (size_t index = 0; index < frame.spectrum.size(); ++index) {
+        reference->spectrum[index] += Weight * (frame.spectrum[index] - reference->spectrum[index]);
+    }
+    return correction;
+}
+
+} // namespace cp
@@ -0,0 +1,690 @@
+#include "capture/storage.hpp"
+using namespace cp::Capture::StorageConst;
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+
+#ifdef __unix__
+    #include <unistd.h>
+#endif
+
+#include <boost/regex.hpp>
+
+#include <fmt/format.h>
+
+#include "capture/layout.hpp"
+#include "common/utility.hpp"
+
+namespace cp {
+
+struct FrameHeader {
+    uint32_t magic;
+    uint32_t size;
+    int64_t timestamp;
+};
+static_assert(sizeof(FrameHeader) == FrameHeaderSize, "Frame header size is a part of pack file format");
+
+struct Trailer {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t indexOffset;
+};
+static_assert(sizeof(Trailer) == TrailerSize, "Trailer size is a part of pack file format");
+
+static void ReadPackHeader(std::ifstream& file, const std::string& path) {
+    uint32_t header[4] = {};
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != PackMagic) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage: "
+            "File \"{}\" is not a capture pack",
+            path
+        ));
+    }
+
+    if (header[1] > PackVersion) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage: "
+            "Pack \"{}\" version {} is not supported (latest: {})",
+            path, header[1], PackVersion
+        ));
+    }
+}
+
+// Trailer of a sealed pack, empty if the pack isn't sealed
+static std::optional<Trailer> ReadTrailer(std::ifstream& file, uint64_t fileSize) {
+    if (fileSize < PackHeaderSize + TrailerSize) {
+        return {};
+    }
+
+    Trailer trailer = {};
+    file.seekg(fileSize - TrailerSize);
+    if (!file.read(reinterpret_cast<char*>(&trailer), sizeof(trailer)) || trailer.magic != TrailerMagic) {
+        file.clear();
+        return {};
+    }
+
+    if (trailer.indexOffset < PackHeaderSize || trailer.indexOffset + static_cast<uint64_t>(trailer.count) * PackEntrySize + TrailerSize != fileSize) {
+        return {};
+    }
+    return trailer;
+}
+
+// Complete JPEG data ends with EOI marker, unwritten range of a frame reads as zeros or stale data instead
+static constexpr uint8_t EndOfImage[] = { 0xFF, 0xD9 };
+
+// Block size of the search for frames that follow a damaged range of unsealed pack
+static constexpr size_t SearchBlockSize = 1024 * 1024;
+
+// Header of a complete frame at a position of unsealed pack, empty if there isn't one
+static std::optional<FrameHeader> ReadFrame(std::ifstream& file, uint64_t position, uint64_t fileSize) {
+    FrameHeader header = {};
+    file.seekg(position);
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != FrameMagic
+        || header.size < sizeof(EndOfImage) || position + FrameHeaderSize + header.size > fileSize) {
+        file.clear();
+        return {};
+    }
+
+    uint8_t end[sizeof(EndOfImage)] = {};
+    file.seekg(position + FrameHeaderSize + header.size - sizeof(end));
+    if (!file.read(reinterpret_cast<char*>(end), sizeof(end)) || !std::equal(std::begin(end), std::end(end), std::begin(EndOfImage))) {
+        file.clear();
+        return {};
+    }
+    return header;
+}
+
+// Position of the first complete frame after a position of unsealed pack, empty if there isn't one
+static std::optional<uint64_t> FindFrame(std::ifstream& file, uint64_t position, uint64_t fileSize) {
+    const char* magic = reinterpret_cast<const char*>(&FrameMagic);
+    std::vector<char> block(SearchBlockSize);
+    while (position + FrameHeaderSize <= fileSize) {
+        size_t size = static_cast<size_t>(std::min<uint64_t>(block.size(), fileSize - position));
+        file.seekg(position);
+        if (!file.read(block.data(), size)) {
+            file.clear();
+            return {};
+        }
+
+        auto blockEnd = block.begin() + size;
+        for (auto found = std::search(block.begin(), blockEnd, magic, magic + sizeof(FrameMagic)); found != blockEnd; found = std::search(found + 1, blockEnd, magic, magic + sizeof(FrameMagic))) {
+            uint64_t candidate = position + static_cast<uint64_t>(found - block.begin());
+            if (ReadFrame(file, candidate, fileSize)) {
+                return candidate;
+            }
+        }
+
+        // Blocks overlap, so that magic crossing a block boundary is found too
+        if (size < block.size()) {
+            break;
+        }
+        position += size - (sizeof(FrameMagic) - 1);
+    }
+    return {};
+}
+
+// Locations of failed writes: frames of packs are written from their header, previews aren't captures but are reported too
+static std::vector<Capture::Storage::Location> Locate(const std::vector<FileWriter::Failure>& failures) {
+    std::vector<Capture::Storage::Location> locations;
+    for (const FileWriter::Failure& failure : failures) {
+        locations.push_back({ failure.path, failure.create ? 0 : failure.offset + FrameHeaderSize, 0 });
+    }
+    return locations;
+}
+
+std::string Capture::Storage::Path(TaskId task, const Index::Entry& entry) {
+    pt::ptime timestamp = Utility::FromUnixMicroseconds(entry.timestamp);
+    if (entry.offset) {
+        return Layout::PackPath(task, timestamp.date());
+    }
+    return Layout::CapturePath(task, timestamp);
+}
+
+std::optional<Capture::Storage::PackEntry> Capture::Storage::LocateFrame(std::ifstream& file, const Index::Entry& entry) {
+    FrameHeader header = {};
+    if (entry.offset >= PackHeaderSize + FrameHeaderSize && file.seekg(entry.offset - FrameHeaderSize) && file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        && header.magic == FrameMagic && header.timestamp == entry.timestamp && header.size == entry.size) {
+        return PackEntry{ entry.timestamp, entry.offset, entry.size };
+    }
+
+    // Size of the opened file, the path may already name another one
+    file.clear();
+    file.seekg(0, std::ios::end);
+    std::optional<Trailer> trailer = ReadTrailer(file, static_cast<uint64_t>(file.tellg()));
+    if (!trailer) {
+        return {};
+    }
+
+    std::vector<PackEntry> entries(trailer->count);
+    file.seekg(trailer->indexOffset);
+    if (!file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(PackEntry))) {
+        return {};
+    }
+
+    auto frame = std::lower_bound(entries.begin(), entries.end(), entry.timestamp, [](const PackEntry& packEntry, Event::Timestamp timestamp) {
+        return packEntry.timestamp < timestamp;
+    });
+    if (frame == entries.end() || frame->timestamp != entry.timestamp) {
+        return {};
+    }
+    return *frame;
+}
+
+Jpeg::Buffer Capture::Storage::Read(TaskId task, const Index::Entry& entry) {
+    std::string path = Path(task, entry);
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::Read(): "
+            "Couldn't open file \"{}\"",
+            path
+        ));
+    }
+
+    /*
+    *   Pack may be replaced by its rewritten version before the index is updated, or while it's being read.
+    *   The opened file stays the same one until it's closed, and the frame is found by its timestamp
+    *   if the entry doesn't point at it anymore.
+    */
+    PackEntry frame = { entry.timestamp, entry.offset, entry.size };
+    if (entry.offset) {
+        std::optional<PackEntry> located = LocateFrame(file, entry);
+        if (!located) {
+            throw std::runtime_error(fmt::format(
+                "cp::Capture::Storage::Read(): "
+                "Couldn't find capture in pack \"{}\" [timestamp: {}]",
+                path, entry.timestamp
+            ));
+        }
+        frame = *located;
+    }
+
+    Jpeg::Buffer data(frame.size);
+    file.seekg(frame.offset);
+    if (!file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::Read(): "
+            "Couldn't read {} bytes at offset {} of \"{}\"",
+            frame.size, frame.offset, path
+        ));
+    }
+    return data;
+}
+
+Jpeg::Buffer Capture::Storage::ReadPreview(TaskId task, Event::Timestamp timestamp, Pyramid::Level level) {
+    std::string path = Layout::PreviewPath(task, Utility::FromUnixMicroseconds(timestamp), level);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::ReadPreview(): "
+            "Couldn't open file \"{}\"",
+            path
+        ));
+    }
+
+    Jpeg::Buffer data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::ReadPreview(): "
+            "Couldn't read \"{}\"",
+            path
+        ));
+    }
+    return data;
+}
+
+uint64_t Capture::Storage::RemovePreviews(TaskId task, Event::Timestamp timestamp) {
+    pt::ptime time = Utility::FromUnixMicroseconds(timestamp);
+    uint64_t removed = 0;
+    for (size_t level = 0; level < Pyramid::LevelCount; ++level) {
+        std::string path = Layout::PreviewPath(task, time, static_cast<Pyramid::Level>(level));
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(path, error);
+        if (!error && std::filesystem::remove(path, error)) {
+            removed += size;
+        }
+    }
+
+    // Day directory is removed together with its last previews, it fails while the directory isn't empty
+    std::error_code error;
+    std::filesystem::remove(Layout::PreviewDayDirectory(task, time.date()), error);
+    return removed;
+}
+
+Capture::Storage::PackRewriter::PackRewriter(TaskId task, const std::string& path)
+    : m_path(path)
+    , m_temporaryPath(path + FileWriterConst::TemporarySuffix) {
+    m_file = std::fopen(m_temporaryPath.c_str(), "wb");
+    const uint32_t header[] = { PackMagic, PackVersion, static_cast<uint32_t>(task), 0 };
+    if (!m_file || std::fwrite(header, sizeof(header), 1, m_file) != 1) {
+        if (m_file) {
+            std::fclose(m_file);
+            std::filesystem::remove(m_temporaryPath);
+        }
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::PackRewriter::PackRewriter(): "
+            "Couldn't create pack \"{}\"",
+            m_temporaryPath
+        ));
+    }
+    m_size = PackHeaderSize;
+}
+
+Capture::Storage::PackRewriter::~PackRewriter() {
+    if (m_file) {
+        std::fclose(m_file);
+        std::error_code error;
+        std::filesystem::remove(m_temporaryPath, error);
+    }
+}
+
+Capture::Storage::Location Capture::Storage::PackRewriter::append(Event::Timestamp timestamp, const Jpeg::Buffer& data) {
+    // Every capture is flushed as it's written, so that sealing doesn't flush the whole pack at once
+    FrameHeader header = { FrameMagic, static_cast<uint32_t>(data.size()), timestamp };
+    bool written = std::fwrite(&header, sizeof(header), 1, m_file) == 1 && (data.empty() || std::fwrite(data.data(), data.size(), 1, m_file) == 1);
+    written = written && std::fflush(m_file) == 0;
+#ifdef __unix__
+    written = written && fdatasync(fileno(m_file)) == 0;
+#endif
+    if (!written) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::PackRewriter::append(): "
+            "Couldn't write pack \"{}\"",
+            m_temporaryPath
+        ));
+    }
+
+    PackEntry entry = { timestamp, m_size + FrameHeaderSize, data.size() };
+    m_entries.push_back(entry);
+    m_size += FrameHeaderSize + data.size();
+    return { m_path, entry.offset, entry.size };
+}
+
+void Capture::Storage::PackRewriter::finish() {
+    Trailer trailer = { TrailerMagic, static_cast<uint32_t>(m_entries.size()), m_size };
+    bool written = m_entries.empty() || std::fwrite(m_entries.data(), sizeof(PackEntry), m_entries.size(), m_file) == m_entries.size();
+    written = written && std::fwrite(&trailer, sizeof(trailer), 1, m_file) == 1 && std::fflush(m_file) == 0;
+#ifdef __unix__
+    written = written && fdatasync(fileno(m_file)) == 0;
+#endif
+    written = (std::fclose(m_file) == 0) && written;
+    m_file = nullptr;
+
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(m_temporaryPath, m_path, error);
+    }
+    if (!written || error) {
+        std::filesystem::remove(m_temporaryPath, error);
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::PackRewriter::finish(): "
+            "Couldn't replace pack \"{}\"",
+            m_path
+        ));
+    }
+}
+
+Capture::Storage::Location Capture::Storage::Replace(TaskId task, const Index::Entry& entry, const Jpeg::Buffer& data) {
+    std::string path = Path(task, entry);
+    std::string temporaryPath = path + FileWriterConst::TemporarySuffix;
+    std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+    bool written = file && (data.empty() || std::fwrite(data.data(), data.size(), 1, file) == 1) && std::fflush(file) == 0;
+#ifdef __unix__
+    written = written && fdatasync(fileno(file)) == 0;
+#endif
+    if (file) {
+        written = (std::fclose(file) == 0) && written;
+    }
+
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+    if (!written || error) {
+        std::filesystem::remove(temporaryPath, error);
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::Replace(): "
+            "Couldn't replace capture file \"{}\"",
+            path
+        ));
+    }
+    return { path, 0, data.size() };
+}
+
+uint64_t Capture::Storage::Remove(TaskId task, const Index::Entry& entry) {
+    std::string path = Path(task, entry);
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    if (error || !std::filesystem::remove(path, error)) {
+        return 0;
+    }
+    return size;
+}
+
+Capture::Storage::Storage(Config::CaptureStorage type)
+    : m_logger(Utility::CreateLogger("storage"))
+    , m_type(type) {
+    namespace fs = std::filesystem;
+    const boost::regex packRegex(fmt::format(R"(^(\d{{4}})\.(\d{{2}})\.(\d{{2}})\.{}$)", LayoutConst::PackExtension));
+    const dt::date today = dt::day_clock::local_day();
+
+    /*
+    *   Packs are sealed when their day is over, but the day may end while capture isn't running.
+    *   Packs of previous days are looked for in every layout: storage type and layout may have changed since.
+    */
+    for (const Task& task : Tasks) {
+        std::string taskDirectory = task.directory ? Layout::TaskDirectory(task.id) : std::string();
+        if (taskDirectory.empty() || !fs::is_directory(taskDirectory)) {
+            continue;
+        }
+
+        std::vector<fs::path> temporaryFiles;
+        fs::path previewDirectory = fs::path(LayoutConst::CaptureDirectory) / LayoutConst::PreviewDirectory / task.directory;
+        if (fs::is_directory(previewDirectory)) {
+            for (const fs::directory_entry& entry : fs::recursive_directory_iterator(previewDirectory)) {
+                if (entry.is_regular_file() && entry.path().extension() == FileWriterConst::TemporarySuffix) {
+                    temporaryFiles.push_back(entry.path());
+                }
+            }
+        }
+
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(taskDirectory)) {
+            if (entry.is_regular_file() && entry.path().extension() == FileWriterConst::TemporarySuffix) {
+                temporaryFiles.push_back(entry.path());
+                continue;
+            }
+
+            boost::smatch matches;
+            std::string filename = entry.path().filename().string();
+            if (!entry.is_regular_file() || !boost::regex_match(filename, matches, packRegex)) {
+                continue;
+            }
+
+            Pack pack;
+            try {
+                pack.date = dt::date(std::stoi(matches.str(1)), std::stoi(matches.str(2)), std::stoi(matches.str(3)));
+            }
+            catch (const std::out_of_range&) {
+                continue;
+            }
+
+            pack.path = entry.path().string();
+            std::ifstream file(pack.path, std::ios::binary);
+            if (pack.date >= today || ReadTrailer(file, fs::file_size(pack.path))) {
+                continue;
+            }
+            file.close();
+
+            m_logger.warn("Pack \"{}\" of a previous day is not sealed", pack.path);
+            pack.entries = recoverPack(pack.path);
+            pack.size = fs::file_size(pack.path);
+            pack.open = true;
+            sealPack(pack);
+        }
+
+        // Captures that weren't completely written when power was lost
+        for (const fs::path& path : temporaryFiles) {
+            m_logger.warn("Removing incomplete capture \"{}\"", path.string());
+            fs::remove(path);
+        }
+    }
+}
+
+std::vector<Capture::Storage::PackEntry> Capture::Storage::recoverPack(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::recoverPack(): "
+            "Couldn't open pack \"{}\"",
+            path
+        ));
+    }
+
+    uint64_t fileSize = std::filesystem::file_size(path);
+    ReadPackHeader(file, path);
+
+    // Sealed pack: entries are read from trailing index, which is removed to append more frames
+    std::vector<PackEntry> entries;
+    std::optional<Trailer> trailer = ReadTrailer(file, fileSize);
+    if (trailer) {
+        entries.resize(trailer->count);
+        file.seekg(trailer->indexOffset);
+        file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(PackEntry));
+        if (file) {
+            file.close();
+            std::filesystem::resize_file(path, trailer->indexOffset);
+            return entries;
+        }
+
+        file.clear();
+        entries.clear();
+    }
+
+    /*
+    *   Unsealed pack: frames are scanned from the start.
+    *   A frame whose write failed leaves a damaged range that is skipped, frames written after it are kept.
+    *   Only the range after the last complete frame is torn and truncated.
+    */
+    uint64_t position = PackHeaderSize, validSize = PackHeaderSize;
+    while (position + FrameHeaderSize <= fileSize) {
+        std::optional<FrameHeader> header = ReadFrame(file, position, fileSize);
+        if (!header) {
+            std::optional<uint64_t> next = FindFrame(file, position + 1, fileSize);
+            if (!next) {
+                break;
+            }
+
+            m_logger.warn(
+                "Skipping damaged range of {} at offset {} in \"{}\"",
+                Utility::ToReadableSize(*next - position), position, path
+            );
+            position = *next;
+            continue;
+        }
+
+        entries.push_back({ header->timestamp, position + FrameHeaderSize, header->size });
+        position += FrameHeaderSize + header->size;
+        validSize = position;
+    }
+    file.close();
+
+    if (validSize != fileSize) {
+        m_logger.warn(
+            "Pack tail is torn, truncating {} from \"{}\"",
+            Utility::ToReadableSize(fileSize - validSize), path
+        );
+        std::filesystem::resize_file(path, validSize);
+    }
+    return entries;
+}
+
+void Capture::Storage::discardFrame(Pack& pack, uint64_t offset) {
+    auto entry = std::find_if(pack.entries.begin(), pack.entries.end(), [offset](const PackEntry& entry) { return entry.offset == offset; });
+    if (entry == pack.entries.end()) {
+        return;
+    }
+
+    uint64_t frameEnd = entry->offset + entry->size;
+    pack.entries.erase(entry);
+    if (frameEnd != pack.size) {
+        return;
+    }
+
+    // The last reserved frame gives its space back, the next frame is written in its place instead of after a damaged range
+    std::error_code error;
+    std::filesystem::resize_file(pack.path, offset - FrameHeaderSize, error);
+    if (error) {
+        m_logger.error("Couldn't truncate failed frame from \"{}\": \"{}\"", pack.path, error.message());
+        return;
+    }
+    pack.size = offset - FrameHeaderSize;
+}
+
+void Capture::Storage::discardFrames(const std::vector<Location>& failed) {
+    for (auto location = failed.rbegin(); location != failed.rend(); ++location) {
+        for (Pack& pack : m_packs) {
+            if (location->offset && pack.path == location->path) {
+                discardFrame(pack, location->offset);
+            }
+        }
+    }
+}
+
+void Capture::Storage::discardFailedFrames() {
+    std::vector<Location> failed;
+    {
+        std::lock_guard lock(m_mutex);
+        failed.swap(m_failedFrames);
+    }
+    discardFrames(failed);
+}
+
+Capture::Storage::Pack& Capture::Storage::openPack(TaskId task, dt::date date) {
+    Pack& pack = m_packs[static_cast<size_t>(task)];
+    if (pack.open && pack.date == date) {
+        return pack;
+    }
+
+    if (pack.open) {
+        sealPack(pack);
+    }
+
+    pack.date = date;
+    pack.path = Layout::PackPath(task, date);
+    pack.entries.clear();
+    std::filesystem::create_directories(std::filesystem::path(pack.path).parent_path());
+    if (std::filesystem::exists(pack.path) && std::filesystem::file_size(pack.path) != 0) {
+        pack.entries = recoverPack(pack.path);
+    }
+    else {
+        std::FILE* file = std::fopen(pack.path.c_str(), "wb");
+        const uint32_t header[] = { PackMagic, PackVersion, static_cast<uint32_t>(task), 0 };
+        bool written = (file && std::fwrite(header, sizeof(header), 1, file) == 1);
+        if (file) {
+            written = (std::fclose(file) == 0) && written;
+        }
+
+        if (!written) {
+            throw std::runtime_error(fmt::format(
+                "cp::Capture::Storage::openPack(): "
+                "Couldn't create pack \"{}\"",
+                pack.path
+            ));
+        }
+    }
+
+    pack.size = std::filesystem::file_size(pack.path);
+    pack.open = true;
+    return pack;
+}
+
+void Capture::Storage::sealPack(Pack& pack) {
+    // Frames of the pack may still be being written, those that failed are left out of its index
+    m_writer.flush();
+    discardFailedFrames();
+    pack.open = false;
+
+    std::FILE* file = std::fopen(pack.path.c_str(), "ab");
+    Trailer trailer = { TrailerMagic, static_cast<uint32_t>(pack.entries.size()), pack.size };
+    bool written = file && (pack.entries.empty() || std::fwrite(pack.entries.data(), sizeof(PackEntry), pack.entries.size(), file) == pack.entries.size());
+    written = written && std::fwrite(&trailer, sizeof(trailer), 1, file) == 1 && std::fflush(file) == 0;
+#ifdef __unix__
+    written = written && fdatasync(fileno(file)) == 0;
+#endif
+    if (file) {
+        std::fclose(file);
+    }
+
+    if (!written) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Storage::sealPack(): "
+            "Couldn't seal pack \"{}\"",
+            pack.path
+        ));
+    }
+
+    m_logger.info(
+        "Sealed pack \"{}\": {} capture{}, {}",
+        pack.path, pack.entries.size(), pack.entries.size() == 1 ? "" : "s",
+        Utility::ToReadableSize(pack.size)
+    );
+    pack.entries.clear();
+}
+
+Capture::Storage::Location Capture::Storage::save(TaskId task, pt::ptime timestamp, Jpeg::SharedBuffer data) {
+    if (m_type == Config::CaptureStorage::Files) {
+        std::string path = Layout::CapturePath(task, timestamp);
+        if (Config::Instance->captureLayout() == Config::CaptureLayout::Sharded) {
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+        }
+
+        uint64_t size = data->size();
+        m_writer.write(path, std::move(data));
+        return { path, 0, size };
+    }
+
+    /*
+    *   Frame position is reserved right away, so frames are written independently of each other.
+    *   A frame that wasn't written completely is skipped or truncated when the pack is opened again.
+    */
+    discardFailedFrames();
+    Pack& pack = openPack(task, timestamp.date());
+    FrameHeader header = { FrameMagic, static_cast<uint32_t>(data->size()), Utility::ToUnixMicroseconds(timestamp) };
+    const uint8_t* headerBytes = reinterpret_cast<const uint8_t*>(&header);
+    PackEntry entry = { header.timestamp, pack.size + FrameHeaderSize, data->size() };
+
+    // Frame header and data are written with one system call
+    m_writer.write(pack.path, pack.size, { std::make_shared<const Jpeg::Buffer>(headerBytes, headerBytes + sizeof(header)), std::move(data) });
+    pack.entries.push_back(entry);
+    pack.size += FrameHeaderSize + entry.size;
+    return { pack.path, entry.offset, entry.size };
+}
+
+void Capture::Storage::savePreviews(TaskId task, pt::ptime timestamp, const Previews& previews) {
+    std::filesystem::create_directories(Layout::PreviewDayDirectory(task, timestamp.date()));
+    for (size_t level = 0; level < previews.size(); ++level) {
+        if (previews[level]) {
+            m_writer.write(Layout::PreviewPath(task, timestamp, static_cast<Pyramid::Level>(level)), previews[level]);
+        }
+    }
+}
+
+void Capture::Storage::commit(Completion completion) {
+    if (!completion) {
+        m_writer.commit();
+        return;
+    }
+
+    // Packs are only changed by the thread using storage, failed frames are discarded from them by its next call
+    m_writer.commit([this, completion = std::move(completion)](std::vector<FileWriter::Failure> failures) {
+        std::vector<Location> failed = Locate(failures);
+        {
+            std::lock_guard lock(m_mutex);
+            m_failedFrames.insert(m_failedFrames.end(), failed.begin(), failed.end());
+        }
+        completion(std::move(failed));
+    });
+}
+
+std::vector<Capture::Storage::Location> Capture::Storage::flush() {
+    m_writer.flush();
+
+    std::vector<Location> failed = Locate(m_writer.takeFailures());
+    discardFailedFrames();
+    discardFrames(failed);
+    return failed;
+}
+
+void Capture::Storage::seal(dt::date date) {
+    for (Pack& pack : m_packs) {
+        if (pack.open && pack.date < date) {
+            sealPack(pack);
+        }
+    }
+}
+
+} // namespace cp
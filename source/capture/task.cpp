@@ -0,0 +1,82 @@
+#include "capture/task.hpp"
+
+#include "capture/event.hpp"
+
+namespace cp {
+
+/*
+*   "Main" task:
+*       -> Target: 60 FPS timelapse where 1 second = 1 real day.
+*       -> Capture: Evenly, 60 captures every day (one every 24 minutes).
+*/
+void Capture::Generators::Main(const Task::Day& day, Schedule& schedule) {
+    pt::time_duration step = pt::time_duration(24, 0, 0) / 60;
+    for (pt::ptime timestamp = pt::ptime(day.date) + step / 2; timestamp.date() == day.date; timestamp += step) {
+        schedule.push(TaskId::Main, timestamp);
+    }
+}
+
+/*
+*   "Midnight" task:
+*       -> Target: 60 FPS timelapse where 1 second = 60 real days.
+*       -> Capture: Every midnight, 1 capture every day (one every 24 hours).
+*/
+void Capture::Generators::Midnight(const Task::Day& day, Schedule& schedule) {
+    schedule.push(TaskId::Midnight, pt::ptime(day.date));
+}
+
+/*
+*   "Midday" task:
+*       -> Target: 60 FPS timelapse where 1 second = 60 real days.
+*       -> Capture: Every midday, 1 capture every day (one every 24 hours).
+*/
+void Capture::Generators::Midday(const Task::Day& day, Schedule& schedule) {
+    schedule.push(TaskId::Midday, pt::ptime(day.date, pt::time_duration(12, 0, 0)));
+}
+
+/*
+*   "Sunrise" task:
+*       -> Target: 60 FPS timelapse where 1 second = 60 real days.
+*       -> Capture: Every sunrise, 1 capture every day.
+*/
+void Capture::Generators::Sunrise(const Task::Day& day, Schedule& schedule) {
+    schedule.push(TaskId::Sunrise, day.sunrise);
+}
+
+/*
+*   "Sunset" task:
+*       -> Target: 60 FPS timelapse where 1 second = 60 real days.
+*       -> Capture: Every sunset, 1 capture every day.
+*/
+void Capture::Generators::Sunset(const Task::Day& day, Schedule& schedule) {
+    schedule.push(TaskId::Sunset, day.sunset);
+}
+
+/*
+*   "Day" task:
+*       -> Target: 60 FPS timelapse where 1 second = 10 real days.
+*       -> Capture: Evenly between sunrises and sunsets, 6 captures every day.
+*/
+void Capture::Generators::Day(const Task::Day& day, Schedule& schedule) {
+    pt::time_duration step = (day.sunset - day.sunrise) / 6;
+    for (pt::ptime timestamp = day.sunrise + step / 2; timestamp < day.sunset; timestamp += step) {
+        schedule.push(TaskId::Day, timestamp);
+    }
+}
+
+/*
+*   "Night" task:
+*       -> Target: 60 FPS timelapse where 1 second = 10 real days.
+*       -> Capture: Evenly between sunsets and sunrises, 6 captures every day.
+*/
+void Capture::Generators::Night(const Task::Day& day, Schedule& schedule) {
+    pt::time_duration step = (pt::time_duration(24, 0, 0) - (day.sunset - day.sunrise)) / 6;
+    for (pt::ptime timestamp = day.sunrise - step / 2; timestamp.date().day() == day.sunrise.date().day(); timestamp -= step) {
+        schedule.push(TaskId::Night, timestamp);
+    }
+    for (pt::ptime timestamp = day.sunset + step / 2; timestamp.date().day() == day.sunset.date().day(); timestamp += step) {
+        schedule.push(TaskId::Night, timestamp);
+    }
+}
+
+} // namespace cp
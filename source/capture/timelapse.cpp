@@ -0,0 +1,361 @@
+#include "capture/timelapse.hpp"
+using namespace cp::Capture::TimelapseConst;
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/regex.hpp>
+
+#include <nlohmann/json.hpp>
+using nlohmann::json;
+
+#include <fmt/format.h>
+
+#include "capture/layout.hpp"
+#include "common/utility.hpp"
+
+namespace cp {
+
+// Four-character code as little-endian 32-bit integer
+static constexpr uint32_t FourCc(const char (&code)[5]) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(code[0]))
+        | static_cast<uint32_t>(static_cast<uint8_t>(code[1])) << 8
+        | static_cast<uint32_t>(static_cast<uint8_t>(code[2])) << 16
+        | static_cast<uint32_t>(static_cast<uint8_t>(code[3])) << 24;
+}
+
+// Offsets of fields read back when a video is opened
+constexpr size_t WidthOffset = 176;
+constexpr size_t HeightOffset = 180;
+constexpr size_t MoviTypeOffset = 220;
+
+// Frame is a key frame (every MJPEG frame is)
+constexpr uint32_t KeyFrameFlag = 0x10;
+
+// AVI has an index
+constexpr uint32_t HasIndexFlag = 0x10;
+
+template <typename Value>
+static void Put(std::vector<uint8_t>& buffer, Value value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(Value));
+}
+
+static FileWriter::Data CreateHeader(int width, int height, uint32_t frames, uint32_t maxFrameSize, uint64_t moviEnd) {
+    uint64_t fileSize = moviEnd + 8 + static_cast<uint64_t>(frames) * 16;
+    std::vector<uint8_t> header;
+    header.reserve(HeaderSize);
+
+    Put<uint32_t>(header, FourCc("RIFF"));
+    Put<uint32_t>(header, static_cast<uint32_t>(fileSize - 8));
+    Put<uint32_t>(header, FourCc("AVI "));
+
+    Put<uint32_t>(header, FourCc("LIST"));
+    Put<uint32_t>(header, 192);
+    Put<uint32_t>(header, FourCc("hdrl"));
+
+    Put<uint32_t>(header, FourCc("avih"));
+    Put<uint32_t>(header, 56);
+    Put<uint32_t>(header, 1'000'000 / FrameRate);                       // Microseconds per frame
+    Put<uint32_t>(header, maxFrameSize * FrameRate);                    // Maximum bytes per second
+    Put<uint32_t>(header, 0);                                           // Padding granularity
+    Put<uint32_t>(header, HasIndexFlag);
+    Put<uint32_t>(header, frames);
+    Put<uint32_t>(header, 0);                                           // Initial frames
+    Put<uint32_t>(header, 1);                                           // Streams
+    Put<uint32_t>(header, maxFrameSize);                                // Suggested buffer size
+    Put<uint32_t>(header, static_cast<uint32_t>(width));
+    Put<uint32_t>(header, static_cast<uint32_t>(height));
+    header.resize(header.size() + 16, 0);                               // Reserved
+
+    Put<uint32_t>(header, FourCc("LIST"));
+    Put<uint32_t>(header, 116);
+    Put<uint32_t>(header, FourCc("strl"));
+
+    Put<uint32_t>(header, FourCc("strh"));
+    Put<uint32_t>(header, 56);
+    Put<uint32_t>(header, FourCc("vids"));
+    Put<uint32_t>(header, FourCc("MJPG"));
+    Put<uint32_t>(header, 0);                                           // Flags
+    Put<uint16_t>(header, 0);                                           // Priority
+    Put<uint16_t>(header, 0);                                           // Language
+    Put<uint32_t>(header, 0);                                           // Initial frames
+    Put<uint32_t>(header, 1);                                           // Scale
+    Put<uint32_t>(header, FrameRate);                                   // Rate
+    Put<uint32_t>(header, 0);                                           // Start
+    Put<uint32_t>(header, frames);                                      // Length
+    Put<uint32_t>(header, maxFrameSize);                                // Suggested buffer size
+    Put<uint32_t>(header, 0xFFFFFFFF);                                  // Default quality
+    Put<uint32_t>(header, 0);                                           // Sample size
+    Put<int16_t>(header, 0);
+    Put<int16_t>(header, 0);
+    Put<int16_t>(header, static_cast<int16_t>(width));
+    Put<int16_t>(header, static_cast<int16_t>(height));
+
+    Put<uint32_t>(header, FourCc("strf"));
+    Put<uint32_t>(header, 40);
+    Put<uint32_t>(header, 40);                                          // Header size
+    Put<int32_t>(header, width);
+    Put<int32_t>(header, height);
+    Put<uint16_t>(header, 1);                                           // Planes
+    Put<uint16_t>(header, 24);                                          // Bits per pixel
+    Put<uint32_t>(header, FourCc("MJPG"));
+    Put<uint32_t>(header, static_cast<uint32_t>(width * height * 3));   // Image size
+    header.resize(header.size() + 16, 0);                               // Resolution and palette
+
+    Put<uint32_t>(header, FourCc("LIST"));
+    Put<uint32_t>(header, static_cast<uint32_t>(moviEnd - MoviTypeOffset));
+    Put<uint32_t>(header, FourCc("movi"));
+    return std::make_shared<const std::vector<uint8_t>>(std::move(header));
+}
+
+static std::string CoveragePath() {
+    return fmt::format("{}/{}/{}", Capture::LayoutConst::CaptureDirectory, TimelapseDirectory, CoverageFile);
+}
+
+Capture::Timelapse::Timelapse()
+    : m_logger(Utility::CreateLogger("timelapse")) {
+    for (const Task& task : Tasks) {
+        if (task.directory) {
+            m_coverage[static_cast<size_t>(task.id)] = Coverage(task.id);
+        }
+    }
+}
+
+std::string Capture::Timelapse::path(TaskId task, int number) const {
+    return fmt::format(
+        "{}/{}/{}.{:#03d}.{}",
+        LayoutConst::CaptureDirectory,
+        TimelapseDirectory,
+        GetTask(task).directory,
+        number,
+        TimelapseExtension
+    );
+}
+
+std::optional<Capture::Timelapse::Video> Capture::Timelapse::openVideo(TaskId task, int& lastNumber) {
+    namespace fs = std::filesystem;
+    fs::path directory = fs::path(LayoutConst::CaptureDirectory) / TimelapseDirectory;
+    if (!fs::is_directory(directory)) {
+        return {};
+    }
+
+    const boost::regex filenameRegex(fmt::format(R"(^{}\.(\d{{3,}})\.{}$)", GetTask(task).directory, TimelapseExtension));
+    Video video;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory)) {
+        boost::smatch matches;
+        std::string filename = entry.path().filename().string();
+        if (entry.is_regular_file() && boost::regex_match(filename, matches, filenameRegex)) {
+            video.number = std::max(video.number, std::stoi(matches.str(1)));
+        }
+    }
+    lastNumber = video.number;
+    if (video.number == 0) {
+        return {};
+    }
+
+    video.path = path(task, video.number);
+    std::ifstream file(video.path, std::ios::binary);
+    uint8_t header[HeaderSize] = {};
+    uint64_t fileSize = fs::file_size(video.path);
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, "RIFF", 4) || std::memcmp(header + MoviTypeOffset, "movi", 4)) {
+        m_logger.warn("Timelapse \"{}\" is not valid, new one will be started", video.path);
+        return {};
+    }
+    std::memcpy(&video.width, header + WidthOffset, sizeof(video.width));
+    std::memcpy(&video.height, header + HeightOffset, sizeof(video.height));
+
+    /*
+    *   Index at the end is not trusted: frames are found by walking the chunks.
+    *   The walk stops at the index or at the first chunk that isn't complete.
+    */
+    uint32_t chunk[2] = {};
+    while (video.moviEnd + sizeof(chunk) <= fileSize && file.seekg(video.moviEnd) && file.read(reinterpret_cast<char*>(chunk), sizeof(chunk))) {
+        uint64_t chunkEnd = video.moviEnd + sizeof(chunk) + chunk[1] + (chunk[1] & 1);
+        if (chunk[0] != FourCc("00dc") || chunkEnd > fileSize) {
+            break;
+        }
+
+        video.index.push_back({ FourCc("00dc"), KeyFrameFlag, static_cast<uint32_t>(video.moviEnd - MoviTypeOffset), chunk[1] });
+        video.maxFrameSize = std::max(video.maxFrameSize, chunk[1]);
+        video.moviEnd = chunkEnd;
+    }
+    file.close();
+
+    uint64_t expectedSize = video.moviEnd + 8 + video.index.size() * sizeof(IndexEntry);
+    if (fileSize != expectedSize) {
+        m_logger.warn("Timelapse \"{}\" was not closed properly, recovered {} frame{}", video.path, video.index.size(), video.index.size() == 1 ? "" : "s");
+        fs::resize_file(video.path, std::min(fileSize, video.moviEnd));
+        writeTail(video);
+    }
+    return video;
+}
+
+Capture::Timelapse::Video Capture::Timelapse::createVideo(TaskId task, int number, int width, int height) {
+    Video video;
+    video.path = path(task, number);
+    video.number = number;
+    video.width = width;
+    video.height = height;
+
+    /*
+    *   The file is created empty right away, so that its header and frames are written into it by the same batch
+    *   instead of waiting for it to be published. A torn new video is recovered on open like any other.
+    */
+    std::filesystem::create_directories(std::filesystem::path(video.path).parent_path());
+    if (!std::ofstream(video.path, std::ios::binary | std::ios::trunc)) {
+        throw std::runtime_error(fmt::format(
+            "cp::Capture::Timelapse::createVideo(): "
+            "Couldn't create timelapse \"{}\"",
+            video.path
+        ));
+    }
+    std::vector<uint8_t> data = *CreateHeader(width, height, 0, 0, video.moviEnd);
+    Put<uint32_t>(data, FourCc("idx1"));
+    Put<uint32_t>(data, 0);
+    m_writer.write(video.path, 0, std::make_shared<const std::vector<uint8_t>>(std::move(data)));
+
+    m_logger.info("Started timelapse \"{}\" ({}x{}, {} FPS)", video.path, width, height, FrameRate);
+    return video;
+}
+
+void Capture::Timelapse::writeTail(const Video& video) {
+    std::vector<uint8_t> index;
+    index.reserve(8 + video.index.size() * sizeof(IndexEntry));
+    Put<uint32_t>(index, FourCc("idx1"));
+    Put<uint32_t>(index, static_cast<uint32_t>(video.index.size() * sizeof(IndexEntry)));
+    const uint8_t* entries = reinterpret_cast<const uint8_t*>(video.index.data());
+    index.insert(index.end(), entries, entries + video.index.size() * sizeof(IndexEntry));
+
+    m_writer.write(video.path, video.moviEnd, std::make_shared<const std::vector<uint8_t>>(std::move(index)));
+    m_writer.write(video.path, 0, CreateHeader(video.width, video.height, static_cast<uint32_t>(video.index.size()), video.maxFrameSize, video.moviEnd));
+}
+
+void Capture::Timelapse::updateCoverage(const std::vector<std::pair<TaskId, std::optional<Event::Timestamp>>>& appended, bool failed) {
+    m_failed = m_failed || failed;
+    if (m_failed || appended.empty()) {
+        return;
+    }
+
+    for (const auto& [task, timestamp] : appended) {
+        std::vector<Range>& ranges = m_coverage[static_cast<size_t>(task)];
+        bool& extending = m_extending[static_cast<size_t>(task)];
+        if (!timestamp) {
+            extending = false;
+        }
+        else if (extending) {
+            ranges.back().last = *timestamp;
+        }
+        else {
+            ranges.push_back({ *timestamp, *timestamp });
+            extending = true;
+        }
+    }
+    saveCoverage();
+}
+
+void Capture::Timelapse::saveCoverage() {
+    json coverageJson = json::object();
+    for (const Task& task : Tasks) {
+        if (!task.directory) {
+            continue;
+        }
+
+        json rangesJson = json::array();
+        for (const Range& range : m_coverage[static_cast<size_t>(task.id)]) {
+            rangesJson.push_back({ range.first, range.last });
+        }
+        coverageJson[task.name] = rangesJson;
+    }
+
+    // Frames are flushed already, the file is replaced after them and never claims more than they hold
+    std::string path = CoveragePath();
+    std::string temporaryPath = path + FileWriterConst::TemporarySuffix;
+    {
+        std::ofstream file(temporaryPath);
+        file << coverageJson.dump(4) << '\n';
+        if (!file) {
+            m_logger.error("Couldn't write timelapse coverage file \"{}\"", temporaryPath);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        m_logger.error("Couldn't replace timelapse coverage file \"{}\": {}", path, error.message());
+    }
+}
+
+void Capture::Timelapse::append(TaskId task, Event::Timestamp timestamp, Jpeg::SharedBuffer frame) {
+    // Capture is skipped unless its frame is buffered
+    m_appended.emplace_back(task, std::nullopt);
+    Jpeg::Dimensions dimensions = Jpeg::ReadDimensions(frame->data(), frame->size());
+    std::optional<Video>& video = m_videos[static_cast<size_t>(task)];
+    int lastNumber = 0;
+    if (!video) {
+        video = openVideo(task, lastNumber);
+    }
+
+    // Frame size of a video can't change, and AVI 1.0 file can't grow past 32-bit offsets
+    uint64_t chunkSize = 8 + frame->size() + (frame->size() & 1);
+    if (video) {
+        uint64_t newSize = video->moviEnd + chunkSize + 8 + (video->index.size() + 1) * sizeof(IndexEntry);
+        if (dimensions.width != video->width || dimensions.height != video->height || newSize > MaxFileSize) {
+            video = createVideo(task, video->number + 1, dimensions.width, dimensions.height);
+        }
+    }
+    else {
+        video = createVideo(task, lastNumber + 1, dimensions.width, dimensions.height);
+    }
+
+    std::vector<uint8_t> chunkHeader;
+    Put<uint32_t>(chunkHeader, FourCc("00dc"));
+    Put<uint32_t>(chunkHeader, static_cast<uint32_t>(frame->size()));
+    std::vector<FileWriter::Data> chunk = { std::make_shared<const std::vector<uint8_t>>(std::move(chunkHeader)), frame };
+    if (frame->size() & 1) {
+        chunk.push_back(std::make_shared<const std::vector<uint8_t>>(1, 0));
+    }
+    m_writer.write(video->path, video->moviEnd, std::move(chunk));
+
+    video->index.push_back({ FourCc("00dc"), KeyFrameFlag, static_cast<uint32_t>(video->moviEnd - MoviTypeOffset), static_cast<uint32_t>(frame->size()) });
+    video->maxFrameSize = std::max(video->maxFrameSize, static_cast<uint32_t>(frame->size()));
+    video->moviEnd += chunkSize;
+    writeTail(*video);
+    m_appended.back().second = timestamp;
+}
+
+void Capture::Timelapse::skip(TaskId task) {
+    m_appended.emplace_back(task, std::nullopt);
+}
+
+void Capture::Timelapse::commit() {
+    m_writer.commit([this, appended = std::move(m_appended)](std::vector<FileWriter::Failure> failures) {
+        updateCoverage(appended, !failures.empty());
+    });
+    m_appended.clear();
+}
+
+std::vector<Capture::Timelapse::Range> Capture::Timelapse::Coverage(TaskId task) {
+    std::ifstream file(CoveragePath());
+    if (!file) {
+        return {};
+    }
+
+    // Captures that aren't known to be in timelapse are kept, unreadable coverage counts as none
+    std::vector<Range> ranges;
+    try {
+        json coverageJson = json::parse(file);
+        for (const json& rangeJson : coverageJson.value(GetTask(task).name, json::array())) {
+            ranges.push_back({ rangeJson.at(0).get<Event::Timestamp>(), rangeJson.at(1).get<Event::Timestamp>() });
+        }
+    }
+    catch (const json::exception&) {
+        return {};
+    }
+    return ranges;
+}
+
+} // namespace cp
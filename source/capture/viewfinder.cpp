@@ -0,0 +1,161 @@
+#include "capture/viewfinder.hpp"
+using namespace cp::Capture::ViewfinderConst;
+
+#include <stdexcept>
+#include <vector>
+
+#include "common/utility.hpp"
+
+namespace cp {
+
+Capture::Viewfinder::Subscription::Subscription(Viewfinder& viewfinder, uint64_t id)
+    : m_viewfinder(viewfinder)
+    , m_id(id)
+{}
+
+Capture::Viewfinder::Subscription::~Subscription() {
+    m_viewfinder.unsubscribe(m_id);
+}
+
+Capture::Viewfinder::Pause::Pause(Viewfinder& viewfinder)
+    : m_viewfinder(viewfinder) {
+    m_viewfinder.pause();
+}
+
+Capture::Viewfinder::Pause::~Pause() {
+    m_viewfinder.resume();
+}
+
+Capture::Viewfinder::Viewfinder(Camera& camera)
+    : m_logger(Utility::CreateLogger(fmt::format("{}_viewfinder", camera.name())))
+    , m_camera(camera) {
+    m_thread = std::thread(&Viewfinder::viewfinderFunction, this);
+}
+
+Capture::Viewfinder::~Viewfinder() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void Capture::Viewfinder::viewfinderFunction() {
+    std::chrono::steady_clock::time_point nextFrame = std::chrono::steady_clock::now();
+    std::unique_lock lock(m_mutex);
+    while (true) {
+        bool streaming = !m_stopping && !m_pauses && !m_listeners.empty();
+        if (!streaming && m_cameraOn) {
+            // Camera is released as soon as it's not watched, or a capture is waiting for it
+            lock.unlock();
+            m_camera.turnOff();
+            lock.lock();
+            m_cameraOn = false;
+            m_cv.notify_all();
+            continue;
+        }
+
+        if (m_stopping) {
+            return;
+        }
+
+        if (m_listeners.empty()) {
+            m_lastFrame.reset();
+            m_cv.wait(lock, [this]() { return m_stopping || !m_listeners.empty(); });
+            continue;
+        }
+
+        if (m_pauses) {
+            bool resumed = m_cv.wait_for(lock, KeepAliveInterval, [this]() { return m_stopping || !m_pauses || m_listeners.empty(); });
+            if (!resumed && m_lastFrame) {
+                publish(lock, m_lastFrame);
+            }
+            continue;
+        }
+
+        // Frame rate is capped, viewers joining meanwhile get the last frame
+        if (m_cv.wait_until(lock, nextFrame, [this]() { return m_stopping || m_pauses || m_listeners.empty(); })) {
+            continue;
+        }
+        nextFrame = std::chrono::steady_clock::now() + std::chrono::microseconds(1000000 / MaxFrameRate);
+        m_cameraOn = true;
+        lock.unlock();
+
+        Jpeg::SharedBuffer frame;
+        try {
+            m_camera.turnOn();
+            frame = std::make_shared<const Jpeg::Buffer>(Jpeg::Encode(m_camera.preview(), Quality));
+        }
+        catch (const std::exception& error) {
+            m_logger.error("Couldn't capture viewfinder frame: \"{}\"", error.what());
+            m_camera.turnOff();
+            nextFrame = std::chrono::steady_clock::now() + ErrorDelay;
+        }
+
+        lock.lock();
+        if (!frame) {
+            m_cameraOn = false;
+            m_cv.notify_all();
+            continue;
+        }
+
+        m_lastFrame = frame;
+        publish(lock, frame);
+    }
+}
+
+void Capture::Viewfinder::publish(std::unique_lock<std::mutex>& lock, Jpeg::SharedBuffer frame) {
+    // Listeners are called unlocked, so a viewer may unsubscribe from its listener
+    std::vector<Listener> listeners;
+    listeners.reserve(m_listeners.size());
+    for (const auto& [id, listener] : m_listeners) {
+        listeners.push_back(listener);
+    }
+
+    lock.unlock();
+    for (const Listener& listener : listeners) {
+        listener(frame);
+    }
+    lock.lock();
+}
+
+void Capture::Viewfinder::unsubscribe(uint64_t id) {
+    std::lock_guard lock(m_mutex);
+    m_listeners.erase(id);
+    m_cv.notify_all();
+}
+
+void Capture::Viewfinder::pause() {
+    std::unique_lock lock(m_mutex);
+    ++m_pauses;
+    m_cv.notify_all();
+    m_cv.wait(lock, [this]() { return !m_cameraOn; });
+}
+
+void Capture::Viewfinder::resume() {
+    {
+        std::lock_guard lock(m_mutex);
+        --m_pauses;
+    }
+    m_cv.notify_all();
+}
+
+std::unique_ptr<Capture::Viewfinder::Subscription> Capture::Viewfinder::subscribe(Listener listener) {
+    Jpeg::SharedBuffer lastFrame;
+    uint64_t id = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        id = m_nextListener++;
+        m_listeners.emplace(id, listener);
+        lastFrame = m_lastFrame;
+    }
+    m_cv.notify_all();
+
+    if (lastFrame) {
+        listener(lastFrame);
+    }
+    return std::make_unique<Subscription>(*this, id);
+}
+
+} // namespace cp
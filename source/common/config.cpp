@@ -9,8 +9,12 @@ using nlohmann::json;
 
 #include <fmt/format.h>
 
+#include "capture/task.hpp"
+
 namespace cp {
 
+static_assert(TaskCount == Capture::Tasks.size(), "Per-task settings must cover the task registry");
+
 /*
 *   std::make_unique() needs public constructor, but the Config class uses singleton pattern.
 *   This is why operator new is used instead.
@@ -39,11 +43,28 @@ void Config::GenerateSampleFile() {
     sunObject[Objects::SunriseAngle] = Defaults::SunriseAngle;
     sunObject[Objects::SunsetAngle] = Defaults::SunsetAngle;
 
+    json captureObject;
+    captureObject[Objects::Layout] = Defaults::Layout;
+    captureObject[Objects::Storage] = Defaults::Storage;
+    captureObject[Objects::Overlay] = Defaults::Overlay;
+
+    json cameraObject;
+    cameraObject[Objects::Name] = Defaults::CameraName;
+    cameraObject[Objects::Backend] = Defaults::Backend;
+    cameraObject[Objects::Id] = Defaults::Id;
+    cameraObject[Objects::Tasks] = json::array();
+    captureObject[Objects::Cameras] = json::array({ cameraObject });
+    captureObject[Objects::Retention] = json::object();
+    captureObject[Objects::TargetSize] = json::object();
+    captureObject[Objects::Regions] = json::object();
+    captureObject[Objects::Timelapse] = Defaults::Timelapse;
+
     json configJson;
     configJson[Objects::Common] = commonObject;
     configJson[Objects::I2CPorts] = i2cPortsObject;
     configJson[Objects::Location] = locationObject;
     configJson[Objects::Sun] = sunObject;
+    configJson[Objects::Capture] = captureObject;
     configFile << configJson.dump(4) << '\n';
 }
 
@@ -72,6 +93,178 @@ Config::Config() {
         const json& sunObject = configJson.at(Objects::Sun);
         m_sunriseAngle = sunObject.at(Objects::SunriseAngle);
         m_sunsetAngle = sunObject.at(Objects::SunsetAngle);
+
+        // Capture object was added later, configuration files without it use defaults
+        if (configJson.contains(Objects::Capture)) {
+            const json& captureObject = configJson.at(Objects::Capture);
+            std::string layout = captureObject.value(Objects::Layout, Defaults::Layout);
+            if (layout == Values::FlatLayout) {
+                m_captureLayout = CaptureLayout::Flat;
+            }
+            else if (layout == Values::ShardedLayout) {
+                m_captureLayout = CaptureLayout::Sharded;
+            }
+            else {
+                m_error = fmt::format("Capture layout \"{}\" is unknown (available: \"{}\", \"{}\")", layout, Values::FlatLayout, Values::ShardedLayout);
+                return;
+            }
+
+            std::string storage = captureObject.value(Objects::Storage, Defaults::Storage);
+            if (storage == Values::FilesStorage) {
+                m_captureStorage = CaptureStorage::Files;
+            }
+            else if (storage == Values::PackStorage) {
+                m_captureStorage = CaptureStorage::Pack;
+            }
+            else {
+                m_error = fmt::format("Capture storage \"{}\" is unknown (available: \"{}\", \"{}\")", storage, Values::FilesStorage, Values::PackStorage);
+                return;
+            }
+
+            std::string overlay = captureObject.value(Objects::Overlay, Defaults::Overlay);
+            if (overlay == Values::BurnedOverlay) {
+                m_captureOverlay = CaptureOverlay::Burned;
+            }
+            else if (overlay == Values::MetadataOverlay) {
+                m_captureOverlay = CaptureOverlay::Metadata;
+            }
+            else {
+                m_error = fmt::format("Capture overlay \"{}\" is unknown (available: \"{}\", \"{}\")", overlay, Values::BurnedOverlay, Values::MetadataOverlay);
+                return;
+            }
+
+            // Tasks not listed by any camera are captured by the first one
+            if (captureObject.contains(Objects::Cameras)) {
+                const json& camerasArray = captureObject.at(Objects::Cameras);
+                if (!camerasArray.is_array() || camerasArray.empty()) {
+                    m_error = "Capture cameras must be a non-empty array";
+                    return;
+                }
+
+                m_cameras.clear();
+                std::array<bool, Capture::Tasks.size()> assigned = {};
+                for (const json& cameraObject : camerasArray) {
+                    CameraConfig camera;
+                    camera.name = cameraObject.value(Objects::Name, fmt::format("{}{}", Defaults::CameraName, m_cameras.size()));
+                    for (const CameraConfig& other : m_cameras) {
+                        if (other.name == camera.name) {
+                            m_error = fmt::format("Camera name \"{}\" is used more than once", camera.name);
+                            return;
+                        }
+                    }
+
+                    std::string backend = cameraObject.value(Objects::Backend, Defaults::Backend);
+                    if (backend == Values::LibcameraBackend) {
+                        camera.backend = CameraBackend::Libcamera;
+                    }
+                    else if (backend == Values::SyntheticBackend) {
+                        camera.backend = CameraBackend::Synthetic;
+                    }
+                    else {
+                        m_error = fmt::format("Backend \"{}\" of camera \"{}\" is unknown (available: \"{}\", \"{}\")", backend, camera.name, Values::LibcameraBackend, Values::SyntheticBackend);
+                        return;
+                    }
+
+                    camera.id = cameraObject.value(Objects::Id, Defaults::Id);
+                    camera.width = cameraObject.value(Objects::Width, Defaults::Width);
+                    camera.height = cameraObject.value(Objects::Height, Defaults::Height);
+                    if (camera.width < 0 || camera.height < 0) {
+                        m_error = fmt::format("Frame size of camera \"{}\" can't be negative", camera.name);
+                        return;
+                    }
+
+                    for (const json& taskName : cameraObject.value(Objects::Tasks, json::array())) {
+                        const Capture::Task* task = Capture::FindTask(taskName.get<std::string>());
+                        if (!task || !task->directory) {
+                            m_error = fmt::format("Task \"{}\" of camera \"{}\" is unknown", taskName.get<std::string>(), camera.name);
+                            return;
+                        }
+                        if (assigned[static_cast<size_t>(task->id)]) {
+                            m_error = fmt::format("Task \"{}\" is captured by more than one camera", task->name);
+                            return;
+                        }
+                        assigned[static_cast<size_t>(task->id)] = true;
+                        m_taskCameras[static_cast<size_t>(task->id)] = m_cameras.size();
+                    }
+                    m_cameras.push_back(camera);
+                }
+            }
+
+            // Retention policies are keyed by task name, tasks without a policy are kept forever
+            if (captureObject.contains(Objects::Retention)) {
+                for (const auto& [name, policyObject] : captureObject.at(Objects::Retention).items()) {
+                    const Capture::Task* task = Capture::FindTask(name);
+                    if (!task || !task->directory) {
+                        m_error = fmt::format("Retention policy task \"{}\" is unknown", name);
+                        return;
+                    }
+
+                    RetentionPolicy& policy = m_retentionPolicies[static_cast<size_t>(task->id)];
+                    policy.recompressAfter = policyObject.value(Objects::RecompressAfter, Defaults::RecompressAfter);
+                    policy.quality = policyObject.value(Objects::Quality, Defaults::Quality);
+                    policy.scale = policyObject.value(Objects::Scale, Defaults::Scale);
+                    policy.deleteAfter = policyObject.value(Objects::DeleteAfter, Defaults::DeleteAfter);
+                    policy.deleteTimelapsedAfter = policyObject.value(Objects::DeleteTimelapsedAfter, Defaults::DeleteTimelapsedAfter);
+                    if (policy.recompressAfter < 0 || policy.deleteAfter < 0 || policy.deleteTimelapsedAfter < 0) {
+                        m_error = fmt::format("Retention ages of task \"{}\" can't be negative", name);
+                        return;
+                    }
+                    if (policy.quality < 1 || policy.quality > 100) {
+                        m_error = fmt::format("Retention quality of task \"{}\" is not in range (current: {}, range: [1; 100])", name, policy.quality);
+                        return;
+                    }
+                    if (policy.scale != 1 && policy.scale != 2 && policy.scale != 4 && policy.scale != 8) {
+                        m_error = fmt::format("Retention scale of task \"{}\" is unknown (current: {}, available: 1, 2, 4, 8)", name, policy.scale);
+                        return;
+                    }
+                }
+            }
+
+            // Target sizes in bytes are keyed by task name, tasks without one are encoded with fixed quality
+            if (captureObject.contains(Objects::TargetSize)) {
+                for (const auto& [name, targetSize] : captureObject.at(Objects::TargetSize).items()) {
+                    const Capture::Task* task = Capture::FindTask(name);
+                    if (!task || !task->directory) {
+                        m_error = fmt::format("Target size task \"{}\" is unknown", name);
+                        return;
+                    }
+
+                    int64_t size = targetSize;
+                    if (size <= 0) {
+                        m_error = fmt::format("Target size of task \"{}\" must be positive (current: {})", name, size);
+                        return;
+                    }
+                    m_targetSizes[static_cast<size_t>(task->id)] = static_cast<size_t>(size);
+                }
+            }
+
+            // Regions are keyed by task name, tasks without one capture the whole frame
+            if (captureObject.contains(Objects::Regions)) {
+                for (const auto& [name, regionObject] : captureObject.at(Objects::Regions).items()) {
+                    const Capture::Task* task = Capture::FindTask(name);
+                    if (!task || !task->directory) {
+                        m_error = fmt::format("Region task \"{}\" is unknown", name);
+                        return;
+                    }
+
+                    Region region;
+                    region.x = regionObject.at(Objects::X);
+                    region.y = regionObject.at(Objects::Y);
+                    region.width = regionObject.at(Objects::Width);
+                    region.height = regionObject.at(Objects::Height);
+                    if (region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0) {
+                        m_error = fmt::format(
+                            "Region of task \"{}\" is invalid (current: {}x{}+{}+{})",
+                            name, region.width, region.height, region.x, region.y
+                        );
+                        return;
+                    }
+                    m_regions[static_cast<size_t>(task->id)] = region;
+                }
+            }
+
+            m_timelapse = captureObject.value(Objects::Timelapse, Defaults::Timelapse);
+        }
     }
     catch (const json::exception&) {
         m_error = fmt::format("Couldn't parse configuration file \"{}\" JSON", ConfigFile);
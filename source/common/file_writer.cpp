@@ -0,0 +1,441 @@
+#include "common/file_writer.hpp"
+using namespace cp::FileWriterConst;
+
+#include <cstdio>
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <numeric>
+#include <set>
+#include <span>
+
+#ifdef __unix__
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/uio.h>
+    #include <errno.h>
+#endif
+
+#include <fmt/format.h>
+
+#include "common/utility.hpp"
+
+namespace cp {
+
+#ifdef __unix__
+
+struct WriteVector {
+    uint64_t offset;
+    size_t size;
+    std::vector<iovec> parts;
+};
+
+struct Target {
+    std::string path;
+    std::vector<size_t> jobs;           // Batch indices of jobs written to the file
+    std::vector<WriteVector> writes;    // One per job, in batch order
+    int fd = -1;
+    bool ok = true;
+    unsigned completions = 0;
+};
+
+static WriteVector CreateWriteVector(uint64_t offset, const std::vector<FileWriter::Data>& parts) {
+    WriteVector write = { offset, 0, {} };
+    for (const FileWriter::Data& part : parts) {
+        if (part && !part->empty()) {
+            write.parts.push_back({ const_cast<uint8_t*>(part->data()), part->size() });
+            write.size += part->size();
+        }
+    }
+    return write;
+}
+
+static bool WriteFully(int fd, WriteVector write) {
+    size_t index = 0;
+    off_t offset = static_cast<off_t>(write.offset);
+    while (index < write.parts.size()) {
+        ssize_t written = pwritev(fd, write.parts.data() + index, static_cast<int>(write.parts.size() - index), offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // Short write continues in the middle of a part
+        offset += written;
+        while (index < write.parts.size() && static_cast<size_t>(written) >= write.parts[index].iov_len) {
+            written -= write.parts[index].iov_len;
+            ++index;
+        }
+        if (index < write.parts.size()) {
+            write.parts[index].iov_base = static_cast<uint8_t*>(write.parts[index].iov_base) + written;
+            write.parts[index].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+static void WriteSynchronously(std::span<Target> targets, spdlog::logger& logger) {
+    for (Target& target : targets) {
+        if (!target.ok) {
+            continue;
+        }
+
+        for (const WriteVector& write : target.writes) {
+            if (!WriteFully(target.fd, write)) {
+                logger.error("Couldn't write \"{}\" [errno: {}]", target.path, errno);
+                target.ok = false;
+                break;
+            }
+        }
+    }
+
+    // Files are flushed after all of them are written, so their writeback overlaps
+    for (Target& target : targets) {
+        if (target.ok && fdatasync(target.fd) == -1) {
+            logger.error("Couldn't flush \"{}\" [errno: {}]", target.path, errno);
+            target.ok = false;
+        }
+    }
+}
+
+#ifdef CP_USE_IO_URING
+
+/*
+*   Every write of a file and its fsync are linked, the whole batch is submitted with one system call.
+*   Files with more writes than fit in the queue are written synchronously.
+*   Returns false if the ring is broken, targets not reported as failed must be written again then.
+*/
+static bool WriteRing(io_uring& ring, std::vector<Target>& targets, spdlog::logger& logger) {
+    size_t index = 0;
+    while (index < targets.size()) {
+        unsigned submitted = 0;
+        for (; index < targets.size(); ++index) {
+            Target& target = targets[index];
+            unsigned entries = static_cast<unsigned>(target.writes.size()) + 1;
+            if (!target.ok) {
+                continue;
+            }
+            if (entries > QueueDepth) {
+                WriteSynchronously(std::span<Target>(&target, 1), logger);
+                continue;
+            }
+            if (submitted + entries > QueueDepth) {
+                break;
+            }
+
+            for (const WriteVector& write : target.writes) {
+                io_uring_sqe* entry = io_uring_get_sqe(&ring);
+                io_uring_prep_writev(entry, target.fd, write.parts.data(), static_cast<unsigned>(write.parts.size()), write.offset);
+                entry->flags |= IOSQE_IO_LINK;
+                io_uring_sqe_set_data(entry, &target);
+            }
+
+            io_uring_sqe* entry = io_uring_get_sqe(&ring);
+            io_uring_prep_fsync(entry, target.fd, IORING_FSYNC_DATASYNC);
+            io_uring_sqe_set_data(entry, &target);
+            submitted += entries;
+        }
+
+        int result = 0;
+        do {
+            result = io_uring_submit_and_wait(&ring, submitted);
+        } while (result == -EINTR);
+        if (result < 0) {
+            logger.error("Couldn't submit {} io_uring request{} [errno: {}]", submitted, submitted == 1 ? "" : "s", -result);
+            return false;
+        }
+
+        for (unsigned completed = 0; completed < submitted; ++completed) {
+            io_uring_cqe* completion = nullptr;
+            result = io_uring_wait_cqe(&ring, &completion);
+            if (result < 0) {
+                logger.error("Couldn't wait for io_uring completion [errno: {}]", -result);
+                return false;
+            }
+
+            // Linked requests complete in order: writes, then fsync. Short write is a failure too
+            Target& target = *static_cast<Target*>(io_uring_cqe_get_data(completion));
+            unsigned request = target.completions++;
+            bool write = (request < target.writes.size());
+            if (target.ok && (completion->res < 0 || (write && static_cast<size_t>(completion->res) != target.writes[request].size))) {
+                logger.error(
+                    "Couldn't {} \"{}\" [errno: {}]",
+                    write ? "write" : "flush", target.path, completion->res < 0 ? -completion->res : EIO
+                );
+                target.ok = false;
+            }
+            io_uring_cqe_seen(&ring, completion);
+        }
+    }
+    return true;
+}
+
+#endif
+
+#endif
+
+FileWriter::FileWriter()
+    : m_logger(Utility::CreateLogger("file_writer")) {
+#ifdef CP_USE_IO_URING
+    int result = io_uring_queue_init(QueueDepth, &m_ring, 0);
+    m_ringReady = (result == 0);
+    if (!m_ringReady) {
+        m_logger.warn("io_uring is not available [errno: {}], files are written with pwrite()", -result);
+    }
+#endif
+    m_thread = std::thread(&FileWriter::writerFunction, this);
+}
+
+FileWriter::~FileWriter() {
+    commit();
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+
+#ifdef CP_USE_IO_URING
+    if (m_ringReady) {
+        io_uring_queue_exit(&m_ring);
+    }
+#endif
+}
+
+void FileWriter::writerFunction() {
+    while (true) {
+        std::vector<Job> batch;
+        std::vector<Commit> commits;
+        {
+            std::unique_lock lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_stopping || !m_queue.empty() || !m_commits.empty(); });
+            if (m_queue.empty() && m_commits.empty()) {
+                return;
+            }
+
+            batch.swap(m_queue);
+            commits.swap(m_commits);
+            m_busy = true;
+        }
+
+        // Nothing of a batch that threw is known to be durable
+        std::vector<size_t> failedJobs;
+        try {
+            failedJobs = writeBatch(batch);
+        }
+        catch (const std::exception& error) {
+            m_logger.error("Couldn't write batch of {} file{}: \"{}\"", batch.size(), batch.size() == 1 ? "" : "s", error.what());
+            failedJobs.resize(batch.size());
+            std::iota(failedJobs.begin(), failedJobs.end(), 0);
+        }
+        complete(batch, commits, failedJobs);
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_busy = false;
+        }
+        m_doneCv.notify_all();
+    }
+}
+
+std::vector<size_t> FileWriter::writeBatch(std::vector<Job>& batch) {
+    std::vector<size_t> failedJobs;
+#ifdef __unix__
+    // Writes into the same existing file share its target, so that the file is flushed once
+    std::vector<Target> targets;
+    std::map<std::string, size_t> existingTargets;
+    targets.reserve(batch.size());
+    for (size_t index = 0; index < batch.size(); ++index) {
+        const Job& job = batch[index];
+        if (!job.create) {
+            auto [existing, inserted] = existingTargets.try_emplace(job.path, targets.size());
+            if (!inserted) {
+                targets[existing->second].jobs.push_back(index);
+                targets[existing->second].writes.push_back(CreateWriteVector(job.offset, job.parts));
+                continue;
+            }
+        }
+
+        Target& target = targets.emplace_back();
+        target.path = job.create ? job.path + TemporarySuffix : job.path;
+        target.jobs.push_back(index);
+        target.writes.push_back(CreateWriteVector(job.offset, job.parts));
+        target.fd = open(target.path.c_str(), job.create ? (O_WRONLY | O_CREAT | O_TRUNC) : O_WRONLY, 0644);
+        if (target.fd == -1) {
+            m_logger.error("Couldn't open \"{}\" [errno: {}]", target.path, errno);
+            target.ok = false;
+            continue;
+        }
+
+#ifdef __linux__
+        // Encoded size is known, the file is allocated at once instead of growing with every write
+        size_t size = target.writes.front().size;
+        if (job.create && size && fallocate(target.fd, 0, 0, static_cast<off_t>(size)) == -1 && errno != EOPNOTSUPP) {
+            m_logger.error("Couldn't allocate {} for \"{}\" [errno: {}]", Utility::ToReadableSize(size), target.path, errno);
+            target.ok = false;
+        }
+#endif
+    }
+
+#ifdef CP_USE_IO_URING
+    if (m_ringReady && !WriteRing(m_ring, targets, m_logger)) {
+        m_logger.warn("io_uring is broken, files are written with pwritev() from now on");
+        io_uring_queue_exit(&m_ring);
+        m_ringReady = false;
+        WriteSynchronously(targets, m_logger);
+    }
+    else if (!m_ringReady) {
+        WriteSynchronously(targets, m_logger);
+    }
+#else
+    WriteSynchronously(targets, m_logger);
+#endif
+
+    // Complete files are published, and renames are made durable with one fsync per directory
+    std::set<std::string> directories;
+    for (Target& target : targets) {
+        const Job& job = batch[target.jobs.front()];
+        if (target.fd != -1) {
+            close(target.fd);
+        }
+
+        if (job.create) {
+            if (target.ok && rename(target.path.c_str(), job.path.c_str()) == -1) {
+                m_logger.error("Couldn't rename \"{}\" to \"{}\" [errno: {}]", target.path, job.path, errno);
+                target.ok = false;
+            }
+            if (!target.ok) {
+                unlink(target.path.c_str());
+            }
+            else {
+                std::string directory = std::filesystem::path(job.path).parent_path().string();
+                directories.insert(directory.empty() ? "." : directory);
+            }
+        }
+
+        if (!target.ok) {
+            failedJobs.insert(failedJobs.end(), target.jobs.begin(), target.jobs.end());
+        }
+    }
+
+    for (const std::string& directory : directories) {
+        int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd == -1 || fsync(fd) == -1) {
+            m_logger.error("Couldn't flush directory \"{}\" [errno: {}]", directory, errno);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+#else
+    for (size_t index = 0; index < batch.size(); ++index) {
+        const Job& job = batch[index];
+        std::string writePath = job.create ? job.path + TemporarySuffix : job.path;
+        std::FILE* file = std::fopen(writePath.c_str(), job.create ? "wb" : "r+b");
+        bool written = file && std::fseek(file, static_cast<long>(job.offset), SEEK_SET) == 0;
+        for (const Data& part : job.parts) {
+            written = written && (!part || part->empty() || std::fwrite(part->data(), part->size(), 1, file) == 1);
+        }
+        if (file) {
+            written = (std::fclose(file) == 0) && written;
+        }
+
+        std::error_code error;
+        if (written && job.create) {
+            std::filesystem::rename(writePath, job.path, error);
+            written = !error;
+        }
+        if (!written) {
+            m_logger.error("Couldn't write \"{}\"", writePath);
+            if (job.create) {
+                std::filesystem::remove(writePath, error);
+            }
+            failedJobs.push_back(index);
+        }
+    }
+#endif
+
+    std::sort(failedJobs.begin(), failedJobs.end());
+    return failedJobs;
+}
+
+void FileWriter::complete(const std::vector<Job>& batch, std::vector<Commit>& commits, const std::vector<size_t>& failedJobs) {
+    std::vector<std::vector<Failure>> failures(commits.size());
+    std::vector<Failure> uncompleted;
+    for (size_t index : failedJobs) {
+        Failure failure = { batch[index].path, batch[index].offset, batch[index].create };
+        auto commit = std::find_if(commits.begin(), commits.end(), [index](const Commit& commit) {
+            return index >= commit.begin && index < commit.end;
+        });
+        if (commit == commits.end()) {
+            uncompleted.push_back(std::move(failure));
+            continue;
+        }
+        failures[commit - commits.begin()].push_back(std::move(failure));
+    }
+
+    if (!uncompleted.empty()) {
+        std::lock_guard lock(m_mutex);
+        m_failures.insert(m_failures.end(), std::make_move_iterator(uncompleted.begin()), std::make_move_iterator(uncompleted.end()));
+    }
+
+    for (size_t index = 0; index < commits.size(); ++index) {
+        try {
+            commits[index].completion(std::move(failures[index]));
+        }
+        catch (const std::exception& error) {
+            m_logger.error("Commit completion failed: \"{}\"", error.what());
+        }
+    }
+}
+
+void FileWriter::write(const std::string& path, Data data) {
+    std::lock_guard lock(m_mutex);
+    m_pending.push_back({ path, 0, { std::move(data) }, true });
+}
+
+void FileWriter::write(const std::string& path, uint64_t offset, Data data) {
+    std::lock_guard lock(m_mutex);
+    m_pending.push_back({ path, offset, { std::move(data) }, false });
+}
+
+void FileWriter::write(const std::string& path, uint64_t offset, std::vector<Data> parts) {
+    std::lock_guard lock(m_mutex);
+    m_pending.push_back({ path, offset, std::move(parts), false });
+}
+
+void FileWriter::commit(Completion completion) {
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_pending.empty() && !completion) {
+            return;
+        }
+
+        // Completion of a commit without writes is still called in order with the others
+        size_t begin = m_queue.size();
+        m_queue.insert(m_queue.end(), std::make_move_iterator(m_pending.begin()), std::make_move_iterator(m_pending.end()));
+        m_pending.clear();
+        if (completion) {
+            m_commits.push_back({ begin, m_queue.size(), std::move(completion) });
+        }
+    }
+    m_cv.notify_one();
+}
+
+void FileWriter::flush() {
+    commit();
+    std::unique_lock lock(m_mutex);
+    m_doneCv.wait(lock, [this]() { return m_queue.empty() && m_commits.empty() && !m_busy; });
+}
+
+std::vector<FileWriter::Failure> FileWriter::takeFailures() {
+    std::lock_guard lock(m_mutex);
+    std::vector<Failure> failures;
+    failures.swap(m_failures);
+    return failures;
+}
+
+} // namespace cp
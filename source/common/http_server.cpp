@@ -1,7 +1,22 @@
 #include "common/http_server.hpp"
+using namespace cp::HttpServerConst;
 
 #include <sstream>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string_view>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sys/sendfile.h>
+    #include <unistd.h>
+#endif
 
 #include <boost/beast/core/buffers_to_string.hpp>
 #include <boost/regex.hpp>
@@ -9,9 +24,15 @@
 #include <nlohmann/json.hpp>
 using nlohmann::json;
 
+#include <fmt/chrono.h>
 #include <fmt/format.h>
 
+#include "capture/contact_sheet.hpp"
+#include "capture/storage.hpp"
 #include "common/config.hpp"
+#include "common/jpeg.hpp"
+#include "common/overlay.hpp"
+#include "common/pyramid.hpp"
 #include "common/utility.hpp"
 
 namespace cp {
@@ -50,6 +71,67 @@ static int GetItemsCount(const std::string& query) {
     }
 }
 
+/*
+*   "If-None-Match" is a list of entity tags or "*", compared weakly: "W/" prefix doesn't matter.
+*   Tags are quoted and can't contain quotes, so the list is split at them rather than at commas.
+*/
+static bool MatchesEtag(std::string_view header, std::string_view etag) {
+    auto strip = [](std::string_view tag) {
+        return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag;
+    };
+    etag = strip(etag);
+
+    size_t position = 0;
+    while (position < header.size()) {
+        position = header.find_first_not_of(" \t,", position);
+        if (position == std::string_view::npos) {
+            return false;
+        }
+        if (header[position] == '*') {
+            return true;
+        }
+
+        size_t opening = header.find('"', position);
+        size_t closing = (opening == std::string_view::npos ? opening : header.find('"', opening + 1));
+        if (closing == std::string_view::npos) {
+            return false;
+        }
+        if (strip(header.substr(position, closing + 1 - position)) == etag) {
+            return true;
+        }
+        position = closing + 1;
+    }
+    return false;
+}
+
+static std::optional<std::string> GetQueryValue(const std::string& query, const std::string& name) {
+    boost::smatch matches;
+    if (!boost::regex_search(query, matches, boost::regex(fmt::format(R"((?:^|&){}=([^&]*))", name)))) {
+        return {};
+    }
+    return matches.str(1);
+}
+
+static std::optional<int64_t> GetQueryNumber(const std::string& query, const std::string& name) {
+    std::optional<std::string> value = GetQueryValue(query, name);
+    if (!value) {
+        return {};
+    }
+
+    try {
+        size_t position = 0;
+        int64_t number = std::stoll(*value, &position);
+        if (position != value->size()) {
+            return {};
+        }
+        return number;
+    }
+    catch (...) {
+        // Not a number or number is too big or too small
+        return {};
+    }
+}
+
 static HttpServer::Connection::HistoryFields GetHistoryFields(const std::string& query) {
     boost::smatch matches;
     if (!boost::regex_search(query, matches, boost::regex(R"(fields=["']?([\w|]+)["']?)"))) {
@@ -76,20 +158,120 @@ static HttpServer::Connection::HistoryFields GetHistoryFields(const std::string&
     return fields;
 }
 
-HttpServer::Connection::Connection(Logger logger, Display::Ui::Pointer displayUi, Capture::Master::Pointer captureMaster, asio::ip::tcp::socket& socket)
+// Decode percent-encoded URL path, empty if it's malformed
+static std::optional<std::string> DecodeUrl(const std::string& url) {
+    std::string result;
+    for (size_t index = 0; index < url.size(); ++index) {
+        if (url[index] != '%') {
+            result.push_back(url[index]);
+            continue;
+        }
+
+        if (index + 2 >= url.size() || !std::isxdigit(url[index + 1]) || !std::isxdigit(url[index + 2])) {
+            return {};
+        }
+        result.push_back(static_cast<char>(std::stoi(url.substr(index + 1, 2), nullptr, 16)));
+        index += 2;
+    }
+    return result;
+}
+
+// Date in HTTP format (RFC 9110 IMF-fixdate)
+static std::string ToHttpDate(std::filesystem::file_time_type time) {
+    auto systemTime = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+        time - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now()
+    );
+    return fmt::format("{:%a, %d %b %Y %H:%M:%S} GMT", fmt::gmtime(std::chrono::system_clock::to_time_t(systemTime)));
+}
+
+static const char* GetContentType(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    if (extension == ".jpeg" || extension == ".jpg") {
+        return "image/jpeg";
+    }
+    if (extension == ".json") {
+        return "application/json";
+    }
+    if (extension == ".avi") {
+        return "video/x-msvideo";
+    }
+    return "application/octet-stream";
+}
+
+/*
+*   Capture is resized from the smallest preview at least as wide as requested, or from the capture itself.
+*   The source is decoded at the smallest DCT scale that is still wide enough, and is only shrunk the rest of the way.
+*   Previews carry overlay metadata of their capture, so the overlay is drawn without reading the capture.
+*/
+static Jpeg::Buffer ResizeCapture(Capture::TaskId task, const Capture::Index::Entry& entry, int width, bool overlay) {
+    constexpr Pyramid::Level Levels[] = { Pyramid::Level::Thumbnail, Pyramid::Level::Eighth, Pyramid::Level::Quarter, Pyramid::Level::Half };
+
+    Jpeg::Buffer source;
+    for (Pyramid::Level level : Levels) {
+        try {
+            Jpeg::Buffer preview = Capture::Storage::ReadPreview(task, entry.timestamp, level);
+            if (Jpeg::ReadDimensions(preview.data(), preview.size()).width >= width) {
+                source = std::move(preview);
+                break;
+            }
+        }
+        catch (const std::runtime_error&) {
+            // Capture has no previews or they are broken
+            break;
+        }
+    }
+
+    std::optional<Camera::UiInfo> info;
+    if (source.empty()) {
+        source = Capture::Storage::Read(task, entry);
+        info = overlay ? Overlay::Read(source) : std::nullopt;
+        if (!info && Jpeg::ReadDimensions(source.data(), source.size()).width <= width) {
+            return source;
+        }
+    }
+    else if (overlay) {
+        info = Overlay::Read(source);
+    }
+
+    Image image = Jpeg::DecodeToWidth(source.data(), source.size(), width);
+    if (image.width() > width) {
+        int height = std::max(static_cast<int>(std::lround(static_cast<double>(width) * image.height() / image.width())), 1);
+        image = Pyramid::Shrink(image, width, height);
+    }
+    if (info) {
+        Overlay::Draw(image, *info);
+    }
+    return Jpeg::Encode(image, ResizedQuality);
+}
+
+// Cache key and ETag of a capture: its size is a part of it, recompressed capture is a new image
+static std::string CaptureKey(Capture::TaskId task, Capture::Event::Timestamp timestamp, size_t size) {
+    return fmt::format("{}.{}.{}", Capture::GetTask(task).directory, timestamp, size);
+}
+
+static Jpeg::Buffer RenderOverlay(const Jpeg::Buffer& data, const Camera::UiInfo& info) {
+    Image image = Jpeg::Decode(data.data(), data.size());
+    Overlay::Draw(image, info);
+    return Jpeg::Encode(image, OverlayQuality);
+}
+
+HttpServer::Connection::Connection(Logger logger, Display::Ui::Pointer displayUi, Capture::Master::Pointer captureMaster, std::shared_ptr<ImageCache> imageCache, std::shared_ptr<Sensors::Charts> charts, asio::thread_pool& workers, asio::ip::tcp::socket& socket)
     : m_logger(logger)
     , m_displayUi(displayUi)
     , m_captureMaster(captureMaster)
+    , m_imageCache(imageCache)
+    , m_charts(charts)
+    , m_workers(workers)
     , m_socket(std::move(socket))
     , m_buffer(1024 * 8)
-    , m_timeout(m_socket.get_executor(), std::chrono::seconds(10)) {
+    , m_timeout(m_socket.get_executor(), Timeout) {
     m_logMessage = [this](const std::string& message) {
         return fmt::format(
             "{} {} from {}: {} {}",
             std::string(m_request.method_string()),
             std::string(m_request.target()),
             m_socket.remote_endpoint().address().to_string(),
-            m_response.result_int(),
+            m_image ? m_imageResponse.result_int() : m_response.result_int(),
             message
         );
     };
@@ -100,6 +282,14 @@ HttpServer::Connection::Connection(Logger logger, Display::Ui::Pointer displayUi
     });
 }
 
+HttpServer::Connection::~Connection() {
+#ifdef __linux__
+    if (m_file != -1) {
+        close(m_file);
+    }
+#endif
+}
+
 void HttpServer::Connection::notFound() {
     m_response.result(beast::http::status::not_found);
     m_response.set(beast::http::field::content_type, "text/plain");
@@ -198,45 +388,426 @@ void HttpServer::Connection::getHistory(Sensors::Location location, int itemsCou
     }
     response += '\n';
 
+    using Field = Sensors::Recorder::History::Field;
     Sensors::Recorder::HistoryHandle handle = Sensors::Recorder::Instance->historyHandle();
-    Sensors::Recorder::History::const_iterator iterator = (itemsCount == -1 || itemsCount > handle.history.size() ? handle.history.begin() : handle.history.end() - itemsCount);
-    for (Sensors::Recorder::History::const_iterator end = handle.history.end(); iterator != end; ++iterator) {
-        response += fmt::format(
-            "{};{}",
-            Utility::ToUnixTimestamp(iterator->timestamp),
-            Utility::IsDaylight(iterator->timestamp) ? "true" : "false"
-        );
+    const Sensors::Recorder::History& history = handle.history;
+    size_t first = (itemsCount == -1 || static_cast<size_t>(itemsCount) > history.size() ? 0 : history.size() - itemsCount);
+    size_t count = history.size() - first;
 
-        const auto& measurement = (location == Sensors::Location::Internal ? iterator->internal : iterator->external);
-        if (!measurement) {
-            if (fields.temperature) {
-                response += ';';
-            }
-            if (fields.alternative) {
-                response += ';';
-            }
-            if (fields.humidity) {
-                response += ';';
+    // Every column of the range is split at the same index, so the segments are walked together
+    auto timestamps = history.timestamps(first, count);
+    auto temperatures = history.column(location, Field::Temperature, first, count);
+    auto alternatives = history.column(location, Field::Alternative, first, count);
+    auto humidities = history.column(location, Field::Humidity, first, count);
+    auto pressures = history.column(location, Field::Pressure, first, count);
+    response.reserve(response.size() + count * 64);
+    size_t index = first;
+    for (size_t segment = 0; segment < timestamps.size(); ++segment) {
+        for (size_t item = 0; item < timestamps[segment].size(); ++item, ++index) {
+            pt::ptime timestamp = Utility::FromUnixMicroseconds(timestamps[segment][item]);
+            response += fmt::format(
+                "{};{}",
+                Utility::ToUnixTimestamp(timestamp),
+                Utility::IsDaylight(timestamp) ? "true" : "false"
+            );
+
+            if (!history.valid(location, index)) {
+                if (fields.temperature) {
+                    response += ';';
+                }
+                if (fields.alternative) {
+                    response += ';';
+                }
+                if (fields.humidity) {
+                    response += ';';
+                }
+                if (fields.pressure) {
+                    response += ';';
+                }
             }
-            if (fields.pressure) {
-                response += ';';
+            else {
+                if (fields.temperature) {
+                    response += fmt::format(";{:.2f}", temperatures[segment][item]);
+                }
+                if (fields.alternative) {
+                    response += fmt::format(";{:.2f}", alternatives[segment][item]);
+                }
+                if (fields.humidity) {
+                    response += fmt::format(";{:.2f}", humidities[segment][item]);
+                }
+                if (fields.pressure) {
+                    response += fmt::format(";{:.2f}", pressures[segment][item]);
+                }
             }
+            response += '\n';
         }
-        else {
-            if (fields.temperature) {
-                response += fmt::format(";{:.2f}", measurement->bmp280.temperature);
+    }
+    handle.lock.unlock();
+
+    m_response.result(beast::http::status::ok);
+    m_response.set(beast::http::field::content_type, "text/csv");
+    beast::ostream(m_response.body()) << response;
+    m_logger->info(m_logMessage("OK"));
+}
+
+void HttpServer::Connection::getHistoryChart(Sensors::Location location, const std::string& query, int indentation) {
+    std::optional<int64_t> hours = GetQueryNumber(query, "hours");
+    if (GetQueryValue(query, "hours") && (!hours || *hours < 1 || *hours > Sensors::ChartsConst::MaxHours)) {
+        badRequest(fmt::format("Hours must be a number from 1 to {}", Sensors::ChartsConst::MaxHours), indentation);
+        return;
+    }
+
+    HistoryFields historyFields = GetHistoryFields(query);
+    Sensors::Charts::Fields fields = { historyFields.temperature, historyFields.alternative, historyFields.humidity, historyFields.pressure };
+    if (fields == Sensors::Charts::Fields{ false, false, false, false }) {
+        badRequest("No known fields to chart", indentation);
+        return;
+    }
+
+    // Rendering takes a while, it's done by a worker and the response is sent when it's done
+    m_deferred = true;
+    int window = hours ? static_cast<int>(*hours) : Sensors::ChartsConst::DefaultHours;
+    asio::post(m_workers, [self = shared_from_this(), location, window, fields, indentation]() {
+        Sensors::Charts::Chart chart;
+        std::string error;
+        try {
+            chart = self->m_charts->get(location, window, fields);
+        }
+        catch (const std::exception& exception) {
+            error = exception.what();
+        }
+
+        asio::post(self->m_socket.get_executor(), [self, chart, error, location, window, fields, indentation]() {
+            if (chart.data) {
+                // History only changes with its generation, so does the chart
+                std::string etag = fmt::format(
+                    "\"chart.{}.{}.{:d}{:d}{:d}{:d}.{}\"",
+                    location == Sensors::Location::Internal ? "internal" : "external",
+                    window,
+                    fields.temperature, fields.alternative, fields.humidity, fields.pressure,
+                    chart.generation
+                );
+                self->sendImage(chart.data, etag, "image/png");
+            }
+            else {
+                self->chartUnrenderable(error, indentation);
             }
-            if (fields.alternative) {
-                response += fmt::format(";{:.2f}", measurement->aht20.temperature);
+            self->sendResponse();
+        });
+    });
+}
+
+void HttpServer::Connection::badRequest(const std::string& what, int indentation) {
+    json responseJson;
+    responseJson["_success"] = false;
+    responseJson["what"] = what;
+
+    m_response.result(beast::http::status::bad_request);
+    m_response.set(beast::http::field::content_type, "application/json");
+    beast::ostream(m_response.body()) << responseJson.dump(indentation) << '\n';
+    m_logger->error(m_logMessage(fmt::format("Bad Request: {}", what)));
+}
+
+void HttpServer::Connection::indexUnavailable(int indentation) {
+    json responseJson;
+    responseJson["_success"] = false;
+    responseJson["what"] = "Capture index is not available: capture master wasn't started yet";
+
+    m_response.result(beast::http::status::service_unavailable);
+    m_response.set(beast::http::field::content_type, "application/json");
+    beast::ostream(m_response.body()) << responseJson.dump(indentation) << '\n';
+    m_logger->error(m_logMessage("Service Unavailable"));
+}
+
+void HttpServer::Connection::captureUnreadable(const std::string& error, int indentation) {
+    json responseJson;
+    responseJson["_success"] = false;
+    responseJson["what"] = "Sorry, something went wrong: capture couldn't be read.";
+
+    m_response.result(beast::http::status::internal_server_error);
+    m_response.set(beast::http::field::content_type, "application/json");
+    beast::ostream(m_response.body()) << responseJson.dump(indentation) << '\n';
+    m_logger->error(m_logMessage(fmt::format("Internal Server Error: {}", error)));
+}
+
+void HttpServer::Connection::chartUnrenderable(const std::string& error, int indentation) {
+    json responseJson;
+    responseJson["_success"] = false;
+    responseJson["what"] = "Sorry, something went wrong: chart couldn't be rendered.";
+
+    m_response.result(beast::http::status::internal_server_error);
+    m_response.set(beast::http::field::content_type, "application/json");
+    beast::ostream(m_response.body()) << responseJson.dump(indentation) << '\n';
+    m_logger->error(m_logMessage(fmt::format("Internal Server Error: {}", error)));
+}
+
+void HttpServer::Connection::sendImage(Jpeg::SharedBuffer image, const std::string& etag, const char* contentType) {
+    if (MatchesEtag(std::string(m_request[beast::http::field::if_none_match]), etag)) {
+        m_response.result(beast::http::status::not_modified);
+        m_response.set(beast::http::field::etag, etag);
+        m_response.set(beast::http::field::cache_control, "no-cache");
+        m_logger->info(m_logMessage("Not Modified"));
+        return;
+    }
+
+    // Image is never modified, so it's sent without copying and only kept alive until it's sent
+    m_image = std::move(image);
+    m_imageResponse.result(beast::http::status::ok);
+    m_imageResponse.set(beast::http::field::content_type, contentType);
+    m_imageResponse.set(beast::http::field::etag, etag);
+    m_imageResponse.set(beast::http::field::cache_control, "no-cache");
+    m_imageResponse.body().data = const_cast<uint8_t*>(m_image->data());
+    m_imageResponse.body().size = m_image->size();
+    m_imageResponse.body().more = false;
+    m_logger->info(m_logMessage("OK"));
+}
+
+ImageCache::Callback HttpServer::Connection::imageSender(const std::string& key, int indentation) {
+    return [self = shared_from_this(), key, indentation](Jpeg::SharedBuffer image, const std::string& error) {
+        asio::post(self->m_socket.get_executor(), [self, image, error, key, indentation]() {
+            if (image) {
+                self->sendImage(image, fmt::format("\"{}\"", key));
             }
-            if (fields.humidity) {
-                response += fmt::format(";{:.2f}", measurement->aht20.humidity);
+            else {
+                self->captureUnreadable(error, indentation);
             }
-            if (fields.pressure) {
-                response += fmt::format(";{:.2f}", measurement->bmp280.pressure);
+            self->sendResponse();
+        });
+    };
+}
+
+void HttpServer::Connection::generateImage(const std::string& key, ImageCache::Generator generator, int indentation) {
+    // Generation takes a while, it's done by a worker and the response is sent when it's done
+    m_deferred = true;
+    // Requests of an image that is being generated don't occupy a worker, they are completed by the one generating it
+    asio::post(m_workers, [self = shared_from_this(), key, generator = std::move(generator), indentation]() {
+        self->m_imageCache->get(key, generator, self->imageSender(key, indentation));
+    });
+}
+
+void HttpServer::Connection::readCapture(Capture::TaskId task, Capture::Index::Entry entry, bool overlay, int indentation) {
+    // Reading waits for storage, it's done by a worker and the response is sent when it's done
+    m_deferred = true;
+    asio::post(m_workers, [self = shared_from_this(), task, entry, overlay, indentation]() {
+        Jpeg::SharedBuffer data;
+        std::string error;
+        try {
+            data = std::make_shared<const Jpeg::Buffer>(Capture::Storage::Read(task, entry));
+        }
+        catch (const std::exception& exception) {
+            error = exception.what();
+        }
+
+        // Captures are sent as they are, only their overlay is cached
+        std::string key = CaptureKey(task, entry.timestamp, data ? data->size() : entry.size);
+        std::optional<Camera::UiInfo> info = (data && overlay) ? Overlay::Read(*data) : std::nullopt;
+        if (!info) {
+            self->imageSender(key, indentation)(data, error);
+            return;
+        }
+
+        key += ".overlay";
+        self->m_imageCache->get(key, [data, info = *info]() { return RenderOverlay(*data, info); }, self->imageSender(key, indentation));
+    });
+}
+
+void HttpServer::Connection::sendCapture(Capture::TaskId task, Capture::Event::Timestamp timestamp, Jpeg::SharedBuffer data, bool overlay, int indentation) {
+    std::string key = CaptureKey(task, timestamp, data->size());
+    std::optional<Camera::UiInfo> info = overlay ? Overlay::Read(*data) : std::nullopt;
+    if (!info) {
+        sendImage(data, fmt::format("\"{}\"", key));
+        return;
+    }
+
+    generateImage(fmt::format("{}.overlay", key), [data, info = *info]() {
+        return RenderOverlay(*data, info);
+    }, indentation);
+}
+
+void HttpServer::Connection::getLatestCapture(const std::string& query, int indentation) {
+    std::optional<std::string> taskName = GetQueryValue(query, "task");
+    const Capture::Task* task = taskName ? Capture::FindTask(*taskName) : nullptr;
+    if (taskName && (!task || !task->directory)) {
+        badRequest("Unknown task", indentation);
+        return;
+    }
+
+    std::optional<Capture::TaskId> taskId;
+    if (task) {
+        taskId = task->id;
+    }
+
+    bool overlay = (GetQueryValue(query, "overlay") != "false");
+    std::optional<Capture::Master::LatestCapture> latest = m_captureMaster->latestCapture(taskId);
+    if (latest) {
+        sendCapture(latest->task, latest->timestamp, latest->data, overlay, indentation);
+        return;
+    }
+
+    // Nothing was captured since start, the latest capture is read from storage
+    std::shared_ptr<const Capture::Index> index = m_captureMaster->index();
+    if (!index) {
+        indexUnavailable(indentation);
+        return;
+    }
+
+    Capture::TaskId latestTask = Capture::TaskId::Start;
+    std::optional<Capture::Index::Entry> entry;
+    for (const Capture::Task& candidate : Capture::Tasks) {
+        if (!candidate.directory || (taskId && candidate.id != *taskId)) {
+            continue;
+        }
+
+        std::optional<Capture::Index::Entry> last = index->last(candidate.id);
+        if (last && (!entry || last->timestamp > entry->timestamp)) {
+            entry = last;
+            latestTask = candidate.id;
+        }
+    }
+
+    if (!entry) {
+        notFound();
+        return;
+    }
+    readCapture(latestTask, *entry, overlay, indentation);
+}
+
+void HttpServer::Connection::getCaptures(const std::string& query, int indentation) {
+    std::optional<std::string> taskName = GetQueryValue(query, "task");
+    const Capture::Task* task = taskName ? Capture::FindTask(*taskName) : nullptr;
+    if (!task || !task->directory) {
+        badRequest("Unknown or missing task", indentation);
+        return;
+    }
+
+    std::optional<int64_t> from = GetQueryNumber(query, "from");
+    std::optional<int64_t> to = GetQueryNumber(query, "to");
+    std::optional<int64_t> offset = GetQueryNumber(query, "offset");
+    std::optional<int64_t> limit = GetQueryNumber(query, "limit");
+    if ((offset && *offset < 0) || (limit && *limit <= 0)) {
+        badRequest("Offset and limit must be positive", indentation);
+        return;
+    }
+
+    // Index timestamps are in microseconds, the range has to be convertible to them
+    constexpr int64_t MaxTimestamp = std::numeric_limits<int64_t>::max() / 1'000'000 - 1;
+    constexpr int64_t MinTimestamp = std::numeric_limits<int64_t>::min() / 1'000'000 + 1;
+    if ((GetQueryValue(query, "from") && (!from || *from < MinTimestamp || *from > MaxTimestamp))
+        || (GetQueryValue(query, "to") && (!to || *to < MinTimestamp || *to > MaxTimestamp))) {
+        badRequest(fmt::format("Timestamps must be numbers from {} to {}", MinTimestamp, MaxTimestamp), indentation);
+        return;
+    }
+
+    // Change score is a fraction of changed cells, so is the filter
+    std::optional<double> minChange;
+    if (std::optional<std::string> value = GetQueryValue(query, "min_change")) {
+        try {
+            size_t position = 0;
+            minChange = std::stod(*value, &position);
+            if (position != value->size() || *minChange < 0.0 || *minChange > 1.0) {
+                throw std::invalid_argument("out of range");
             }
         }
-        response += '\n';
+        catch (...) {
+            badRequest("Minimal change must be a number from 0 to 1", indentation);
+            return;
+        }
+    }
+
+    std::shared_ptr<const Capture::Index> index = m_captureMaster->index();
+    if (!index) {
+        indexUnavailable(indentation);
+        return;
+    }
+
+    Capture::Index::QueryResult result = index->query(
+        task->id,
+        from ? *from * 1'000'000 : std::numeric_limits<int64_t>::min(),
+        to ? *to * 1'000'000 + 999'999 : std::numeric_limits<int64_t>::max(),
+        offset ? static_cast<size_t>(*offset) : 0,
+        limit ? static_cast<size_t>(*limit) : Capture::IndexConst::MaxQueryLimit,
+        minChange ? Capture::Index::Filter([minChange = *minChange](const Capture::Index::Entry& entry) { return entry.change >= minChange; }) : Capture::Index::Filter()
+    );
+
+    json capturesArray = json::array();
+    for (const Capture::Index::Entry& entry : result.entries) {
+        pt::ptime timestamp = Utility::FromUnixMicroseconds(entry.timestamp);
+        json captureObject;
+        captureObject["timestamp"] = Utility::ToUnixTimestamp(timestamp);
+        captureObject["path"] = Capture::Storage::Path(task->id, entry);
+        captureObject["offset"] = entry.offset;
+        captureObject["size"] = entry.size;
+        captureObject["mean_luma"] = Utility::Round(entry.meanLuma, Sensors::Precision);
+        captureObject["clipped"] = Utility::Round(entry.clipped, 4);
+        captureObject["sky_luma"] = Utility::Round(entry.skyLuma, Sensors::Precision);
+        captureObject["cloud_cover"] = Utility::Round(entry.cloudCover, 4);
+        captureObject["color_temperature"] = std::round(entry.colorTemperature);
+        captureObject["gain"] = Utility::Round(entry.gain, 4);
+        captureObject["shift_x"] = Utility::Round(entry.shiftX, 2);
+        captureObject["shift_y"] = Utility::Round(entry.shiftY, 2);
+        captureObject["change"] = Utility::Round(entry.change, 4);
+        captureObject["change_mask"] = fmt::format("{:016x}", entry.changeMask);
+        capturesArray.push_back(captureObject);
+    }
+
+    json responseJson;
+    responseJson["_success"] = true;
+    responseJson["task"] = task->name;
+    responseJson["total"] = result.total;
+    responseJson["offset"] = offset ? *offset : 0;
+    responseJson["captures"] = capturesArray;
+
+    m_response.result(beast::http::status::ok);
+    m_response.set(beast::http::field::content_type, "application/json");
+    beast::ostream(m_response.body()) << responseJson.dump(indentation) << '\n';
+    m_logger->info(m_logMessage("OK"));
+}
+
+void HttpServer::Connection::getSceneHistory(const std::string& query, int indentation) {
+    std::optional<std::string> taskName = GetQueryValue(query, "task");
+    const Capture::Task* task = taskName ? Capture::FindTask(*taskName) : nullptr;
+    if (!task || !task->directory) {
+        badRequest("Unknown or missing task", indentation);
+        return;
+    }
+
+    std::shared_ptr<const Capture::Index> index = m_captureMaster->index();
+    if (!index) {
+        indexUnavailable(indentation);
+        return;
+    }
+
+    // Unmeasured metrics are left empty, like missing sensor measurements
+    auto formatMetric = [](float value, const char* format) {
+        return std::isnan(value) ? std::string() : fmt::format(fmt::runtime(format), value);
+    };
+
+    // Index is read page by page, the history is the last "count" captures
+    constexpr int64_t From = std::numeric_limits<int64_t>::min(), To = std::numeric_limits<int64_t>::max();
+    size_t total = index->query(task->id, From, To, 0, 1).total;
+    int itemsCount = GetItemsCount(query);
+    size_t offset = (itemsCount == -1 || static_cast<size_t>(itemsCount) > total ? 0 : total - itemsCount);
+
+    std::string response = "Timestamp;Daylight;MeanLuma;SkyLuma;CloudCover;ColorTemperature\n";
+    while (offset < total) {
+        Capture::Index::QueryResult result = index->query(task->id, From, To, offset, Capture::IndexConst::MaxQueryLimit);
+        if (result.entries.empty()) {
+            break;
+        }
+
+        for (const Capture::Index::Entry& entry : result.entries) {
+            pt::ptime timestamp = Utility::FromUnixMicroseconds(entry.timestamp);
+            response += fmt::format(
+                "{};{};{:.2f};{};{};{}\n",
+                Utility::ToUnixTimestamp(timestamp),
+                Utility::IsDaylight(timestamp) ? "true" : "false",
+                entry.meanLuma,
+                formatMetric(entry.skyLuma, "{:.2f}"),
+                formatMetric(entry.cloudCover, "{:.4f}"),
+                formatMetric(entry.colorTemperature, "{:.0f}")
+            );
+        }
+        offset += result.entries.size();
     }
 
     m_response.result(beast::http::status::ok);
@@ -245,6 +816,200 @@ void HttpServer::Connection::getHistory(Sensors::Location location, int itemsCou
     m_logger->info(m_logMessage("OK"));
 }
 
+void HttpServer::Connection::getCapture(const std::string& resource, const std::string& query, int indentation) {
+    boost::smatch matches;
+    if (!boost::regex_match(resource, matches, boost::regex(R"(/api/capture/(\w+)/(\d{1,12}))"))) {
+        notFound();
+        return;
+    }
+
+    const Capture::Task* task = Capture::FindTask(matches.str(1));
+    if (!task || !task->directory) {
+        notFound();
+        return;
+    }
+
+    std::optional<int64_t> width = GetQueryNumber(query, "w");
+    if (GetQueryValue(query, "w") && (!width || *width < MinResizedWidth || *width > std::numeric_limits<int>::max())) {
+        badRequest(fmt::format("Width must be a number not less than {}", MinResizedWidth), indentation);
+        return;
+    }
+
+    std::shared_ptr<const Capture::Index> index = m_captureMaster->index();
+    if (!index) {
+        indexUnavailable(indentation);
+        return;
+    }
+
+    // Timestamps are reported by "/api/captures" in seconds
+    int64_t timestamp = std::stoll(matches.str(2)) * 1'000'000;
+    Capture::Index::QueryResult result = index->query(task->id, timestamp, timestamp + 999'999, 0, 1);
+    if (result.entries.empty()) {
+        notFound();
+        return;
+    }
+
+    Capture::Index::Entry entry = result.entries.front();
+    bool overlay = (GetQueryValue(query, "overlay") != "false");
+    if (!width) {
+        readCapture(task->id, entry, overlay, indentation);
+        return;
+    }
+
+    // Capture size is a part of the key: recompressed capture is a new image
+    std::string key = fmt::format("{}.{}.{}.{}{}", task->directory, entry.timestamp, entry.size, *width, overlay ? ".overlay" : "");
+    generateImage(key, [task = task->id, entry, width = static_cast<int>(*width), overlay]() {
+        return ResizeCapture(task, entry, width, overlay);
+    }, indentation);
+}
+
+void HttpServer::Connection::getContactSheet(const std::string& resource, int indentation) {
+    boost::smatch matches;
+    if (!boost::regex_match(resource, matches, boost::regex(R"(/api/contact_sheet/(\d{4})-(\d{2})-(\d{2}))"))) {
+        notFound();
+        return;
+    }
+
+    dt::date date;
+    try {
+        date = dt::date(std::stoi(matches.str(1)), std::stoi(matches.str(2)), std::stoi(matches.str(3)));
+    }
+    catch (const std::out_of_range&) {
+        notFound();
+        return;
+    }
+
+    // Sheets of finished days are generated by capture master and served as files
+    std::string path = Capture::Layout::ContactSheetPath(date);
+    if (std::filesystem::exists(path)) {
+        getFile("/" + path, indentation);
+        return;
+    }
+
+    std::shared_ptr<const Capture::Index> index = m_captureMaster->index();
+    if (!index) {
+        indexUnavailable(indentation);
+        return;
+    }
+
+    std::vector<Capture::ContactSheet::Tile> tiles = Capture::ContactSheet::Tiles(*index, date);
+    if (tiles.empty()) {
+        notFound();
+        return;
+    }
+
+    // Sheet of the current day changes with every capture, the latest capture is a part of the key
+    std::string key = fmt::format("sheet.{}.{}.{}", dt::to_iso_string(date), tiles.size(), tiles.back().entry.timestamp);
+    generateImage(key, [tiles = std::move(tiles), date]() {
+        return Capture::ContactSheet::Generate(tiles, date);
+    }, indentation);
+}
+
+void HttpServer::Connection::getFile(const std::string& resource, int indentation) {
+    namespace fs = std::filesystem;
+
+    // Files outside of capture directory are never served, whatever the path is
+    std::optional<std::string> decoded = DecodeUrl(resource.substr(1));
+    std::error_code error;
+    fs::path root = fs::canonical(Capture::LayoutConst::CaptureDirectory, error);
+    fs::path path = decoded ? fs::canonical(*decoded, error) : fs::path();
+    if (!decoded || error || std::mismatch(root.begin(), root.end(), path.begin(), path.end()).first != root.end()) {
+        notFound();
+        return;
+    }
+
+    uint64_t fileSize = fs::file_size(path, error);
+    fs::file_time_type modified = fs::last_write_time(path, error);
+    if (error || !fs::is_regular_file(path)) {
+        notFound();
+        return;
+    }
+
+    /*
+    *   Only a single range is supported, others are answered with the whole file as allowed by RFC 9110.
+    *   Range is ignored if "If-Range" is present and the file was modified since.
+    */
+    std::string lastModified = ToHttpDate(modified);
+    uint64_t first = 0, last = fileSize ? fileSize - 1 : 0;
+    bool partial = false;
+    std::string range(m_request[beast::http::field::range]);
+    std::string ifRange(m_request[beast::http::field::if_range]);
+    boost::smatch matches;
+    if (!range.empty() && (ifRange.empty() || ifRange == lastModified) && boost::regex_match(range, matches, boost::regex(R"(bytes=(\d{0,19})-(\d{0,19}))"))) {
+        try {
+            if (matches.length(1)) {
+                first = std::stoull(matches.str(1));
+                last = matches.length(2) ? std::min<uint64_t>(std::stoull(matches.str(2)), last) : last;
+                partial = true;
+            }
+            else if (matches.length(2)) {
+                // Suffix range: the last N bytes
+                first = fileSize - std::min<uint64_t>(std::stoull(matches.str(2)), fileSize);
+                partial = true;
+            }
+        }
+        catch (const std::out_of_range&) {
+            partial = false;
+        }
+
+        if (partial && (first > last || first >= fileSize)) {
+            m_response.result(beast::http::status::range_not_satisfiable);
+            m_response.set(beast::http::field::content_range, fmt::format("bytes */{}", fileSize));
+            m_logger->error(m_logMessage("Range Not Satisfiable"));
+            return;
+        }
+    }
+
+    uint64_t length = fileSize ? last - first + 1 : 0;
+    m_response.result(partial ? beast::http::status::partial_content : beast::http::status::ok);
+    m_response.set(beast::http::field::content_type, GetContentType(path));
+    m_response.set(beast::http::field::accept_ranges, "bytes");
+    m_response.set(beast::http::field::last_modified, lastModified);
+    if (partial) {
+        m_response.set(beast::http::field::content_range, fmt::format("bytes {}-{}/{}", first, last, fileSize));
+    }
+
+#ifdef __linux__
+    // File is sent by kernel straight from page cache, it's never copied to user space
+    m_file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_file == -1) {
+        captureUnreadable(fmt::format("Couldn't open \"{}\" [errno: {}]", path.string(), errno), indentation);
+        return;
+    }
+    m_fileOffset = first;
+    m_fileRemaining = length;
+#else
+    std::ifstream file(path, std::ios::binary);
+    file.seekg(first);
+    auto buffer = m_response.body().prepare(length);
+    for (const auto& part : buffer) {
+        file.read(static_cast<char*>(part.data()), part.size());
+    }
+    if (!file) {
+        m_response.body().clear();
+        captureUnreadable(fmt::format("Couldn't read \"{}\"", path.string()), indentation);
+        return;
+    }
+    m_response.body().commit(length);
+#endif
+    m_logger->info(m_logMessage(partial ? "Partial Content" : "OK"));
+}
+
+void HttpServer::Connection::getPreviewStream(const std::string& query, int indentation) {
+    std::optional<std::string> camera = GetQueryValue(query, "camera");
+    m_viewfinder = m_captureMaster->viewfinder(camera.value_or(""));
+    if (!m_viewfinder) {
+        badRequest("Unknown camera", indentation);
+        return;
+    }
+
+    // Frames are sent as long as the client stays connected, the stream has no length
+    m_response.result(beast::http::status::ok);
+    m_response.set(beast::http::field::content_type, fmt::format("multipart/x-mixed-replace; boundary={}", PreviewBoundary));
+    m_response.set(beast::http::field::cache_control, "no-cache");
+    m_logger->info(m_logMessage(fmt::format("OK, streaming preview of camera \"{}\"", m_viewfinder->camera().name())));
+}
+
 void HttpServer::Connection::getDisplay(int indentation) {
     json displayObject;
     displayObject["enabled"] = static_cast<bool>(*m_displayUi);
@@ -366,6 +1131,15 @@ void HttpServer::Connection::produceResponse() {
         }
         return;
     }
+    else if (target.resource == "/api/external/history/chart.png") {
+        if (m_request.method() == beast::http::verb::get) {
+            getHistoryChart(Sensors::Location::External, target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
     else if (target.resource == "/api/internal") {
         if (m_request.method() == beast::http::verb::get) {
             getSensors(Sensors::Location::Internal, indentation);
@@ -393,6 +1167,78 @@ void HttpServer::Connection::produceResponse() {
         }
         return;
     }
+    else if (target.resource == "/api/internal/history/chart.png") {
+        if (m_request.method() == beast::http::verb::get) {
+            getHistoryChart(Sensors::Location::Internal, target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource == "/api/captures") {
+        if (m_request.method() == beast::http::verb::get) {
+            getCaptures(target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource == "/api/scene/history") {
+        if (m_request.method() == beast::http::verb::get) {
+            getSceneHistory(target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource == "/api/capture/latest") {
+        if (m_request.method() == beast::http::verb::get) {
+            getLatestCapture(target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource.starts_with("/api/capture/")) {
+        if (m_request.method() == beast::http::verb::get) {
+            getCapture(target.resource, target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource.starts_with("/api/contact_sheet/")) {
+        if (m_request.method() == beast::http::verb::get) {
+            getContactSheet(target.resource, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource.starts_with(fmt::format("/{}/", Capture::LayoutConst::CaptureDirectory))) {
+        if (m_request.method() == beast::http::verb::get) {
+            getFile(target.resource, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
+    else if (target.resource == "/api/preview.mjpeg") {
+        if (m_request.method() == beast::http::verb::get) {
+            getPreviewStream(target.query, indentation);
+        }
+        else {
+            methodNotAllowed();
+        }
+        return;
+    }
     else if (target.resource == "/api/display") {
         if (m_request.method() == beast::http::verb::get) {
             getDisplay(indentation);
@@ -424,13 +1270,191 @@ void HttpServer::Connection::produceResponse() {
 
 void HttpServer::Connection::sendResponse() {
     auto self = shared_from_this();
+    if (m_image) {
+        m_imageResponse.version(m_request.version());
+        m_imageResponse.keep_alive(false);
+        m_imageResponse.content_length(m_image->size());
+        beast::http::async_write(m_socket, m_imageResponse, [self](beast::error_code error, std::size_t bytesTransferred) {
+            boost::ignore_unused(error, bytesTransferred);
+            self->finishResponse();
+        });
+        return;
+    }
+
+    if (m_file != -1) {
+        // Header is written by Beast, the body is sent by sendfile()
+        m_response.content_length(m_fileRemaining);
+        std::ostringstream stream;
+        stream << m_response.base();
+        m_fileHeader = stream.str();
+        asio::async_write(m_socket, asio::buffer(m_fileHeader), [self](beast::error_code error, std::size_t bytesTransferred) {
+            boost::ignore_unused(bytesTransferred);
+            if (error) {
+                self->finishResponse();
+                return;
+            }
+            self->sendFile();
+        });
+        return;
+    }
+
+    if (m_viewfinder) {
+        std::ostringstream stream;
+        stream << m_response.base();
+        m_previewHeader = stream.str();
+        asio::async_write(m_socket, asio::buffer(m_previewHeader), [self](beast::error_code error, std::size_t bytesTransferred) {
+            boost::ignore_unused(bytesTransferred);
+            if (error) {
+                self->finishResponse();
+                return;
+            }
+
+            /*
+            *   The stream has no deadline: a paused viewfinder may have no frame to send for a while.
+            *   Only writes of frames are timed, so a viewer that stops reading is still dropped.
+            */
+            self->m_timeout.cancel();
+
+            // Viewfinder thread hands frames over to the connection's executor, it never keeps the connection alive
+            std::weak_ptr<Connection> connection = self;
+            self->m_previewSubscription = self->m_viewfinder->subscribe([connection](Jpeg::SharedBuffer frame) {
+                if (std::shared_ptr<Connection> self = connection.lock()) {
+                    asio::post(self->m_socket.get_executor(), [self, frame]() {
+                        self->sendPreviewFrame(frame);
+                    });
+                }
+            });
+
+            // Client isn't expected to send anything, the read completes when it disconnects
+            self->m_socket.async_read_some(self->m_buffer.prepare(1), [self](beast::error_code error, std::size_t bytesTransferred) {
+                boost::ignore_unused(error, bytesTransferred);
+                self->stopPreview();
+            });
+        });
+        return;
+    }
+
     m_response.content_length(m_response.body().size());
     beast::http::async_write(m_socket, m_response, [self](beast::error_code error, std::size_t bytesTransferred) {
-        self->m_socket.shutdown(asio::ip::tcp::socket::shutdown_send, error);
+        boost::ignore_unused(bytesTransferred);
+        if (error) {
+            // Client is gone or stopped reading, there is nothing left to send
+            self->m_socket.close(error);
+            self->m_timeout.cancel();
+            return;
+        }
+        self->finishResponse();
+    });
+}
+
+void HttpServer::Connection::sendFile() {
+#ifdef __linux__
+    beast::error_code error;
+    m_socket.native_non_blocking(true, error);
+    while (m_fileRemaining && !error) {
+        off_t offset = static_cast<off_t>(m_fileOffset);
+        ssize_t sent = sendfile(m_socket.native_handle(), m_file, &offset, std::min<uint64_t>(m_fileRemaining, SendfileChunkSize));
+        if (sent > 0) {
+            m_fileOffset += sent;
+            m_fileRemaining -= sent;
+            continue;
+        }
+
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Socket buffer is full: wait until it drains, the connection is alive as long as the client reads
+            auto self = shared_from_this();
+            m_timeout.expires_after(Timeout);
+            m_timeout.async_wait([self](beast::error_code error) {
+                if (!error) {
+                    self->m_socket.close(error);
+                }
+            });
+            m_socket.async_wait(asio::ip::tcp::socket::wait_write, [self](beast::error_code error) {
+                if (error) {
+                    self->finishResponse();
+                    return;
+                }
+                self->sendFile();
+            });
+            return;
+        }
+
+        // Client is gone or file was truncated meanwhile
+        m_logger->error(m_logMessage(fmt::format("File was not sent completely [errno: {}]", sent == -1 ? errno : 0)));
+        break;
+    }
+#endif
+    finishResponse();
+}
+
+void HttpServer::Connection::sendPreviewFrame(Jpeg::SharedBuffer frame) {
+    if (!m_previewSubscription) {
+        return;
+    }
+
+    m_nextPreviewFrame = std::move(frame);
+    if (!m_previewWriting) {
+        writePreviewFrame();
+    }
+}
+
+void HttpServer::Connection::writePreviewFrame() {
+    auto self = shared_from_this();
+    m_previewFrame = std::move(m_nextPreviewFrame);
+    m_previewWriting = true;
+    m_previewHeader = fmt::format(
+        "--{}\r\nContent-Type: image/jpeg\r\nContent-Length: {}\r\n\r\n",
+        PreviewBoundary,
+        m_previewFrame->size()
+    );
+
+    m_timeout.expires_after(Timeout);
+    m_timeout.async_wait([self](beast::error_code error) {
+        if (!error) {
+            self->m_socket.close(error);
+        }
+    });
+
+    // Frame is shared by all viewers, it's sent without copying
+    std::array<asio::const_buffer, 3> buffers = {
+        asio::buffer(m_previewHeader),
+        asio::buffer(m_previewFrame->data(), m_previewFrame->size()),
+        asio::buffer("\r\n", 2)
+    };
+    asio::async_write(m_socket, buffers, [self](beast::error_code error, std::size_t bytesTransferred) {
+        boost::ignore_unused(bytesTransferred);
         self->m_timeout.cancel();
+        self->m_previewWriting = false;
+        self->m_previewFrame.reset();
+        if (error) {
+            self->stopPreview();
+            return;
+        }
+
+        if (self->m_nextPreviewFrame) {
+            self->writePreviewFrame();
+        }
     });
 }
 
+void HttpServer::Connection::stopPreview() {
+    if (!m_previewSubscription) {
+        return;
+    }
+
+    m_previewSubscription.reset();
+    m_nextPreviewFrame.reset();
+    // Socket may be closed already, so the client isn't a part of the message
+    m_logger->info("Preview stream of camera \"{}\" is closed", m_viewfinder->camera().name());
+    finishResponse();
+}
+
+void HttpServer::Connection::finishResponse() {
+    beast::error_code error;
+    m_socket.shutdown(asio::ip::tcp::socket::shutdown_send, error);
+    m_timeout.cancel();
+}
+
 void HttpServer::Connection::handleRequest() {
     auto self = shared_from_this();
     beast::http::async_read(m_socket, m_buffer, m_request, [self](beast::error_code error, std::size_t bytesTransferred) {
@@ -440,7 +1464,9 @@ void HttpServer::Connection::handleRequest() {
         }
 
         self->produceResponse();
-        self->sendResponse();
+        if (!self->m_deferred) {
+            self->sendResponse();
+        }
     });
 }
 
@@ -451,7 +1477,7 @@ void HttpServer::startAccepting() {
             return;
         }
 
-        std::make_shared<Connection>(m_logger, m_displayUi, m_captureMaster, m_socket)->handleRequest();
+        std::make_shared<Connection>(m_logger, m_displayUi, m_captureMaster, m_imageCache, m_charts, m_workers, m_socket)->handleRequest();
         startAccepting();
     });
 }
@@ -460,6 +1486,9 @@ HttpServer::HttpServer(Display::Ui::Pointer displayUi, Capture::Master::Pointer
     : m_logger(std::make_shared<spdlog::logger>(Utility::CreateLogger("http_server")))
     , m_displayUi(displayUi)
     , m_captureMaster(captureMaster)
+    , m_imageCache(std::make_shared<ImageCache>(fmt::format("{}/{}", Capture::LayoutConst::CaptureDirectory, ImageCacheDirectory)))
+    , m_charts(std::make_shared<Sensors::Charts>())
+    , m_workers(WorkerThreads)
     , m_context(1)
     , m_acceptor(m_context, { asio::ip::make_address("0.0.0.0"), Config::Instance->httpPort() })
     , m_socket(m_context)
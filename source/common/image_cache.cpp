@@ -0,0 +1,201 @@
+#include "common/image_cache.hpp"
+using namespace cp::ImageCacheConst;
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "common/file_writer.hpp"
+#include "common/utility.hpp"
+
+namespace cp {
+
+ImageCache::ImageCache(const std::string& directory)
+    : m_logger(Utility::CreateLogger("image_cache"))
+    , m_directory(directory) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    // Cache directory is created on first store, capture thread may still be creating its parent
+    if (!fs::is_directory(m_directory, error)) {
+        return;
+    }
+
+    struct File {
+        fs::path path;
+        fs::file_time_type time;
+        size_t size;
+    };
+    std::vector<File> files;
+    for (const fs::directory_entry& entry : fs::directory_iterator(m_directory)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        if (entry.path().extension() != fmt::format(".{}", CacheExtension)) {
+            fs::remove(entry.path(), error);
+            continue;
+        }
+        files.push_back({ entry.path(), entry.last_write_time(), static_cast<size_t>(entry.file_size()) });
+    }
+
+    // Modification time of cached files is their last use
+    std::sort(files.begin(), files.end(), [](const File& left, const File& right) {
+        return left.time > right.time;
+    });
+    for (const File& file : files) {
+        if (m_disk.size + file.size > DiskLimit) {
+            fs::remove(file.path, error);
+            continue;
+        }
+
+        std::string key = file.path.stem().string();
+        m_disk.items.emplace_back(key, file.size);
+        m_disk.positions[key] = std::prev(m_disk.items.end());
+        m_disk.size += file.size;
+    }
+
+    if (!m_disk.items.empty()) {
+        m_logger.info("Disk cache holds {} image{}, {}", m_disk.items.size(), m_disk.items.size() == 1 ? "" : "s", Utility::ToReadableSize(m_disk.size));
+    }
+}
+
+std::string ImageCache::path(const std::string& key) const {
+    return fmt::format("{}/{}.{}", m_directory, key, CacheExtension);
+}
+
+Jpeg::SharedBuffer ImageCache::readDisk(const std::string& key) {
+    std::ifstream file(path(key), std::ios::binary | std::ios::ate);
+    if (!file) {
+        return {};
+    }
+
+    Jpeg::Buffer data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+        return {};
+    }
+
+    std::error_code error;
+    std::filesystem::last_write_time(path(key), std::filesystem::file_time_type::clock::now(), error);
+    return std::make_shared<const Jpeg::Buffer>(std::move(data));
+}
+
+bool ImageCache::writeDisk(const std::string& key, const Jpeg::Buffer& image) {
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    if (error) {
+        m_logger.error("Couldn't create cache directory \"{}\": {}", m_directory, error.message());
+        return false;
+    }
+
+    // Cache is not flushed to storage: the whole cache is disposable
+    std::string temporaryPath = path(key) + FileWriterConst::TemporarySuffix;
+    std::ofstream file(temporaryPath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(image.data()), image.size());
+    file.close();
+
+    if (file) {
+        std::filesystem::rename(temporaryPath, path(key), error);
+    }
+    if (!file || error) {
+        std::filesystem::remove(temporaryPath, error);
+        m_logger.error("Couldn't write cached image \"{}\"", path(key));
+        return false;
+    }
+    return true;
+}
+
+void ImageCache::remember(const std::string& key, const Jpeg::SharedBuffer& image, bool onDisk) {
+    if (m_memory.positions.count(key) == 0 && image->size() <= MemoryLimit) {
+        m_memory.items.emplace_front(key, image);
+        m_memory.positions[key] = m_memory.items.begin();
+        m_memory.size += image->size();
+        while (m_memory.size > MemoryLimit) {
+            m_memory.size -= m_memory.items.back().second->size();
+            m_memory.positions.erase(m_memory.items.back().first);
+            m_memory.items.pop_back();
+        }
+    }
+
+    if (!onDisk) {
+        return;
+    }
+
+    auto position = m_disk.positions.find(key);
+    if (position != m_disk.positions.end()) {
+        m_disk.items.splice(m_disk.items.begin(), m_disk.items, position->second);
+        return;
+    }
+
+    m_disk.items.emplace_front(key, image->size());
+    m_disk.positions[key] = m_disk.items.begin();
+    m_disk.size += image->size();
+    while (m_disk.size > DiskLimit && m_disk.items.size() > 1) {
+        std::error_code error;
+        std::filesystem::remove(path(m_disk.items.back().first), error);
+        m_disk.size -= m_disk.items.back().second;
+        m_disk.positions.erase(m_disk.items.back().first);
+        m_disk.items.pop_back();
+    }
+}
+
+void ImageCache::get(const std::string& key, const Generator& generator, Callback callback) {
+    bool onDisk = false;
+    {
+        std::unique_lock lock(m_mutex);
+        auto position = m_memory.positions.find(key);
+        if (position != m_memory.positions.end()) {
+            m_memory.items.splice(m_memory.items.begin(), m_memory.items, position->second);
+            Jpeg::SharedBuffer image = position->second->second;
+            lock.unlock();
+            callback(image, {});
+            return;
+        }
+
+        auto pending = m_pending.find(key);
+        if (pending != m_pending.end()) {
+            pending->second.push_back(std::move(callback));
+            return;
+        }
+
+        m_pending[key].push_back(std::move(callback));
+        onDisk = (m_disk.positions.count(key) != 0);
+    }
+
+    Jpeg::SharedBuffer image;
+    std::string error;
+    try {
+        image = onDisk ? readDisk(key) : nullptr;
+        if (!image) {
+            image = std::make_shared<const Jpeg::Buffer>(generator());
+            onDisk = writeDisk(key, *image);
+        }
+    }
+    catch (const std::exception& exception) {
+        image = nullptr;
+        error = exception.what();
+    }
+    catch (...) {
+        image = nullptr;
+        error = "Unknown error";
+    }
+
+    std::vector<Callback> callbacks;
+    {
+        std::lock_guard lock(m_mutex);
+        if (image) {
+            remember(key, image, onDisk);
+        }
+        callbacks = std::move(m_pending[key]);
+        m_pending.erase(key);
+    }
+
+    for (const Callback& pendingCallback : callbacks) {
+        pendingCallback(image, error);
+    }
+}
+
+} // namespace cp
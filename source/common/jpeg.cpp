@@ -0,0 +1,302 @@
+#include "common/jpeg.hpp"
+using namespace cp::JpegConst;
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <jpeglib.h>
+
+#include <fmt/format.h>
+
+namespace cp {
+
+/*
+*   libjpeg reports errors by calling error_exit() which must not return.
+*   It jumps back to the function that started the operation, where the error is thrown as usual.
+*/
+struct ErrorManager {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+static void ErrorExit(j_common_ptr info) {
+    ErrorManager* error = reinterpret_cast<ErrorManager*>(info->err);
+    info->err->format_message(info, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+static void OutputMessage(j_common_ptr) {
+    // Warnings are ignored, just like CImg does
+}
+
+/*
+*   Destination manager writing straight into a growing buffer:
+*   the encoded image is never copied and no temporary file is used.
+*/
+struct BufferDestination {
+    jpeg_destination_mgr manager;
+    Jpeg::Buffer* buffer;
+};
+
+static void InitDestination(j_compress_ptr info) {
+    BufferDestination* destination = reinterpret_cast<BufferDestination*>(info->dest);
+    destination->buffer->resize(destination->buffer->capacity());
+    destination->manager.next_output_byte = destination->buffer->data();
+    destination->manager.free_in_buffer = destination->buffer->size();
+}
+
+static boolean EmptyOutputBuffer(j_compress_ptr info) {
+    BufferDestination* destination = reinterpret_cast<BufferDestination*>(info->dest);
+    size_t used = destination->buffer->size();
+    destination->buffer->resize(used * 2);
+    destination->manager.next_output_byte = destination->buffer->data() + used;
+    destination->manager.free_in_buffer = destination->buffer->size() - used;
+    return TRUE;
+}
+
+static void TermDestination(j_compress_ptr info) {
+    BufferDestination* destination = reinterpret_cast<BufferDestination*>(info->dest);
+    destination->buffer->resize(destination->buffer->size() - destination->manager.free_in_buffer);
+}
+
+Jpeg::Buffer Jpeg::Encode(const Image& image, int quality) {
+    return Encode(image, FullRegion(image), quality);
+}
+
+Jpeg::Buffer Jpeg::Encode(const Image& image, const Region& region, int quality) {
+    if (image.is_empty() || (image.spectrum() != 1 && image.spectrum() != 3)) {
+        throw std::runtime_error(fmt::format(
+            "cp::Jpeg::Encode(): "
+            "Image of {}x{} with {} channel(s) can't be encoded",
+            image.width(), image.height(), image.spectrum()
+        ));
+    }
+    if (!Contains(image, region)) {
+        throw std::invalid_argument(fmt::format(
+            "cp::Jpeg::Encode(): "
+            "Region {}x{}+{}+{} doesn't lie within image of {}x{}",
+            region.width, region.height, region.x, region.y, image.width(), image.height()
+        ));
+    }
+
+    // A tenth of raw size is a good first guess for a photo, the buffer grows if it's not enough
+    Buffer buffer;
+    buffer.reserve(std::max<size_t>(static_cast<size_t>(region.width) * region.height * image.spectrum() / 10, 64 * 1024));
+    std::vector<uint8_t> row(static_cast<size_t>(region.width) * image.spectrum());
+
+    jpeg_compress_struct info;
+    ErrorManager error;
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = ErrorExit;
+    error.manager.output_message = OutputMessage;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&info);
+        throw std::runtime_error(fmt::format(
+            "cp::Jpeg::Encode(): "
+            "Couldn't encode image: {}",
+            error.message
+        ));
+    }
+    jpeg_create_compress(&info);
+
+    BufferDestination destination;
+    destination.manager.init_destination = InitDestination;
+    destination.manager.empty_output_buffer = EmptyOutputBuffer;
+    destination.manager.term_destination = TermDestination;
+    destination.buffer = &buffer;
+    info.dest = &destination.manager;
+
+    info.image_width = region.width;
+    info.image_height = region.height;
+    info.input_components = image.spectrum();
+    info.in_color_space = (image.spectrum() == 3 ? JCS_RGB : JCS_GRAYSCALE);
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, quality, TRUE);
+    jpeg_start_compress(&info, TRUE);
+
+    // CImg images are planar, libjpeg wants interleaved scanlines: rows of the region are interleaved one by one
+    const size_t planeSize = static_cast<size_t>(image.width()) * image.height();
+    while (info.next_scanline < info.image_height) {
+        const uint8_t* source = image.data(region.x, region.y + info.next_scanline);
+        if (image.spectrum() == 3) {
+            for (int x = 0; x < region.width; ++x) {
+                row[x * 3 + 0] = source[x];
+                row[x * 3 + 1] = source[x + planeSize];
+                row[x * 3 + 2] = source[x + planeSize * 2];
+            }
+        }
+        else {
+            std::copy(source, source + region.width, row.begin());
+        }
+
+        JSAMPROW rowPointer = row.data();
+        jpeg_write_scanlines(&info, &rowPointer, 1);
+    }
+
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+    return buffer;
+}
+
+// Scale is chosen after reading the header when minimum width is given
+static Image DecodeScaled(const uint8_t* data, size_t size, int scale, int minWidth) {
+    Image image;
+    std::vector<uint8_t> row;
+
+    jpeg_decompress_struct info;
+    ErrorManager error;
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = ErrorExit;
+    error.manager.output_message = OutputMessage;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        throw std::runtime_error(fmt::format(
+            "cp::Jpeg::Decode(): "
+            "Couldn't decode image: {}",
+            error.message
+        ));
+    }
+    jpeg_create_decompress(&info);
+
+    jpeg_mem_src(&info, data, static_cast<unsigned long>(size));
+    jpeg_read_header(&info, TRUE);
+    if (minWidth > 0) {
+        // libjpeg rounds scaled size up
+        scale = 8;
+        while (scale > 1 && (info.image_width + scale - 1) / scale < static_cast<JDIMENSION>(minWidth)) {
+            scale /= 2;
+        }
+    }
+    info.out_color_space = JCS_RGB;
+    info.scale_num = 1;
+    info.scale_denom = scale;
+    jpeg_start_decompress(&info);
+
+    image.assign(info.output_width, info.output_height, 1, 3);
+    row.resize(static_cast<size_t>(info.output_width) * 3);
+    const size_t planeSize = static_cast<size_t>(image.width()) * image.height();
+    while (info.output_scanline < info.output_height) {
+        uint8_t* destination = image.data(0, info.output_scanline);
+        JSAMPROW rowPointer = row.data();
+        jpeg_read_scanlines(&info, &rowPointer, 1);
+        for (int x = 0; x < image.width(); ++x) {
+            destination[x] = row[x * 3 + 0];
+            destination[x + planeSize] = row[x * 3 + 1];
+            destination[x + planeSize * 2] = row[x * 3 + 2];
+        }
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return image;
+}
+
+Jpeg::Dimensions Jpeg::ReadDimensions(const uint8_t* data, size_t size) {
+    jpeg_decompress_struct info;
+    ErrorManager error;
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = ErrorExit;
+    error.manager.output_message = OutputMessage;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        throw std::runtime_error(fmt::format(
+            "cp::Jpeg::ReadDimensions(): "
+            "Couldn't read image header: {}",
+            error.message
+        ));
+    }
+    jpeg_create_decompress(&info);
+
+    jpeg_mem_src(&info, data, static_cast<unsigned long>(size));
+    jpeg_read_header(&info, TRUE);
+    Dimensions dimensions = { static_cast<int>(info.image_width), static_cast<int>(info.image_height) };
+    jpeg_destroy_decompress(&info);
+    return dimensions;
+}
+
+Image Jpeg::Decode(const uint8_t* data, size_t size, int scale) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        throw std::invalid_argument(fmt::format(
+            "cp::Jpeg::Decode(): "
+            "Scale {} is not supported (available: 1, 2, 4, 8)",
+            scale
+        ));
+    }
+    return DecodeScaled(data, size, scale, 0);
+}
+
+Image Jpeg::DecodeToWidth(const uint8_t* data, size_t size, int width) {
+    return DecodeScaled(data, size, 1, width);
+}
+
+// JPEG markers
+static constexpr uint8_t MarkerPrefix = 0xFF;
+static constexpr uint8_t StartOfImage = 0xD8;
+static constexpr uint8_t StartOfScan = 0xDA;
+static constexpr uint8_t App0 = 0xE0;
+static constexpr uint8_t App1 = 0xE1;
+
+static bool IsXmpSegment(const uint8_t* segment, size_t length) {
+    return segment[1] == App1 && length >= sizeof(XmpSignature) + 2 && std::memcmp(segment + 4, XmpSignature, sizeof(XmpSignature)) == 0;
+}
+
+Jpeg::Buffer Jpeg::InsertXmp(const uint8_t* data, size_t size, const std::string& packet) {
+    size_t length = 2 + sizeof(XmpSignature) + packet.size();
+    if (length > MaxSegmentLength) {
+        throw std::runtime_error(fmt::format("cp::Jpeg::InsertXmp(): XMP packet is too large [size: {}]", packet.size()));
+    }
+    if (size < 4 || data[0] != MarkerPrefix || data[1] != StartOfImage) {
+        throw std::runtime_error("cp::Jpeg::InsertXmp(): Data is not JPEG");
+    }
+
+    // Packet goes right after JFIF and EXIF segments, which have to come first. Previous packet is replaced
+    size_t position = 2, replaced = 0;
+    while (position + 4 <= size && data[position] == MarkerPrefix && (data[position + 1] == App0 || data[position + 1] == App1)) {
+        size_t segmentLength = (static_cast<size_t>(data[position + 2]) << 8) | data[position + 3];
+        if (segmentLength < 2 || position + 2 + segmentLength > size) {
+            throw std::runtime_error("cp::Jpeg::InsertXmp(): JPEG header is corrupted");
+        }
+        if (IsXmpSegment(data + position, segmentLength)) {
+            replaced = 2 + segmentLength;
+            break;
+        }
+        position += 2 + segmentLength;
+    }
+
+    Buffer result;
+    result.reserve(size - replaced + 2 + length);
+    result.insert(result.end(), data, data + position);
+    result.insert(result.end(), { MarkerPrefix, App1, static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length & 0xFF) });
+    result.insert(result.end(), XmpSignature, XmpSignature + sizeof(XmpSignature));
+    result.insert(result.end(), packet.begin(), packet.end());
+    result.insert(result.end(), data + position + replaced, data + size);
+    return result;
+}
+
+std::optional<std::string> Jpeg::ReadXmp(const uint8_t* data, size_t size) {
+    if (size < 4 || data[0] != MarkerPrefix || data[1] != StartOfImage) {
+        return {};
+    }
+
+    // Only the header segments are walked, the scan is never read
+    size_t position = 2;
+    while (position + 4 <= size && data[position] == MarkerPrefix && data[position + 1] != StartOfScan) {
+        size_t length = (static_cast<size_t>(data[position + 2]) << 8) | data[position + 3];
+        if (length < 2 || position + 2 + length > size) {
+            return {};
+        }
+
+        if (IsXmpSegment(data + position, length)) {
+            const char* payload = reinterpret_cast<const char*>(data + position + 4);
+            return std::string(payload + sizeof(XmpSignature), payload + length - 2);
+        }
+        position += 2 + length;
+    }
+    return {};
+}
+
+} // namespace cp
@@ -0,0 +1,265 @@
+#include "common/libcamera_camera.hpp"
+using namespace cp::CameraConst;
+
+#include <stdexcept>
+
+#ifdef __unix__
+    #include <sys/mman.h>
+#endif
+
+#include <fmt/format.h>
+
+namespace cp {
+
+#ifdef __unix__
+static std::shared_ptr<lc::CameraManager> AcquireManager() {
+    static std::mutex mutex;
+    static std::weak_ptr<lc::CameraManager> shared;
+
+    std::lock_guard lock(mutex);
+    std::shared_ptr<lc::CameraManager> manager = shared.lock();
+    if (!manager) {
+        manager = std::make_shared<lc::CameraManager>();
+        int result = manager->start();
+        if (result < 0) {
+            throw std::runtime_error(fmt::format("cp::AcquireManager(): Couldn't start camera manager [result: {}]", result));
+        }
+        shared = manager;
+    }
+    return manager;
+}
+#endif
+
+LibcameraCamera::LibcameraCamera(const std::string& name, const std::string& id)
+    : Camera(name)
+    , m_id(id) {
+#ifdef __unix__
+    lc::logSetLevel("RPI", "ERROR");
+    lc::logSetLevel("RPiSdn", "ERROR");
+    lc::logSetLevel("Camera", "ERROR");
+#endif
+}
+
+LibcameraCamera::~LibcameraCamera() {
+    turnOff();
+}
+
+#ifdef __unix__
+void LibcameraCamera::requestCompleted(lc::Request* request) {
+    if (request->status() == lc::Request::RequestCancelled) {
+        m_cv.notify_all();
+        return;
+    }
+
+    const lc::FrameBuffer::Plane& plane = request->buffers().begin()->second->planes().at(0);
+    void* buffer = mmap(nullptr, plane.length, PROT_READ, MAP_SHARED, plane.fd.get(), 0);
+    if (buffer == MAP_FAILED) {
+        m_logger.error("Image capture failed: Couldn't map data buffer [errno: {}]", errno);
+        return;
+    }
+
+    const lc::StreamConfiguration& streamConfig = request->buffers().begin()->first->configuration();
+    unsigned int calculatedWidth = plane.length / 3 / streamConfig.size.height;
+    m_image->assign(reinterpret_cast<uint8_t*>(buffer), 3, calculatedWidth, streamConfig.size.height, 1);
+    m_image->permute_axes("yzcx");
+    if (streamConfig.size.width != calculatedWidth) {
+        m_image->crop(0, streamConfig.size.width - 1);
+    }
+
+    int result = munmap(buffer, plane.length);
+    if (result == -1) {
+        m_logger.error("Image capture failed: Couldn't unmap data buffer [errno: {}]", errno);
+        return;
+    }
+    m_cv.notify_all();
+}
+
+Camera::Image LibcameraCamera::request(std::unique_lock<std::mutex>& lock, lc::Stream* stream) {
+    std::unique_ptr<lc::Request> request = m_camera->createRequest();
+    if (!request) {
+        throw std::runtime_error("cp::LibcameraCamera::request(): Couldn't create capture request");
+    }
+
+    int result = request->addBuffer(stream, m_allocator->buffers(stream).at(0).get());
+    if (result < 0) {
+        throw std::runtime_error(fmt::format("cp::LibcameraCamera::request(): Couldn't add buffer to capture request [result: {}]", result));
+    }
+
+    Image image;
+    m_image = &image;
+
+    result = m_camera->queueRequest(request.get());
+    if (result < 0) {
+        m_image = nullptr;
+        throw std::runtime_error(fmt::format("cp::LibcameraCamera::request(): Couldn't queue capture request [result: {}]", result));
+    }
+
+    m_cv.wait(lock);
+    m_image = nullptr;
+    return image;
+}
+
+void LibcameraCamera::stop() {
+    m_streaming = false;
+    int result = m_camera->stop();
+    if (result < 0) {
+        throw std::runtime_error(fmt::format("cp::LibcameraCamera::stop(): Couldn't stop camera [result: {}]", result));
+    }
+}
+#endif
+
+void LibcameraCamera::turnOn() {
+    std::lock_guard lock(m_mutex);
+    if (m_on) {
+        return;
+    }
+
+#ifdef __unix__
+    std::shared_ptr<lc::CameraManager> manager = AcquireManager();
+    if (manager->cameras().empty()) {
+        throw std::runtime_error("cp::LibcameraCamera::turnOn(): No cameras detected");
+    }
+
+    std::shared_ptr<lc::Camera> camera;
+    if (m_id.empty()) {
+        if (manager->cameras().size() > 1) {
+            throw std::runtime_error("cp::LibcameraCamera::turnOn(): Multiple cameras detected (ambiguous), camera ID has to be configured");
+        }
+        camera = manager->cameras().at(0);
+    }
+    else {
+        camera = manager->get(m_id);
+        if (!camera) {
+            throw std::runtime_error(fmt::format("cp::LibcameraCamera::turnOn(): Camera \"{}\" is not detected", m_id));
+        }
+    }
+    int result = camera->acquire();
+    if (result < 0) {
+        throw std::runtime_error(fmt::format("cp::LibcameraCamera::turnOn(): Couldn't acquire camera [result: {}]", result));
+    }
+
+    std::unique_ptr<lc::CameraConfiguration> cameraConfig = camera->generateConfiguration({ lc::StreamRole::Raw, lc::StreamRole::Viewfinder });
+    if (!cameraConfig || cameraConfig->size() != 2) {
+        camera->release();
+        throw std::runtime_error("cp::LibcameraCamera::turnOn(): Couldn't generate camera configuration");
+    }
+
+    lc::StreamConfiguration& streamConfig = cameraConfig->at(0);
+    streamConfig.size.width = CaptureWidth;
+    streamConfig.size.height = CaptureHeight;
+    streamConfig.pixelFormat = lc::formats::BGR888;
+
+    lc::StreamConfiguration& previewConfig = cameraConfig->at(1);
+    previewConfig.size.width = PreviewWidth;
+    previewConfig.size.height = PreviewHeight;
+    previewConfig.pixelFormat = lc::formats::BGR888;
+    if (cameraConfig->validate() == lc::CameraConfiguration::Status::Invalid) {
+        camera->release();
+        throw std::runtime_error(fmt::format(
+            "cp::LibcameraCamera::turnOn(): Couldn't validate stream config \"{}\", \"{}\"",
+            streamConfig.toString(),
+            previewConfig.toString()
+        ));
+    }
+
+    result = camera->configure(cameraConfig.get());
+    if (result < 0) {
+        camera->release();
+        throw std::runtime_error(fmt::format("cp::LibcameraCamera::turnOn(): Couldn't configure camera [result: {}]", result));
+    }
+
+    std::unique_ptr<lc::FrameBufferAllocator> allocator = std::make_unique<lc::FrameBufferAllocator>(camera);
+    for (const lc::StreamConfiguration& config : *cameraConfig) {
+        result = allocator->allocate(config.stream());
+        if (result < 0) {
+            allocator.reset();
+            camera->release();
+            throw std::runtime_error(fmt::format("cp::LibcameraCamera::turnOn(): Couldn't allocate frame buffer [result: {}]", result));
+        }
+    }
+
+    // Camera object is kept by the shared manager and outlives this turn, the slot is disconnected when it's turned off
+    camera->requestCompleted.connect(this, &LibcameraCamera::requestCompleted);
+    m_manager = std::move(manager);
+    m_camera = std::move(camera);
+    m_cameraConfig = std::move(cameraConfig);
+    m_allocator = std::move(allocator);
+#endif
+    m_on = true;
+}
+
+void LibcameraCamera::turnOff() {
+    std::lock_guard lock(m_mutex);
+    if (!m_on) {
+        return;
+    }
+
+#ifdef __unix__
+    if (m_streaming) {
+        try {
+            stop();
+        }
+        catch (const std::runtime_error& error) {
+            m_logger.error("Couldn't stop viewfinder stream: \"{}\"", error.what());
+        }
+    }
+    for (const lc::StreamConfiguration& config : *m_cameraConfig) {
+        m_allocator->free(config.stream());
+    }
+    m_allocator.reset();
+    m_cameraConfig.reset();
+    m_camera->requestCompleted.disconnect(this);
+    m_camera->release();
+    m_camera.reset();
+    m_manager.reset();
+#endif
+    m_on = false;
+}
+
+Camera::Image LibcameraCamera::capture() {
+    std::unique_lock lock(m_mutex);
+    if (!m_on) {
+        throw std::invalid_argument("cp::LibcameraCamera::capture(): Camera is not on");
+    }
+
+#ifdef __unix__
+    // Viewfinder stream is restarted, so the still frame isn't exposed with the viewfinder's controls
+    if (m_streaming) {
+        stop();
+    }
+
+    int result = m_camera->start();
+    if (result < 0) {
+        throw std::runtime_error(fmt::format("cp::LibcameraCamera::capture(): Couldn't start camera [result: {}]", result));
+    }
+
+    m_streaming = true;
+    Image image = request(lock, m_cameraConfig->at(0).stream());
+    stop();
+    return image;
+#else
+    return Image(CaptureWidth, CaptureHeight, 1, 3);
+#endif
+}
+
+Camera::Image LibcameraCamera::preview() {
+    std::unique_lock lock(m_mutex);
+    if (!m_on) {
+        throw std::invalid_argument("cp::LibcameraCamera::preview(): Camera is not on");
+    }
+
+#ifdef __unix__
+    if (!m_streaming) {
+        int result = m_camera->start();
+        if (result < 0) {
+            throw std::runtime_error(fmt::format("cp::LibcameraCamera::preview(): Couldn't start camera [result: {}]", result));
+        }
+        m_streaming = true;
+    }
+    return request(lock, m_cameraConfig->at(1).stream());
+#else
+    return Image(PreviewWidth, PreviewHeight, 1, 3);
+#endif
+}
+
+} // namespace cp
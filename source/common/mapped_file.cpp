@@ -0,0 +1,127 @@
+#include "common/mapped_file.hpp"
+
+#include <stdexcept>
+
+#ifdef __unix__
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#else
+    #include <filesystem>
+    #include <fstream>
+#endif
+
+#include <fmt/format.h>
+
+namespace cp {
+
+MappedFile::MappedFile(const std::string& path, bool writable)
+    : m_path(path)
+    , m_writable(writable) {
+#ifdef __unix__
+    m_fd = open(m_path.c_str(), m_writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (m_fd == -1) {
+        throw std::runtime_error(fmt::format(
+            "cp::MappedFile::MappedFile(): Couldn't open file \"{}\" [errno: {}]",
+            m_path, errno
+        ));
+    }
+
+    struct stat fileStat = {};
+    if (fstat(m_fd, &fileStat) == -1) {
+        close(m_fd);
+        throw std::runtime_error(fmt::format(
+            "cp::MappedFile::MappedFile(): Couldn't stat file \"{}\" [errno: {}]",
+            m_path, errno
+        ));
+    }
+    m_size = static_cast<size_t>(fileStat.st_size);
+#else
+    if (std::filesystem::exists(m_path)) {
+        std::ifstream file(m_path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error(fmt::format("cp::MappedFile::MappedFile(): Couldn't open file \"{}\"", m_path));
+        }
+        m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else if (!m_writable) {
+        throw std::runtime_error(fmt::format("cp::MappedFile::MappedFile(): File \"{}\" doesn't exist", m_path));
+    }
+    m_size = m_buffer.size();
+#endif
+    map();
+}
+
+MappedFile::~MappedFile() {
+    flush();
+    unmap();
+#ifdef __unix__
+    close(m_fd);
+#endif
+}
+
+void MappedFile::map() {
+#ifdef __unix__
+    if (m_size == 0) {
+        m_data = nullptr;
+        return;
+    }
+
+    void* data = mmap(nullptr, m_size, m_writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error(fmt::format(
+            "cp::MappedFile::map(): Couldn't map file \"{}\" [errno: {}]",
+            m_path, errno
+        ));
+    }
+    m_data = static_cast<uint8_t*>(data);
+#else
+    m_data = m_buffer.data();
+#endif
+}
+
+void MappedFile::unmap() {
+#ifdef __unix__
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+#endif
+    m_data = nullptr;
+}
+
+void MappedFile::resize(size_t size) {
+    if (!m_writable) {
+        throw std::runtime_error(fmt::format("cp::MappedFile::resize(): File \"{}\" is mapped read-only", m_path));
+    }
+
+    unmap();
+#ifdef __unix__
+    if (ftruncate(m_fd, static_cast<off_t>(size)) == -1) {
+        throw std::runtime_error(fmt::format(
+            "cp::MappedFile::resize(): Couldn't resize file \"{}\" [errno: {}]",
+            m_path, errno
+        ));
+    }
+#else
+    m_buffer.resize(size);
+#endif
+    m_size = size;
+    map();
+}
+
+void MappedFile::flush() {
+    if (!m_writable || !m_data) {
+        return;
+    }
+
+#ifdef __unix__
+    msync(m_data, m_size, MS_ASYNC);
+#else
+    std::ofstream file(m_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size());
+#endif
+}
+
+} // namespace cp
@@ -0,0 +1,220 @@
+#include "common/overlay.hpp"
+using namespace cp::OverlayConst;
+using namespace cp::CameraConst;
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+
+#include <boost/regex.hpp>
+
+#include <fmt/format.h>
+#include <fmt/xchar.h>
+
+#include "common/pyramid.hpp"
+#include "common/text.hpp"
+
+namespace cp {
+
+static char32_t TrendSymbol(double trend) {
+    if (trend > 1.0) {
+        return U'↑';
+    }
+    if (trend > 0.3) {
+        return U'⇡';
+    }
+    if (trend >= -0.3) {
+        return U'~';
+    }
+    if (trend >= -1.0) {
+        return U'⇣';
+    }
+    return U'↓';
+}
+
+static std::u32string CreateMeasurementString(const std::optional<Sensors::Measurement>& measurement, const std::optional<Sensors::Measurement>& trend) {
+    if (!measurement) {
+        return U"×××.×°C× ×××.×%× ××××.×hPa×";
+    }
+
+    if (!trend) {
+        return fmt::format(
+            U"{:>+5.1f}°C× {:>5.1f}%× {:>6.1f}hPa×",
+            measurement->bmp280.temperature,
+            measurement->aht20.humidity,
+            measurement->bmp280.pressure
+        );
+    }
+
+    return fmt::format(
+        U"{:>+5.1f}°C{} {:>5.1f}%{} {:>6.1f}hPa{}",
+        measurement->bmp280.temperature,
+        TrendSymbol(trend->bmp280.temperature),
+        measurement->aht20.humidity,
+        TrendSymbol(trend->aht20.humidity),
+        measurement->bmp280.pressure,
+        TrendSymbol(trend->bmp280.pressure)
+    );
+}
+
+static void DrawUi(Image& image, const Camera::UiInfo& info) {
+    image.draw_rectangle(0, image.height() - Ui::InfoBarHeight, image.width(), image.height(), Ui::BlackColor, 1.0);
+    image.draw_image(Ui::SideMargin, image.height() - Ui::InfoBarHeight + Ui::SmallTextOffset, Text::Render(U"External", Ui::SmallTextSize));
+    image.draw_image(Ui::SideMargin, image.height() - Ui::InfoBarHeight + Ui::BigTextOffset, Text::Render(CreateMeasurementString(info.record.external, info.trend.external), Ui::BigTextSize));
+
+    Image taskText = Text::Render(fmt::format(U"[{}] ", std::u32string(info.task.begin(), info.task.end())), Ui::BigTextSize);
+    Image timestampText = Text::Render(fmt::format(
+        U"{:#02d}.{:#02d}.{:#04d} {:#02d}:{:#02d}:{:#02d}",
+        static_cast<int>(info.record.timestamp.date().day()),
+        info.record.timestamp.date().month().as_number(),
+        static_cast<int>(info.record.timestamp.date().year()),
+        info.record.timestamp.time_of_day().hours(),
+        info.record.timestamp.time_of_day().minutes(),
+        info.record.timestamp.time_of_day().seconds()
+    ), Ui::BigTextSize);
+    int totalWidth = taskText.width() + timestampText.width();
+    image.draw_image(image.width() / 2 - totalWidth / 2, image.height() - Ui::InfoBarHeight + Ui::SmallTextOffset, Text::Render(U"Task", Ui::SmallTextSize));
+    image.draw_image(image.width() / 2 - totalWidth / 2, image.height() - Ui::InfoBarHeight + Ui::BigTextOffset, taskText);
+    Image text = Text::Render(U"Timestamp", Ui::SmallTextSize);
+    image.draw_image(image.width() / 2 + totalWidth / 2 - text.width(), image.height() - Ui::InfoBarHeight + Ui::SmallTextOffset, text);
+    image.draw_image(image.width() / 2 - totalWidth / 2 + taskText.width(), image.height() - Ui::InfoBarHeight + Ui::BigTextOffset, timestampText);
+
+    text = Text::Render(U"Internal", Ui::SmallTextSize);
+    image.draw_image(image.width() - Ui::SideMargin - text.width(), image.height() - Ui::InfoBarHeight + Ui::SmallTextOffset, text);
+    text = Text::Render(CreateMeasurementString(info.record.internal, info.trend.internal), Ui::BigTextSize);
+    image.draw_image(image.width() - Ui::SideMargin - text.width(), image.height() - Ui::InfoBarHeight + Ui::BigTextOffset, text);
+}
+
+static std::string EscapeXml(const std::string& string) {
+    std::string result;
+    for (char character : string) {
+        switch (character) {
+            case '&': result += "&amp;"; break;
+            case '<': result += "&lt;"; break;
+            case '>': result += "&gt;"; break;
+            case '"': result += "&quot;"; break;
+            default: result += character; break;
+        }
+    }
+    return result;
+}
+
+static std::string UnescapeXml(const std::string& string) {
+    return boost::regex_replace(string, boost::regex("&(amp|lt|gt|quot);"), [](const boost::smatch& match) {
+        const std::string entity = match.str(1);
+        return std::string(entity == "amp" ? "&" : entity == "lt" ? "<" : entity == "gt" ? ">" : "\"");
+    });
+}
+
+// Measurement properties are "<prefix><field>", e.g. "TrendExternalAht20Humidity"
+static void WriteMeasurement(std::string& properties, const std::string& prefix, const std::optional<Sensors::Measurement>& measurement) {
+    if (!measurement) {
+        return;
+    }
+    properties += fmt::format(
+        " cp:{0}Aht20Temperature=\"{1}\" cp:{0}Aht20Humidity=\"{2}\" cp:{0}Bmp280Temperature=\"{3}\" cp:{0}Bmp280Pressure=\"{4}\"",
+        prefix,
+        measurement->aht20.temperature,
+        measurement->aht20.humidity,
+        measurement->bmp280.temperature,
+        measurement->bmp280.pressure
+    );
+}
+
+static std::optional<Sensors::Measurement> ReadMeasurement(const std::map<std::string, std::string>& properties, const std::string& prefix) {
+    auto aht20Temperature = properties.find(prefix + "Aht20Temperature");
+    auto aht20Humidity = properties.find(prefix + "Aht20Humidity");
+    auto bmp280Temperature = properties.find(prefix + "Bmp280Temperature");
+    auto bmp280Pressure = properties.find(prefix + "Bmp280Pressure");
+    if (aht20Temperature == properties.end() || aht20Humidity == properties.end() || bmp280Temperature == properties.end() || bmp280Pressure == properties.end()) {
+        return {};
+    }
+
+    Sensors::Measurement measurement;
+    measurement.aht20.temperature = std::stod(aht20Temperature->second);
+    measurement.aht20.humidity = std::stod(aht20Humidity->second);
+    measurement.bmp280.temperature = std::stod(bmp280Temperature->second);
+    measurement.bmp280.pressure = std::stod(bmp280Pressure->second);
+    return measurement;
+}
+
+void Overlay::Draw(Image& image, const Camera::UiInfo& info) {
+    if (image.width() >= CaptureWidth) {
+        DrawUi(image, info);
+        return;
+    }
+
+    // Text is rendered at capture resolution and the bar is shrunk, so it looks the same at any size
+    Image bar(CaptureWidth, Ui::InfoBarHeight, 1, 3, 0);
+    DrawUi(bar, info);
+    int height = std::max(static_cast<int>(std::lround(static_cast<double>(Ui::InfoBarHeight) * image.width() / CaptureWidth)), 1);
+    image.draw_image(0, image.height() - height, Pyramid::Shrink(bar, image.width(), height));
+}
+
+std::string Overlay::ToXmp(const Camera::UiInfo& info) {
+    std::string properties = fmt::format(
+        " cp:Task=\"{}\" cp:Timestamp=\"{}\"",
+        EscapeXml(info.task),
+        pt::to_iso_extended_string(info.record.timestamp)
+    );
+    WriteMeasurement(properties, "External", info.record.external);
+    WriteMeasurement(properties, "Internal", info.record.internal);
+    WriteMeasurement(properties, "TrendExternal", info.trend.external);
+    WriteMeasurement(properties, "TrendInternal", info.trend.internal);
+
+    return fmt::format(
+        "<?xpacket begin=\"\xEF\xBB\xBF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>"
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">"
+        "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+        "<rdf:Description rdf:about=\"\" xmlns:cp=\"{}\"{}/>"
+        "</rdf:RDF>"
+        "</x:xmpmeta>"
+        "<?xpacket end=\"r\"?>",
+        XmpNamespace,
+        properties
+    );
+}
+
+std::optional<Camera::UiInfo> Overlay::FromXmp(const std::string& packet) {
+    if (packet.find(XmpNamespace) == std::string::npos) {
+        return {};
+    }
+
+    std::map<std::string, std::string> properties;
+    const boost::regex propertyRegex(R"regex(\bcp:(\w+)="([^"]*)")regex");
+    for (boost::sregex_iterator iterator(packet.begin(), packet.end(), propertyRegex), end; iterator != end; ++iterator) {
+        properties[iterator->str(1)] = UnescapeXml(iterator->str(2));
+    }
+
+    auto task = properties.find("Task");
+    auto timestamp = properties.find("Timestamp");
+    if (task == properties.end() || timestamp == properties.end()) {
+        return {};
+    }
+
+    try {
+        Camera::UiInfo info;
+        info.task = task->second;
+        info.record.timestamp = pt::from_iso_extended_string(timestamp->second);
+        info.record.external = ReadMeasurement(properties, "External");
+        info.record.internal = ReadMeasurement(properties, "Internal");
+        info.trend.external = ReadMeasurement(properties, "TrendExternal");
+        info.trend.internal = ReadMeasurement(properties, "TrendInternal");
+        return info;
+    }
+    catch (const std::exception&) {
+        // Malformed number or timestamp
+        return {};
+    }
+}
+
+std::optional<Camera::UiInfo> Overlay::Read(const Jpeg::Buffer& data) {
+    std::optional<std::string> packet = Jpeg::ReadXmp(data.data(), data.size());
+    if (!packet) {
+        return {};
+    }
+    return FromXmp(*packet);
+}
+
+} // namespace cp
@@ -0,0 +1,76 @@
+#include "common/png.hpp"
+using namespace cp::PngConst;
+
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include <zlib.h>
+
+namespace cp {
+
+static void PutBigEndian(Png::Buffer& buffer, uint32_t value) {
+    buffer.push_back(static_cast<uint8_t>(value >> 24));
+    buffer.push_back(static_cast<uint8_t>(value >> 16));
+    buffer.push_back(static_cast<uint8_t>(value >> 8));
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+// Chunk is its length, type, data and CRC of type and data
+static void PutChunk(Png::Buffer& buffer, const char (&type)[5], const uint8_t* data, size_t size) {
+    PutBigEndian(buffer, static_cast<uint32_t>(size));
+    size_t typePosition = buffer.size();
+    buffer.insert(buffer.end(), type, type + 4);
+    buffer.insert(buffer.end(), data, data + size);
+    PutBigEndian(buffer, static_cast<uint32_t>(crc32(0, buffer.data() + typePosition, static_cast<uInt>(size + 4))));
+}
+
+Png::Buffer Png::Encode(const Image& image) {
+    if (image.spectrum() != 1 && image.spectrum() != 3) {
+        throw std::invalid_argument(fmt::format(
+            "cp::Png::Encode(): "
+            "Image must be grayscale or RGB [spectrum: {}]",
+            image.spectrum()
+        ));
+    }
+
+    // Scanlines are interleaved, each is prefixed by filter type 0 (none)
+    size_t stride = static_cast<size_t>(image.width()) * image.spectrum() + 1;
+    std::vector<uint8_t> scanlines(stride * image.height());
+    for (int y = 0; y < image.height(); ++y) {
+        uint8_t* scanline = scanlines.data() + y * stride;
+        scanline[0] = 0;
+        for (int channel = 0; channel < image.spectrum(); ++channel) {
+            const uint8_t* input = image.data(0, y, 0, channel);
+            for (int x = 0; x < image.width(); ++x) {
+                scanline[1 + x * image.spectrum() + channel] = input[x];
+            }
+        }
+    }
+
+    uLongf compressedSize = compressBound(static_cast<uLong>(scanlines.size()));
+    std::vector<uint8_t> compressed(compressedSize);
+    if (compress2(compressed.data(), &compressedSize, scanlines.data(), static_cast<uLong>(scanlines.size()), CompressionLevel) != Z_OK) {
+        throw std::runtime_error(fmt::format(
+            "cp::Png::Encode(): "
+            "Couldn't compress image [size: {}x{}]",
+            image.width(), image.height()
+        ));
+    }
+
+    Buffer buffer = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<uint8_t> header;
+    PutBigEndian(header, static_cast<uint32_t>(image.width()));
+    PutBigEndian(header, static_cast<uint32_t>(image.height()));
+    header.push_back(8);                                    // Bit depth
+    header.push_back(image.spectrum() == 3 ? 2 : 0);        // Colour type: truecolour or greyscale
+    header.push_back(0);                                    // Compression method
+    header.push_back(0);                                    // Filter method
+    header.push_back(0);                                    // No interlace
+    PutChunk(buffer, "IHDR", header.data(), header.size());
+    PutChunk(buffer, "IDAT", compressed.data(), compressedSize);
+    PutChunk(buffer, "IEND", nullptr, 0);
+    return buffer;
+}
+
+} // namespace cp
@@ -0,0 +1,182 @@
+#include "common/pyramid.hpp"
+using namespace cp::PyramidConst;
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+namespace cp {
+
+// Average 2x2 blocks of two rows into one row of given width
+static void HalveRow(const uint8_t* top, const uint8_t* bottom, uint8_t* output, int width) {
+    int x = 0;
+
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint16x8_t low = vaddq_u16(vpaddlq_u8(vld1q_u8(top + x * 2)), vpaddlq_u8(vld1q_u8(bottom + x * 2)));
+        uint16x8_t high = vaddq_u16(vpaddlq_u8(vld1q_u8(top + x * 2 + 16)), vpaddlq_u8(vld1q_u8(bottom + x * 2 + 16)));
+        vst1q_u8(output + x, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+    }
+#elif defined(__SSE2__)
+    const __m128i evenMask = _mm_set1_epi16(0x00FF);
+    const __m128i rounding = _mm_set1_epi16(2);
+    auto sumPairs = [&evenMask](const uint8_t* pixels) {
+        __m128i vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+        return _mm_add_epi16(_mm_and_si128(vector, evenMask), _mm_srli_epi16(vector, 8));
+    };
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i low = _mm_add_epi16(sumPairs(top + x * 2), sumPairs(bottom + x * 2));
+        __m128i high = _mm_add_epi16(sumPairs(top + x * 2 + 16), sumPairs(bottom + x * 2 + 16));
+        low = _mm_srli_epi16(_mm_add_epi16(low, rounding), 2);
+        high = _mm_srli_epi16(_mm_add_epi16(high, rounding), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + x), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        output[x] = static_cast<uint8_t>((top[x * 2] + top[x * 2 + 1] + bottom[x * 2] + bottom[x * 2 + 1] + 2) >> 2);
+    }
+}
+
+/*
+*   Area filter weights of one axis: every output pixel covers a span of input pixels,
+*   the pixels at its edges are weighted by the part of them that is covered.
+*/
+struct Contribution {
+    int first = 0;
+    std::vector<float> weights;
+};
+
+static std::vector<Contribution> CalculateContributions(int inputSize, int outputSize) {
+    std::vector<Contribution> contributions(outputSize);
+    double scale = static_cast<double>(inputSize) / outputSize;
+    for (int index = 0; index < outputSize; ++index) {
+        double start = index * scale, end = (index + 1) * scale;
+        Contribution& contribution = contributions[index];
+        contribution.first = static_cast<int>(start);
+        int last = std::min(static_cast<int>(std::ceil(end)), inputSize);
+        for (int input = contribution.first; input < last; ++input) {
+            double covered = std::min<double>(end, input + 1) - std::max<double>(start, input);
+            contribution.weights.push_back(static_cast<float>(covered / scale));
+        }
+    }
+    return contributions;
+}
+
+const char* Pyramid::LevelName(Level level) {
+    switch (level) {
+        case Level::Half:
+            return "half";
+        case Level::Quarter:
+            return "quarter";
+        case Level::Eighth:
+            return "eighth";
+        case Level::Thumbnail:
+            return "thumbnail";
+        default:
+            return "unknown";
+    }
+}
+
+Image Pyramid::Halve(const Image& image) {
+    return Halve(image, FullRegion(image));
+}
+
+Image Pyramid::Halve(const Image& image, const Region& region) {
+    Image result(std::max(region.width / 2, 1), std::max(region.height / 2, 1), 1, image.spectrum());
+    if (region.width < 2 || region.height < 2) {
+        return image.get_crop(region.x, region.y, region.x + region.width - 1, region.y + region.height - 1)
+            .resize(result.width(), result.height(), 1, image.spectrum(), 2);
+    }
+
+    for (int channel = 0; channel < image.spectrum(); ++channel) {
+        for (int y = 0; y < result.height(); ++y) {
+            HalveRow(
+                image.data(region.x, region.y + y * 2, 0, channel),
+                image.data(region.x, region.y + y * 2 + 1, 0, channel),
+                result.data(0, y, 0, channel),
+                result.width()
+            );
+        }
+    }
+    return result;
+}
+
+Image Pyramid::Shrink(const Image& image, int width, int height) {
+    std::vector<Contribution> columns = CalculateContributions(image.width(), width);
+    std::vector<Contribution> rows = CalculateContributions(image.height(), height);
+
+    Image result(width, height, 1, image.spectrum());
+    std::vector<float> row(image.width());
+    for (int channel = 0; channel < image.spectrum(); ++channel) {
+        for (int y = 0; y < height; ++y) {
+            // Vertical pass into one row of full width, then horizontal pass into the result
+            std::fill(row.begin(), row.end(), 0.0f);
+            for (size_t index = 0; index < rows[y].weights.size(); ++index) {
+                const uint8_t* input = image.data(0, rows[y].first + static_cast<int>(index), 0, channel);
+                float weight = rows[y].weights[index];
+                for (int x = 0; x < image.width(); ++x) {
+                    row[x] += input[x] * weight;
+                }
+            }
+
+            uint8_t* output = result.data(0, y, 0, channel);
+            for (int x = 0; x < width; ++x) {
+                float value = 0.0f;
+                for (size_t index = 0; index < columns[x].weights.size(); ++index) {
+                    value += row[columns[x].first + index] * columns[x].weights[index];
+                }
+                output[x] = static_cast<uint8_t>(std::clamp(value + 0.5f, 0.0f, 255.0f));
+            }
+        }
+    }
+    return result;
+}
+
+Pyramid::Levels Pyramid::Build(const Image& image) {
+    return Build(image, FullRegion(image));
+}
+
+Pyramid::Levels Pyramid::Build(const Image& image, const Region& region) {
+    Levels levels;
+    levels[static_cast<size_t>(Level::Half)] = Halve(image, region);
+    levels[static_cast<size_t>(Level::Quarter)] = Halve(levels[static_cast<size_t>(Level::Half)]);
+    levels[static_cast<size_t>(Level::Eighth)] = Halve(levels[static_cast<size_t>(Level::Quarter)]);
+
+    // Thumbnail is shrunk from the smallest level that is still wider than it
+    const Image* source = nullptr;
+    for (size_t level = static_cast<size_t>(Level::Eighth) + 1; level-- > 0;) {
+        if (levels[level].width() >= ThumbnailWidth) {
+            source = &levels[level];
+            break;
+        }
+    }
+
+    // Region narrower than twice the thumbnail is small, so it's copied out of the frame
+    Image narrowRegion;
+    if (!source && region == FullRegion(image)) {
+        source = &image;
+    }
+    else if (!source) {
+        narrowRegion = image.get_crop(region.x, region.y, region.x + region.width - 1, region.y + region.height - 1);
+        source = &narrowRegion;
+    }
+
+    if (source->width() <= ThumbnailWidth) {
+        levels[static_cast<size_t>(Level::Thumbnail)] = *source;
+    }
+    else {
+        int height = std::max(static_cast<int>(std::lround(static_cast<double>(ThumbnailWidth) * source->height() / source->width())), 1);
+        levels[static_cast<size_t>(Level::Thumbnail)] = Shrink(*source, ThumbnailWidth, height);
+    }
+    return levels;
+}
+
+} // namespace cp
@@ -0,0 +1,175 @@
+#include "common/scene.hpp"
+using namespace cp::SceneConst;
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+namespace cp {
+
+// Luma of planar RGB row: (77 * R + 150 * G + 29 * B) / 256, the weights add up to 256 so it never overflows 16 bits
+static void LumaRow(const uint8_t* red, const uint8_t* green, const uint8_t* blue, uint8_t* output, int width) {
+    int x = 0;
+
+#if defined(__ARM_NEON)
+    const uint8x8_t redWeight = vdup_n_u8(77);
+    const uint8x8_t greenWeight = vdup_n_u8(150);
+    const uint8x8_t blueWeight = vdup_n_u8(29);
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t sum = vmull_u8(vld1_u8(red + x), redWeight);
+        sum = vmlal_u8(sum, vld1_u8(green + x), greenWeight);
+        sum = vmlal_u8(sum, vld1_u8(blue + x), blueWeight);
+        vst1_u8(output + x, vshrn_n_u16(sum, 8));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i redWeight = _mm_set1_epi16(77);
+    const __m128i greenWeight = _mm_set1_epi16(150);
+    const __m128i blueWeight = _mm_set1_epi16(29);
+    auto weigh = [&](__m128i redHalf, __m128i greenHalf, __m128i blueHalf) {
+        __m128i sum = _mm_mullo_epi16(redHalf, redWeight);
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(greenHalf, greenWeight));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(blueHalf, blueWeight));
+        return _mm_srli_epi16(sum, 8);
+    };
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i redVector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(red + x));
+        __m128i greenVector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(green + x));
+        __m128i blueVector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blue + x));
+        __m128i low = weigh(_mm_unpacklo_epi8(redVector, zero), _mm_unpacklo_epi8(greenVector, zero), _mm_unpacklo_epi8(blueVector, zero));
+        __m128i high = weigh(_mm_unpackhi_epi8(redVector, zero), _mm_unpackhi_epi8(greenVector, zero), _mm_unpackhi_epi8(blueVector, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + x), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        output[x] = static_cast<uint8_t>((77 * red[x] + 150 * green[x] + 29 * blue[x]) >> 8);
+    }
+}
+
+// Sum of a row of bytes
+static uint64_t SumRow(const uint8_t* row, int width) {
+    int x = 0;
+    uint64_t sum = 0;
+
+#if defined(__ARM_NEON)
+    uint32x4_t accumulator = vdupq_n_u32(0);
+    for (; x + 16 <= width; x += 16) {
+        accumulator = vpadalq_u16(accumulator, vpaddlq_u8(vld1q_u8(row + x)));
+    }
+    uint64x2_t pairs = vpaddlq_u32(accumulator);
+    sum = vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i accumulator = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        accumulator = _mm_add_epi64(accumulator, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), zero));
+    }
+    sum = static_cast<uint64_t>(_mm_cvtsi128_si32(accumulator)) + static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(accumulator, 8)));
+#endif
+
+    for (; x < width; ++x) {
+        sum += row[x];
+    }
+    return sum;
+}
+
+static double ToLinear(double value) {
+    value /= 255.0;
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+// McCamy's approximation from chromaticity of mean sRGB colour
+static float EstimateColorTemperature(double red, double green, double blue) {
+    double linearRed = ToLinear(red), linearGreen = ToLinear(green), linearBlue = ToLinear(blue);
+    double x = 0.4124 * linearRed + 0.3576 * linearGreen + 0.1805 * linearBlue;
+    double y = 0.2126 * linearRed + 0.7152 * linearGreen + 0.0722 * linearBlue;
+    double z = 0.0193 * linearRed + 0.1192 * linearGreen + 0.9505 * linearBlue;
+    double sum = x + y + z;
+    if (sum <= 0.0) {
+        return std::numeric_limits<float>::quiet_NaN();
+    }
+
+    double n = (x / sum - 0.3320) / (0.1858 - y / sum);
+    double temperature = 449.0 * n * n * n + 3525.0 * n * n + 6823.3 * n + 5520.33;
+    return static_cast<float>(std::clamp(temperature, 1000.0, 25000.0));
+}
+
+Image Scene::Luma(const Image& image, int height) {
+    Image luma(image.width(), height, 1, 1);
+    for (int y = 0; y < height; ++y) {
+        LumaRow(image.data(0, y, 0, 0), image.data(0, y, 0, 1), image.data(0, y, 0, 2), luma.data(0, y), image.width());
+    }
+    return luma;
+}
+
+Scene::Metrics Scene::Measure(const Image& image, int height) {
+    Metrics metrics;
+    height = std::min(height, image.height());
+    int width = image.width();
+    int skyHeight = static_cast<int>(std::lround(height * SkyShare));
+    if (image.spectrum() != 3 || width == 0 || skyHeight == 0) {
+        return metrics;
+    }
+
+    Image luma = Luma(image, height);
+    uint64_t channelSums[3] = {};
+    uint64_t skyLumaSum = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int channel = 0; channel < 3; ++channel) {
+            channelSums[channel] += SumRow(image.data(0, y, 0, channel), width);
+        }
+        if (y < skyHeight) {
+            skyLumaSum += SumRow(luma.data(0, y), width);
+        }
+    }
+
+    double pixels = static_cast<double>(width) * height;
+    metrics.skyLuma = static_cast<float>(skyLumaSum / (static_cast<double>(width) * skyHeight));
+    if (metrics.skyLuma < MinLuma) {
+        return metrics;
+    }
+    metrics.colorTemperature = EstimateColorTemperature(channelSums[0] / pixels, channelSums[1] / pixels, channelSums[2] / pixels);
+
+    // Sky block is cloudy if it's grey rather than blue, or if cloud edges make it uneven
+    int blockColumns = width / BlockSize, blockRows = skyHeight / BlockSize;
+    if (blockColumns == 0 || blockRows == 0) {
+        return metrics;
+    }
+
+    size_t cloudy = 0;
+    constexpr double BlockPixels = BlockSize * BlockSize;
+    for (int blockRow = 0; blockRow < blockRows; ++blockRow) {
+        for (int blockColumn = 0; blockColumn < blockColumns; ++blockColumn) {
+            uint64_t lumaSum = 0, lumaSquares = 0, redSum = 0, blueSum = 0;
+            for (int y = blockRow * BlockSize; y < (blockRow + 1) * BlockSize; ++y) {
+                int x = blockColumn * BlockSize;
+                const uint8_t* lumaRow = luma.data(x, y);
+                const uint8_t* red = image.data(x, y, 0, 0);
+                const uint8_t* blue = image.data(x, y, 0, 2);
+                for (int offset = 0; offset < BlockSize; ++offset) {
+                    lumaSum += lumaRow[offset];
+                    lumaSquares += lumaRow[offset] * lumaRow[offset];
+                    redSum += red[offset];
+                    blueSum += blue[offset];
+                }
+            }
+
+            double mean = lumaSum / BlockPixels;
+            double deviation = std::sqrt(std::max(lumaSquares / BlockPixels - mean * mean, 0.0));
+            bool grey = redSum > CloudRedBlueRatio * blueSum;
+            cloudy += (grey || deviation > CloudContrast);
+        }
+    }
+    metrics.cloudCover = static_cast<float>(cloudy) / (blockColumns * blockRows);
+    return metrics;
+}
+
+} // namespace cp
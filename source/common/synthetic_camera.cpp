@@ -0,0 +1,89 @@
+#include "common/synthetic_camera.hpp"
+using namespace cp::CameraConst;
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+#include <boost/date_time.hpp>
+namespace pt = boost::posix_time;
+
+namespace cp {
+
+// Small and fast generator, the noise only has to look like noise
+static uint32_t XorShift(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+SyntheticCamera::SyntheticCamera(const std::string& name, int width, int height)
+    : Camera(name)
+    , m_width(width)
+    , m_height(height)
+{}
+
+void SyntheticCamera::turnOn() {
+    std::lock_guard lock(m_mutex);
+    m_on = true;
+}
+
+void SyntheticCamera::turnOff() {
+    std::lock_guard lock(m_mutex);
+    m_on = false;
+}
+
+Camera::Image SyntheticCamera::render(int width, int height) {
+    std::unique_lock lock(m_mutex);
+    if (!m_on) {
+        throw std::invalid_argument("cp::SyntheticCamera::render(): Camera is not on");
+    }
+    uint64_t frame = m_frame++;
+    lock.unlock();
+
+    // Daylight follows time of day: dark at midnight, the brightest at noon
+    pt::time_duration time = pt::microsec_clock::local_time().time_of_day();
+    double dayShare = time.total_seconds() / 86400.0;
+    double daylight = 0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * dayShare);
+
+    int horizon = height * 2 / 3;
+    int sunRadius = std::max(height / 20, 1);
+    int sunX = static_cast<int>(dayShare * width);
+    int sunY = horizon - static_cast<int>(daylight * (horizon - sunRadius));
+
+    Image image(width, height, 1, 3);
+    uint32_t state = static_cast<uint32_t>(frame * 2654435761u) | 1;
+    for (int y = 0; y < height; ++y) {
+        double sky = (y < horizon) ? 0.6 + 0.4 * y / horizon : 0.35;
+        const double base[3] = {
+            daylight * ((y < horizon) ? 120 * sky : 90),
+            daylight * ((y < horizon) ? 170 * sky : 110),
+            daylight * ((y < horizon) ? 240 * sky : 60),
+        };
+
+        uint8_t* channels[3] = { image.data(0, y, 0, 0), image.data(0, y, 0, 1), image.data(0, y, 0, 2) };
+        int dy = y - sunY;
+        for (int x = 0; x < width; ++x) {
+            int dx = x - sunX;
+            bool sun = (dx * dx + dy * dy <= sunRadius * sunRadius) && daylight > 0.05;
+            int noise = static_cast<int>(XorShift(state) & 15) - 8;
+            for (int channel = 0; channel < 3; ++channel) {
+                int value = sun ? 255 : static_cast<int>(base[channel]) + noise;
+                channels[channel][x] = static_cast<uint8_t>(std::clamp(value, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+Camera::Image SyntheticCamera::capture() {
+    return render(m_width, m_height);
+}
+
+Camera::Image SyntheticCamera::preview() {
+    return render(PreviewWidth, std::max(PreviewWidth * m_height / m_width, 1));
+}
+
+} // namespace cp
@@ -0,0 +1,80 @@
+#include "common/text.hpp"
+
+#include <mutex>
+#include <stdexcept>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include "external/font.hpp"
+
+#include <fmt/format.h>
+
+namespace cp {
+
+static constexpr uint8_t BackgroundColor[] = { 0, 0, 0 };
+
+Image Text::Render(const std::u32string& string, uint32_t height) {
+    // FreeType library and face aren't thread-safe
+    static std::mutex mutex;
+    std::lock_guard lock(mutex);
+
+    static bool initialized = false;
+    static FT_Library library;
+    static FT_Face face;
+    if (!initialized) {
+        FT_Error result = FT_Init_FreeType(&library);
+        if (result) {
+            throw std::runtime_error(fmt::format("cp::Text::Render(): Couldn't initialize FreeType library [result: {}]", result));
+        }
+
+        result = FT_New_Memory_Face(library, Font::CascadiaCode.data(), static_cast<FT_Long>(Font::CascadiaCode.size()), 0, &face);
+        if (result) {
+            throw std::runtime_error(fmt::format("cp::Text::Render(): Couldn't create new memory face [result: {}]", result));
+        }
+        initialized = true;
+    }
+
+    FT_Error result = FT_Set_Pixel_Sizes(face, 0, height * face->height / (face->height - face->descender));
+    if (result) {
+        throw std::runtime_error(fmt::format("cp::Text::Render(): Couldn't set pixel sizes [result: {}]", result));
+    }
+    height = (face->size->metrics.height) / 64;
+
+    Image text;
+    int offset = 0;
+    for (char32_t character : string) {
+        FT_UInt characterIndex = FT_Get_Char_Index(face, static_cast<FT_ULong>(character));
+        if (!characterIndex) {
+            throw std::runtime_error(fmt::format("cp::Text::Render(): Couldn't get character index [character: {}]", static_cast<int>(character)));
+        }
+
+        result = FT_Load_Glyph(face, characterIndex, FT_LOAD_DEFAULT);
+        if (result) {
+            throw std::runtime_error(fmt::format("cp::Text::Render(): Couldn't load character glyph [result: {}]", result));
+        }
+
+        result = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+        if (result) {
+            throw std::runtime_error(fmt::format("cp::Text::Render(): Couldn't render character glyph [result: {}]", result));
+        }
+
+        int width = face->glyph->advance.x >> 6;
+        if (text.is_empty()) {
+            text.assign(width, height);
+            text.draw_rectangle(0, 0, text.width(), text.height(), BackgroundColor);
+        }
+        else {
+            text.crop(0, offset + width);
+            text.draw_rectangle(offset, 0, text.width(), text.height(), BackgroundColor);
+        }
+
+        Image bitmap(face->glyph->bitmap.buffer, face->glyph->bitmap.width, face->glyph->bitmap.rows);
+        text.draw_image(offset + face->glyph->bitmap_left, height - face->glyph->bitmap_top + (face->size->metrics.descender / 64), bitmap);
+        offset += width;
+    }
+
+    text.resize(text.width(), text.height(), 1, 3);
+    return text;
+}
+
+} // namespace cp
@@ -80,6 +80,16 @@ int Utility::ToUnixTimestamp(pt::ptime timestamp) {
     return static_cast<int>((timestamp - epoch).total_seconds());
 }
 
+int64_t Utility::ToUnixMicroseconds(pt::ptime timestamp) {
+    constexpr pt::ptime epoch(dt::date(1970, 1, 1));
+    return (timestamp - epoch).total_microseconds();
+}
+
+pt::ptime Utility::FromUnixMicroseconds(int64_t microseconds) {
+    constexpr pt::ptime epoch(dt::date(1970, 1, 1));
+    return epoch + pt::microseconds(microseconds);
+}
+
 bool Utility::IsDaylight(pt::ptime timestamp) {
     static dt::date date;
     static pt::ptime sunriseTimestamp, sunsetTimestamp;
@@ -295,11 +295,11 @@ void Display::Ui::showMessage(const Message& message) {
     }
 }
 
-void Display::Ui::updateNextEvent(Capture::Event* event) {
+void Display::Ui::updateNextEvent(const Capture::Event* event) {
     {
         std::lock_guard lock(m_mutex);
         if (event) {
-            m_nextEvent = std::make_unique<Capture::Event>(event->name(), event->shortName(), event->timestamp());
+            m_nextEvent = *event;
         }
         else {
             m_nextEvent.reset();
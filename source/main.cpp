@@ -1,6 +1,8 @@
 #include <filesystem>
 
+#include "capture/layout.hpp"
 #include "capture/master.hpp"
+#include "common/stopwatch.hpp"
 #include "common/utility.hpp"
 #include "common/config.hpp"
 #include "common/http_server.hpp"
@@ -11,6 +13,7 @@ struct ParseResult {
         None,       // Parsing error occured
         ShowHelp,   // Help message was requested
         Generate,   // Necessary files generation was requested
+        Migrate,    // Capture files migration to configured layout was requested
         Start,      // Normal Copaipy start was requested
     };
 
@@ -48,6 +51,11 @@ static ParseResult ParseOptions(int argc, char** argv) {
             continue;
         }
 
+        if (option == "-m" || option == "--migrate") {
+            result.result = ParseResult::Result::Migrate;
+            continue;
+        }
+
         fmt::print(
             "Unknown option: \"{}\"\n"
             "See {} --help\n",
@@ -71,6 +79,7 @@ static int ShowHelpMessage(const ParseResult& result) {
         "Unique options:\n"
         "    -h, --help\t\tShow this message and exit\n"
         "    -g, --generate\tGenerate necessary files and exit\n"
+        "    -m, --migrate\tMove existing captures to configured directory layout and exit\n"
         "Only one of the unique options may be passed at the same time. All others will be ignored.\n",
         result.executableName
     );
@@ -118,6 +127,32 @@ static bool CheckConfig(const ParseResult& result) {
     return false;
 }
 
+static int MigrateCaptures() {
+    spdlog::logger logger = Utility::CreateLogger("migrate");
+    Config::CaptureLayout layout = Config::Instance->captureLayout();
+    logger.info("Migrating captures to {} layout", layout == Config::CaptureLayout::Sharded ? "sharded" : "flat");
+
+    try {
+        Stopwatch stopwatch;
+        Capture::Layout::MigrationResult migrationResult = Capture::Layout::Migrate(layout, logger);
+        logger.info(
+            "Moved {} capture file{} in {:.1f}s, skipped {} other file{}",
+            migrationResult.moved, migrationResult.moved == 1 ? "" : "s", stopwatch.seconds(),
+            migrationResult.skipped, migrationResult.skipped == 1 ? "" : "s"
+        );
+
+        if (migrationResult.failed) {
+            logger.error("Couldn't move {} capture file{}", migrationResult.failed, migrationResult.failed == 1 ? "" : "s");
+            return 1;
+        }
+        return 0;
+    }
+    catch (const std::exception& error) {
+        logger.critical("Migration exception: \"{}\"", error.what());
+        return 1;
+    }
+}
+
 int main(int argc, char** argv) {
     ParseResult result = ParseOptions(argc, argv);
     switch (result.result) {
@@ -136,6 +171,10 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (result.result == ParseResult::Result::Migrate) {
+        return MigrateCaptures();
+    }
+
     fmt::print(
         "Welcome to Copaipy\n"
         "GitHub repository: https://github.com/KontraCity/Copaipy\n"
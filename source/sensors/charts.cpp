@@ -0,0 +1,160 @@
+#include "sensors/charts.hpp"
+using namespace cp::Sensors::ChartsConst;
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/xchar.h>
+
+#include "common/text.hpp"
+
+namespace cp {
+
+struct ChartSeries {
+    const char32_t* name;
+    const char32_t* unit;
+    uint8_t color[3];
+    double (*value)(const Sensors::Measurement& measurement);
+};
+
+static const ChartSeries TemperatureSeries = { U"Temperature", U"°C", { 255, 160, 64 }, [](const Sensors::Measurement& measurement) { return measurement.bmp280.temperature; } };
+static const ChartSeries AlternativeSeries = { U"Alternative temperature", U"°C", { 255, 220, 64 }, [](const Sensors::Measurement& measurement) { return measurement.aht20.temperature; } };
+static const ChartSeries HumiditySeries = { U"Humidity", U"%", { 64, 160, 255 }, [](const Sensors::Measurement& measurement) { return measurement.aht20.humidity; } };
+static const ChartSeries PressureSeries = { U"Pressure", U"hPa", { 96, 220, 96 }, [](const Sensors::Measurement& measurement) { return measurement.bmp280.pressure; } };
+
+constexpr uint8_t GridColor[] = { 48, 48, 48 };
+
+struct ChartPoint {
+    pt::ptime timestamp;
+    Sensors::Measurement measurement;
+};
+
+// Grid lines are at full hours, every 6 hours or at midnights, depending on the window
+static int GridStepHours(int hours) {
+    if (hours <= 24) {
+        return 1;
+    }
+    if (hours <= 72) {
+        return 6;
+    }
+    return 24;
+}
+
+static void DrawPanel(Image& chart, int top, int height, const ChartSeries& series, const std::vector<ChartPoint>& points, pt::ptime start, pt::ptime end, int hours) {
+    int plotLeft = Margin, plotRight = chart.width() - Margin;
+    int plotTop = top + 2 * Margin + TextSize, plotBottom = top + height - Margin;
+    double window = static_cast<double>((end - start).total_seconds());
+    auto toX = [&](pt::ptime timestamp) {
+        return plotLeft + static_cast<int>((plotRight - plotLeft) * ((timestamp - start).total_seconds() / window));
+    };
+
+    int step = GridStepHours(hours);
+    pt::ptime grid = pt::ptime(start.date()) + pt::hours((start.time_of_day().hours() / step + 1) * step);
+    for (; grid < end; grid += pt::hours(step)) {
+        chart.draw_line(toX(grid), plotTop, toX(grid), plotBottom, GridColor);
+    }
+    chart.draw_line(plotLeft, plotTop, plotRight, plotTop, GridColor);
+    chart.draw_line(plotLeft, plotBottom, plotRight, plotBottom, GridColor);
+
+    if (points.empty()) {
+        chart.draw_image(Margin, top + Margin, Text::Render(fmt::format(U"{}: no data", series.name), TextSize));
+        return;
+    }
+
+    auto [minimum, maximum] = std::minmax_element(points.begin(), points.end(), [&series](const ChartPoint& left, const ChartPoint& right) {
+        return series.value(left.measurement) < series.value(right.measurement);
+    });
+    double low = series.value(minimum->measurement), high = series.value(maximum->measurement);
+    chart.draw_image(Margin, top + Margin, Text::Render(fmt::format(U"{}: {:.1f} to {:.1f} {}", series.name, low, high, series.unit), TextSize));
+
+    // Flat series is drawn in the middle
+    double range = std::max(high - low, 0.1);
+    double middle = (low + high) / 2.0;
+    auto toY = [&](double value) {
+        return plotBottom - static_cast<int>((plotBottom - plotTop) * ((value - middle) / range + 0.5));
+    };
+
+    for (size_t index = 1; index < points.size(); ++index) {
+        const ChartPoint& previous = points[index - 1];
+        const ChartPoint& point = points[index];
+        if ((point.timestamp - previous.timestamp).total_seconds() > MaxGapMinutes * 60) {
+            continue;
+        }
+        chart.draw_line(toX(previous.timestamp), toY(series.value(previous.measurement)), toX(point.timestamp), toY(series.value(point.measurement)), series.color);
+    }
+}
+
+Sensors::Charts::Chart Sensors::Charts::get(Location location, int hours, Fields fields) {
+    if (hours < 1 || hours > MaxHours) {
+        throw std::invalid_argument(fmt::format(
+            "cp::Sensors::Charts::get(): "
+            "Window must be from 1 to {} hours [hours: {}]",
+            MaxHours, hours
+        ));
+    }
+
+    std::vector<const ChartSeries*> series;
+    if (fields.temperature) {
+        series.push_back(&TemperatureSeries);
+    }
+    if (fields.alternative) {
+        series.push_back(&AlternativeSeries);
+    }
+    if (fields.humidity) {
+        series.push_back(&HumiditySeries);
+    }
+    if (fields.pressure) {
+        series.push_back(&PressureSeries);
+    }
+    if (series.empty()) {
+        throw std::invalid_argument(
+            "cp::Sensors::Charts::get(): "
+            "No fields to chart"
+        );
+    }
+
+    // Charts are rendered under the lock, so concurrent requests of the same chart render it once
+    std::lock_guard lock(m_mutex);
+    std::vector<ChartPoint> points;
+    pt::ptime start, end;
+    uint64_t generation = 0;
+    {
+        Recorder::HistoryHandle handle = Recorder::Instance->historyHandle();
+        generation = handle.generation;
+        auto cached = m_charts.find({ location, hours, fields });
+        if (cached != m_charts.end() && cached->second.generation == generation) {
+            return cached->second;
+        }
+
+        const Recorder::History& history = handle.history;
+        end = history.timestamp(history.size() - 1);
+        start = end - pt::hours(hours);
+        for (size_t index = history.lowerBound(start); index < history.size(); ++index) {
+            if (history.valid(location, index)) {
+                Recorder::Record record = history[index];
+                points.push_back({ record.timestamp, *(location == Location::Internal ? record.internal : record.external) });
+            }
+        }
+    }
+
+    Image chart(Width, Height, 1, 3, 0);
+    int panelHeight = Height / static_cast<int>(series.size());
+    for (size_t index = 0; index < series.size(); ++index) {
+        DrawPanel(chart, static_cast<int>(index) * panelHeight, panelHeight, *series[index], points, start, end, hours);
+    }
+
+    // Charts of older history are never served again
+    std::erase_if(m_charts, [generation](const auto& item) { return item.second.generation != generation; });
+    if (m_charts.size() >= MaxCachedCharts) {
+        m_charts.erase(m_charts.begin());
+    }
+
+    Chart result = { std::make_shared<const Png::Buffer>(Png::Encode(chart)), generation };
+    m_charts[{ location, hours, fields }] = result;
+    return result;
+}
+
+} // namespace cp
@@ -1,6 +1,10 @@
 #include "sensors/recorder.hpp"
 using namespace cp::Sensors::RecorderConst;
 
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
 #include "common/utility.hpp"
 
 namespace cp {
@@ -34,8 +38,100 @@ Sensors::Recorder::Record Sensors::Recorder::Record::operator-(const Record& oth
     return result;
 }
 
+Sensors::Recorder::History::History(size_t capacity)
+    : m_capacity(capacity)
+    , m_timestamps(capacity)
+{
+    for (size_t location = 0; location < LocationsCount; ++location) {
+        for (std::vector<float>& column : m_columns[location]) {
+            column.resize(capacity, std::numeric_limits<float>::quiet_NaN());
+        }
+        m_valid[location].resize((capacity + 63) / 64);
+    }
+}
+
+void Sensors::Recorder::History::push(const Record& record) {
+    size_t slot = physical(m_size);
+    if (m_size == m_capacity) {
+        m_first = physical(1);
+    }
+    else {
+        ++m_size;
+    }
+
+    m_timestamps[slot] = Utility::ToUnixMicroseconds(record.timestamp);
+    for (size_t location = 0; location < LocationsCount; ++location) {
+        const std::optional<Measurement>& measurement = (static_cast<Location>(location) == Location::Internal ? record.internal : record.external);
+        auto& columns = m_columns[location];
+        uint64_t& valid = m_valid[location][slot / 64];
+        if (measurement) {
+            columns[static_cast<size_t>(Field::Temperature)][slot] = static_cast<float>(measurement->bmp280.temperature);
+            columns[static_cast<size_t>(Field::Alternative)][slot] = static_cast<float>(measurement->aht20.temperature);
+            columns[static_cast<size_t>(Field::Humidity)][slot] = static_cast<float>(measurement->aht20.humidity);
+            columns[static_cast<size_t>(Field::Pressure)][slot] = static_cast<float>(measurement->bmp280.pressure);
+            valid |= uint64_t(1) << (slot % 64);
+        }
+        else {
+            for (std::vector<float>& column : columns) {
+                column[slot] = std::numeric_limits<float>::quiet_NaN();
+            }
+            valid &= ~(uint64_t(1) << (slot % 64));
+        }
+    }
+}
+
+Sensors::Recorder::Record Sensors::Recorder::History::operator[](size_t index) const {
+    size_t slot = physical(index);
+    Record record;
+    record.timestamp = timestamp(index);
+    for (size_t location = 0; location < LocationsCount; ++location) {
+        if (!valid(static_cast<Location>(location), index)) {
+            continue;
+        }
+
+        // Values were rounded before they were narrowed, rounding again restores them exactly
+        const auto& columns = m_columns[location];
+        Measurement measurement;
+        measurement.bmp280.temperature = columns[static_cast<size_t>(Field::Temperature)][slot];
+        measurement.aht20.temperature = columns[static_cast<size_t>(Field::Alternative)][slot];
+        measurement.aht20.humidity = columns[static_cast<size_t>(Field::Humidity)][slot];
+        measurement.bmp280.pressure = columns[static_cast<size_t>(Field::Pressure)][slot];
+        measurement.round();
+        (static_cast<Location>(location) == Location::Internal ? record.internal : record.external).emplace(measurement);
+    }
+    return record;
+}
+
+size_t Sensors::Recorder::History::lowerBound(pt::ptime timestamp) const {
+    int64_t microseconds = Utility::ToUnixMicroseconds(timestamp);
+    Segments<int64_t> all = timestamps(0, m_size);
+    if (!all[1].empty() && all[1].front() < microseconds) {
+        return all[0].size() + (std::lower_bound(all[1].begin(), all[1].end(), microseconds) - all[1].begin());
+    }
+    return std::lower_bound(all[0].begin(), all[0].end(), microseconds) - all[0].begin();
+}
+
+template<typename T>
+Sensors::Recorder::History::Segments<T> Sensors::Recorder::History::segments(const std::vector<T>& column, size_t first, size_t count) const {
+    size_t start = physical(first);
+    size_t firstCount = std::min(count, m_capacity - start);
+    return {
+        std::span<const T>(column.data() + start, firstCount),
+        std::span<const T>(column.data(), count - firstCount)
+    };
+}
+
+Sensors::Recorder::History::Segments<int64_t> Sensors::Recorder::History::timestamps(size_t first, size_t count) const {
+    return segments(m_timestamps, first, count);
+}
+
+Sensors::Recorder::History::Segments<float> Sensors::Recorder::History::column(Location location, Field field, size_t first, size_t count) const {
+    return segments(m_columns[static_cast<size_t>(location)][static_cast<size_t>(field)], first, count);
+}
+
 Sensors::Recorder::Recorder()
     : m_logger(Utility::CreateLogger("recorder"))
+    , m_history(MaxHistorySize)
     , m_thread(&Recorder::recordFunction, this)
 {}
 
@@ -53,7 +149,9 @@ Sensors::Recorder::~Recorder() {
 
 void Sensors::Recorder::measure(Record& record, Location location) {
     try {
+        std::unique_lock busLock(m_busMutexes[static_cast<size_t>(location)]);
         Measurement measurement = Measure(location, MeasurementIterations);
+        busLock.unlock();
 
         std::lock_guard lock(m_mutex);
         if (location == Location::Internal) {
@@ -87,10 +185,8 @@ void Sensors::Recorder::recordFunction() {
         internalMeasurementThread.join();
         lock.lock();
 
-        m_history.push_back(record);
-        if (m_history.size() > MaxHistorySize) {
-            m_history.pop_front();
-        }
+        m_history.push(record);
+        ++m_generation;
         m_cv.notify_all();
 
         if (m_threadStatus == ThreadStatus::Stopped) {
@@ -115,7 +211,17 @@ void Sensors::Recorder::awaitHistory(std::unique_lock<std::mutex>& lock) {
 Sensors::Recorder::Record Sensors::Recorder::last() {
     std::unique_lock lock(m_mutex);
     awaitHistory(lock);
-    return *(m_history.end() - 1);
+    return m_history.back();
+}
+
+Sensors::Recorder::Record Sensors::Recorder::snapshot() {
+    Record record;
+    record.timestamp = pt::second_clock::local_time();
+    std::thread externalMeasurementThread(&Recorder::measure, this, std::ref(record), Location::External);
+    std::thread internalMeasurementThread(&Recorder::measure, this, std::ref(record), Location::Internal);
+    externalMeasurementThread.join();
+    internalMeasurementThread.join();
+    return record;
 }
 
 Sensors::Recorder::Record Sensors::Recorder::trend(int interval) {
@@ -125,15 +231,14 @@ Sensors::Recorder::Record Sensors::Recorder::trend(int interval) {
         interval = static_cast<int>(m_history.size()) - 1;
     }
 
-    const auto& current = m_history.end() - 1;
-    const auto& previous = current - interval;
-    return *current - *previous;
+    size_t current = m_history.size() - 1;
+    return m_history[current] - m_history[current - interval];
 }
 
 Sensors::Recorder::HistoryHandle Sensors::Recorder::historyHandle() {
     std::unique_lock lock(m_mutex);
     awaitHistory(lock);
-    return { std::move(lock), m_history };
+    return { std::move(lock), m_history, m_generation };
 }
 
 } // namespace cp